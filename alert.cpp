@@ -0,0 +1,200 @@
+// Serial output alerts
+//
+// See alert.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alert.h"
+#include "serial.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "mem.h"
+#include "ptable.h"
+#include "settings.h"
+
+static const char *ALERTS = "Alerts";
+static const DWORD DEFAULT_ALERT_INTERVAL = 30000;
+
+#define ALERT_MAX_STATES 65535
+
+static HWND g_hwnd = NULL;
+static UINT g_msg = 0;
+static uint64_t g_interval_ns = (uint64_t)DEFAULT_ALERT_INTERVAL * 1000000;
+static char **g_patterns = NULL;
+static int g_npatterns = 0;
+static uint8_t g_class[256];     // byte to class, 0 for bytes in no pattern
+static int g_nclass = 0;
+static uint16_t *g_delta = NULL; // next state, indexed state * g_nclass + class
+static int16_t *g_out = NULL;    // pattern matched on entering state, -1 none
+
+static uint8_t fold(uint8_t c) {
+	return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 'a' - 'A') : c;
+}
+
+static void unload() {
+	for(int i = 0; i < g_npatterns; i++) free(g_patterns[i]);
+	free(g_patterns);
+	free(g_delta);
+	free(g_out);
+	g_patterns = NULL;
+	g_npatterns = 0;
+	g_delta = NULL;
+	g_out = NULL;
+}
+
+static void add_pattern(const char *text, int max) {
+	// pattern numbers must fit the int16_t output table
+	if(!text[0] || g_npatterns >= max || g_npatterns >= 0x7FFF) return;
+	char *p = _strdup(text);
+	if(p) g_patterns[g_npatterns++] = p;
+}
+
+// settings_values callback, ctx is the capacity of g_patterns
+static void add_value(const char *name, const char *value, void *ctx) {
+	if(value) add_pattern(value, *(int *)ctx);
+}
+
+// Build the trie, then fill in failure transitions breadth first
+static bool build() {
+	memset(g_class, 0, sizeof(g_class));
+	g_nclass = 1;
+	size_t states = 1;
+	for(int i = 0; i < g_npatterns; i++) {
+		for(const uint8_t *c = (const uint8_t *)g_patterns[i]; *c; c++) {
+			if(!g_class[fold(*c)]) g_class[fold(*c)] = (uint8_t)g_nclass++;
+			states++;
+		}
+	}
+	for(int c = 0; c < 256; c++) g_class[c] = g_class[fold((uint8_t)c)];
+	if(states > ALERT_MAX_STATES) states = ALERT_MAX_STATES;
+
+	int nc = g_nclass;
+	g_delta = (uint16_t *)calloc(states * nc, sizeof(uint16_t));
+	g_out = (int16_t *)malloc(states * sizeof(int16_t));
+	uint16_t *fail = (uint16_t *)malloc(states * sizeof(uint16_t));
+	uint16_t *queue = (uint16_t *)malloc(states * sizeof(uint16_t));
+	if(!g_delta || !g_out || !fail || !queue) {
+		free(fail);
+		free(queue);
+		return false;
+	}
+	for(size_t s = 0; s < states; s++) g_out[s] = -1;
+
+	// 0 is the root, which is nobody's child, so it marks a missing edge
+	size_t n = 1;
+	for(int i = 0; i < g_npatterns; i++) {
+		size_t len = strlen(g_patterns[i]);
+		if(n + len > states) continue;
+		uint32_t st = 0;
+		for(size_t k = 0; k < len; k++) {
+			uint16_t *edge = &g_delta[st * nc + g_class[(uint8_t)g_patterns[i][k]]];
+			if(!*edge) *edge = (uint16_t)n++;
+			st = *edge;
+		}
+		if(g_out[st] < 0) g_out[st] = (int16_t)i;
+	}
+
+	size_t head = 0;
+	size_t tail = 0;
+	for(int c = 0; c < nc; c++) {
+		uint16_t child = g_delta[c];
+		if(child) {
+			fail[child] = 0;
+			queue[tail++] = child;
+		}
+	}
+	while(head < tail) {
+		uint16_t s = queue[head++];
+		for(int c = 0; c < nc; c++) {
+			uint16_t child = g_delta[s * nc + c];
+			// rows of shallower states are complete already
+			uint16_t f = g_delta[fail[s] * nc + c];
+			if(child) {
+				fail[child] = f;
+				if(g_out[child] < 0) g_out[child] = g_out[f];
+				queue[tail++] = child;
+			} else {
+				g_delta[s * nc + c] = f;
+			}
+		}
+	}
+	free(fail);
+	free(queue);
+	return true;
+}
+
+void alert_load(HWND hwnd, UINT msg) {
+	unload();
+	g_hwnd = hwnd;
+	g_msg = msg;
+	g_interval_ns = (uint64_t)settings_dword("", "AlertInterval", DEFAULT_ALERT_INTERVAL) * 1000000;
+
+	// a REG_MULTI_SZ value, or a repeated name in the file, gives a call per pattern
+	int max = (int)settings_values(ALERTS, NULL, NULL);
+	if(!max) return;
+	g_patterns = (char **)calloc(max, sizeof(char *));
+	if(!g_patterns) {
+		unload();
+		return;
+	}
+	settings_values(ALERTS, add_value, &max);
+	if(!g_npatterns || !build()) unload();
+}
+
+bool alert_active() {
+	return g_delta != NULL;
+}
+
+// Post a rate limited alert for the first of matches matches
+static void raise_alert(alert_stream_t *s, const char *device, int pattern, uint32_t matches) {
+	uint64_t now = evclock_now();
+	if(s->last_ns && now - s->last_ns < g_interval_ns) {
+		s->suppressed += matches;
+		return;
+	}
+	s->last_ns = now;
+	uint32_t more = s->suppressed + matches - 1;
+	s->suppressed = 0;
+	char port[32];
+	sname(device, port, sizeof(port));
+	char name[96] = "";
+	const ptable_t *t = ptable_enter();
+	for(uint32_t i = 0; t && i < t->count; i++) {
+		if(t->entries[i].connected && strcmp(t->entries[i].device, device) == 0) {
+			snprintf(name, sizeof(name), " (%s)", t->entries[i].name);
+			break;
+		}
+	}
+	ptable_leave();
+	char *text = (char *)mem_alloc(MEM_NOTIFY, 256);
+	if(!text) return;
+	if(more) {
+		snprintf(text, 256, "Alert on %s%s\n%s (+%lu more)", port, name, g_patterns[pattern], (unsigned long)more);
+	} else {
+		snprintf(text, 256, "Alert on %s%s\n%s", port, name, g_patterns[pattern]);
+	}
+	if(!PostMessage(g_hwnd, g_msg, 0, (LPARAM)text)) mem_free(text);
+	else metrics_count(M_ALERTS, 1);
+}
+
+void alert_feed(alert_stream_t *s, const char *device, const uint8_t *data, uint32_t len) {
+	if(!g_delta) return;
+	const uint16_t *delta = g_delta;
+	const int nc = g_nclass;
+	uint32_t st = s->state;
+	uint32_t matches = 0;
+	int first = -1;
+	for(uint32_t i = 0; i < len; i++) {
+		st = delta[st * nc + g_class[data[i]]];
+		if(g_out[st] >= 0) {
+			if(!matches) first = g_out[st];
+			matches++;
+		}
+	}
+	s->state = st;
+	if(matches) {
+		metrics_count(M_ALERT_MATCHES, matches);
+		raise_alert(s, device, first, matches);
+	}
+}
@@ -0,0 +1,40 @@
+// Serial output alerts
+//
+// Raises a notification when a captured port prints one of a set of
+// signatures ("PANIC", "assert failed", ...). Patterns are REG_SZ values
+// (one pattern each) or REG_MULTI_SZ values (one pattern per string)
+// under HKCU\Software\ComPortNotify\Alerts, matched ignoring ASCII case.
+//
+// All patterns are compiled into one Aho-Corasick automaton, flattened
+// to a table with a transition for every state and byte class, so
+// matching costs one lookup per byte and never backtracks. Each stream
+// keeps only its current state, matches spanning reads are found.
+//
+// Alerts are rate limited per stream: after one, further matches within
+// AlertInterval ms (DWORD under HKCU\Software\ComPortNotify, default
+// 30000) are only counted and mentioned with the next alert.
+
+#ifndef ALERT_H
+#define ALERT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <windows.h>
+
+typedef struct {
+	uint32_t state;
+	uint64_t last_ns;      // evclock time of the last alert raised
+	uint32_t suppressed;   // matches since then
+} alert_stream_t;
+
+// compile patterns, alerts are posted to hwnd as msg with a text in
+// lParam that the receiver releases with mem_free
+void alert_load(HWND hwnd, UINT msg);
+
+// true if any patterns are loaded
+bool alert_active();
+
+// scan data received from device
+void alert_feed(alert_stream_t *s, const char *device, const uint8_t *data, uint32_t len);
+
+#endif
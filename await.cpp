@@ -0,0 +1,200 @@
+// Awaiting device events
+//
+// See await.h
+
+#include <string.h>
+#include <windows.h>
+#include "await.h"
+#include "ptable.h"
+#include "serial.h"
+#include "evclock.h"
+
+#define AWAIT_BUCKETS 64
+
+static await_wait_t *g_index[AWAIT_BUCKETS];
+static await_wait_t *g_ready = NULL;
+static await_wait_t **g_ready_tail = &g_ready;
+static unsigned g_pending = 0;
+static twheel_t g_timeouts;   // ticks are milliseconds
+static HWND g_hwnd = NULL;
+static UINT_PTR g_timer_id = 0;
+
+static uint64_t now_tick() {
+	return evclock_now() / 1000000;
+}
+
+// FNV-1a of a port name, ignoring case
+static uint32_t port_hash(const char *device) {
+	uint32_t h = 2166136261u;
+	for(const char *p = device; *p; p++) {
+		char c = *p;
+		if(c >= 'a' && c <= 'z') c -= 'a' - 'A';
+		h = (h ^ (uint8_t)c) * 16777619u;
+	}
+	return h;
+}
+
+static uint32_t key_of(const await_wait_t *w) {
+	if(w->kind == AWAIT_REMOVAL) return port_hash(w->device);
+	return devid_hash(w->vid, w->pid, w->serial[0] ? w->serial : NULL);
+}
+
+static bool match_connect(const await_wait_t *w, const devid_t *id) {
+	if(w->kind != AWAIT_CONNECT || w->vid != id->vid || w->pid != id->pid) return false;
+	return !w->serial[0] || strcmp(w->serial, id->serial) == 0;
+}
+
+static void unlink_wait(await_wait_t *w) {
+	*w->pprev = w->next;
+	if(w->next) w->next->pprev = w->pprev;
+	w->next = NULL;
+	w->pprev = NULL;
+	g_pending--;
+}
+
+static void arm_timer() {
+	if(!g_hwnd) return;
+	if(g_ready) {
+		SetTimer(g_hwnd, g_timer_id, USER_TIMER_MINIMUM, NULL);
+		return;
+	}
+	uint64_t next = tw_next_tick(&g_timeouts);
+	if(next == UINT64_MAX) {
+		KillTimer(g_hwnd, g_timer_id);
+		return;
+	}
+	uint64_t now = now_tick();
+	UINT ms = next > now ? (UINT)(next - now) : USER_TIMER_MINIMUM;
+	SetTimer(g_hwnd, g_timer_id, ms, NULL);
+}
+
+// Take w out of the index and queue its completion
+static void complete(await_wait_t *w, int status, const char *device, const devid_t *id) {
+	unlink_wait(w);
+	tw_cancel(&g_timeouts, &w->timer);
+	w->result.status = status;
+	if(device) sname(device, w->result.port, sizeof(w->result.port));
+	if(id) w->result.id = *id;
+	w->ready_next = NULL;
+	*g_ready_tail = w;
+	g_ready_tail = &w->ready_next;
+}
+
+static void expire_wait(tw_node_t *n) {
+	await_wait_t *w = (await_wait_t *)n->ctx;
+	complete(w, AWAIT_TIMEOUT, NULL, NULL);
+}
+
+void await_load(HWND hwnd, UINT_PTR timer_id) {
+	g_hwnd = hwnd;
+	g_timer_id = timer_id;
+	tw_init(&g_timeouts, now_tick());
+}
+
+// Connected already according to the published port table
+static bool find_connected(await_wait_t *w) {
+	bool found = false;
+	const ptable_t *t = ptable_enter();
+	for(uint32_t i = 0; t && i < t->count; i++) {
+		const ptable_entry_t *e = &t->entries[i];
+		if(e->connected && match_connect(w, &e->id)) {
+			sname(e->device, w->result.port, sizeof(w->result.port));
+			w->result.id = e->id;
+			found = true;
+			break;
+		}
+	}
+	ptable_leave();
+	return found;
+}
+
+bool await_start(await_wait_t *w) {
+	memset(&w->result, 0, sizeof(w->result));
+	w->next = NULL;
+	w->pprev = NULL;
+	w->timer.next = NULL;
+	w->timer.prev = NULL;
+	if(w->kind == AWAIT_CONNECT && find_connected(w)) {
+		w->result.status = AWAIT_OK;
+		return false;
+	}
+	if(w->kind == AWAIT_REMOVAL) {
+		char port[AWAIT_PORT_MAX];
+		sname(w->device, port, sizeof(port));
+		strcpy(w->device, port);
+	}
+	await_wait_t **head = &g_index[key_of(w) & (AWAIT_BUCKETS - 1)];
+	w->next = *head;
+	if(w->next) w->next->pprev = &w->next;
+	w->pprev = head;
+	*head = w;
+	g_pending++;
+	if(w->timeout_ms) {
+		// bring the wheel up to date first, it does not tick while idle
+		uint64_t now = now_tick();
+		tw_advance(&g_timeouts, now, expire_wait);
+		tw_schedule(&g_timeouts, &w->timer, now + w->timeout_ms, w);
+		arm_timer();
+	}
+	return true;
+}
+
+void await_cancel(await_wait_t *w) {
+	if(w->pprev) {
+		unlink_wait(w);
+		tw_cancel(&g_timeouts, &w->timer);
+		return;
+	}
+	// completed but not dispatched yet
+	for(await_wait_t **pp = &g_ready; *pp; pp = &(*pp)->ready_next) {
+		if(*pp != w) continue;
+		*pp = w->ready_next;
+		if(g_ready_tail == &w->ready_next) g_ready_tail = pp;
+		break;
+	}
+}
+
+static void scan(uint32_t key, const char *device, const devid_t *id, bool removal) {
+	await_wait_t *w = g_index[key & (AWAIT_BUCKETS - 1)];
+	while(w) {
+		await_wait_t *next = w->next;
+		bool hit = removal ? (w->kind == AWAIT_REMOVAL && _stricmp(w->device, device) == 0) : match_connect(w, id);
+		if(hit) complete(w, AWAIT_OK, device, id);
+		w = next;
+	}
+}
+
+void await_connected(const char *device, const devid_t *id) {
+	if(!g_pending || (!id->vid && !id->pid)) return;
+	scan(devid_hash(id->vid, id->pid, id->serial), device, id, false);
+	// waits for any board with this VID:PID
+	if(id->serial[0]) scan(devid_hash(id->vid, id->pid, NULL), device, id, false);
+}
+
+void await_removed(const char *device, const devid_t *id) {
+	if(!g_pending) return;
+	char port[AWAIT_PORT_MAX];
+	sname(device, port, sizeof(port));
+	scan(port_hash(port), port, id, true);
+}
+
+void await_dispatch() {
+	while(g_ready) {
+		// unlink first, the callback may start a new wait with w or free it
+		await_wait_t *w = g_ready;
+		g_ready = w->ready_next;
+		if(!g_ready) g_ready_tail = &g_ready;
+		w->ready_next = NULL;
+		w->fp_done(w);
+	}
+	arm_timer();
+}
+
+void await_timer() {
+	tw_advance(&g_timeouts, now_tick(), expire_wait);
+	await_dispatch();
+}
+
+unsigned await_pending() {
+	return g_pending;
+}
@@ -0,0 +1,152 @@
+// Awaiting device events
+//
+// Code running on the event loop thread can wait for a device to connect
+// or for a port to be removed without a thread per wait and without
+// polling senum(). Each wait is an intrusive record in a hash index keyed
+// by what it waits for (VID:PID:serial, VID:PID or port name), so an event
+// only looks at the waits in its own bucket. Timeouts live in a timer
+// wheel and a window timer runs only while one is pending, idle waits
+// cost nothing.
+//
+// Ports are named as portshm and the DLL name them ("COM5"), device names
+// from senum() ("COM5:") are accepted too.
+//
+// Completions found while ports are being diffed are queued and run once
+// the diff is done, so callbacks (and resumed coroutines) always see a
+// consistent port list and may start new waits.
+//
+// With C++20 coroutines (-std=c++20) the same waits can be co_awaited:
+//
+//   await_task test() {
+//       await_result_t r = co_await wait_for_device(0x16c0, 0x0483, "12345", 5000);
+//       if(r.status != AWAIT_OK) co_return;
+//       r = co_await next_removal(r.port, 10000);
+//   }
+
+#ifndef AWAIT_H
+#define AWAIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <windows.h>
+#include "devid.h"
+#include "timerwheel.h"
+
+#define AWAIT_PORT_MAX 32
+
+enum {
+	AWAIT_CONNECT = 0,   // device connects (or is connected already)
+	AWAIT_REMOVAL        // port is removed
+};
+
+enum {
+	AWAIT_PENDING = 0,
+	AWAIT_OK,
+	AWAIT_TIMEOUT
+};
+
+typedef struct {
+	int status;
+	char port[AWAIT_PORT_MAX];   // port the device is on or was removed from
+	devid_t id;
+} await_result_t;
+
+typedef struct await_wait {
+	// filled by the caller
+	int kind;                         // AWAIT_CONNECT or AWAIT_REMOVAL
+	uint16_t vid;
+	uint16_t pid;
+	char serial[DEVID_SERIAL_MAX];    // AWAIT_CONNECT, empty matches any board
+	char device[AWAIT_PORT_MAX];      // AWAIT_REMOVAL, port to watch ("COM5")
+	uint32_t timeout_ms;              // 0 waits forever
+	void (*fp_done)(struct await_wait *w);
+	void *ctx;
+	await_result_t result;
+	// internal
+	struct await_wait *next;
+	struct await_wait **pprev;
+	struct await_wait *ready_next;
+	tw_node_t timer;
+} await_wait_t;
+
+// set up timeouts, the wheel is driven by window timer timer_id of hwnd
+void await_load(HWND hwnd, UINT_PTR timer_id);
+
+// start a wait, returns false if it completed at once (fp_done is not
+// called then), w must stay put until it completes or is cancelled
+bool await_start(await_wait_t *w);
+
+// withdraw a wait, harmless if it is not pending, fp_done is not called
+void await_cancel(await_wait_t *w);
+
+// event loop hooks, from the port diff
+void await_connected(const char *device, const devid_t *id);
+void await_removed(const char *device, const devid_t *id);
+
+// run queued completions, after the diff
+void await_dispatch();
+
+// window timer timer_id fired
+void await_timer();
+
+// number of pending waits
+unsigned await_pending();
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <stdlib.h>
+#include <string.h>
+
+// Awaitable for one wait, lives in the coroutine frame while suspended
+struct await_event {
+	await_wait_t w;
+
+	static void done(await_wait_t *w) {
+		std::coroutine_handle<>::from_address(w->ctx).resume();
+	}
+	bool await_ready() { return false; }
+	bool await_suspend(std::coroutine_handle<> h) {
+		w.fp_done = done;
+		w.ctx = h.address();
+		return await_start(&w);
+	}
+	await_result_t await_resume() { return w.result; }
+	// a coroutine destroyed while suspended withdraws its wait
+	~await_event() { await_cancel(&w); }
+};
+
+// wait until a matching device is connected, serial may be NULL for any
+inline await_event wait_for_device(uint16_t vid, uint16_t pid, const char *serial, uint32_t timeout_ms) {
+	await_event e;
+	memset(&e.w, 0, sizeof(e.w));
+	e.w.kind = AWAIT_CONNECT;
+	e.w.vid = vid;
+	e.w.pid = pid;
+	if(serial) strncpy(e.w.serial, serial, sizeof(e.w.serial) - 1);
+	e.w.timeout_ms = timeout_ms;
+	return e;
+}
+
+// wait until port is removed
+inline await_event next_removal(const char *port, uint32_t timeout_ms) {
+	await_event e;
+	memset(&e.w, 0, sizeof(e.w));
+	e.w.kind = AWAIT_REMOVAL;
+	strncpy(e.w.device, port, sizeof(e.w.device) - 1);
+	e.w.timeout_ms = timeout_ms;
+	return e;
+}
+
+// Fire and forget coroutine type, runs until its first wait right away
+struct await_task {
+	struct promise_type {
+		await_task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { abort(); }
+	};
+};
+#endif
+
+#endif
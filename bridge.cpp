@@ -0,0 +1,339 @@
+// Serial to socket bridge
+//
+// See bridge.h
+//
+// Port data is copied once out of the broker ring into a stack buffer
+// and sent from there (see broker_read for why). Socket data is received
+// into one buffer and written to the port from it. Windows has no splice,
+// so bytes pass through user memory either way.
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bridge.h"
+#include "serial.h"
+#include "broker.h"
+#include "profile.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "settings.h"
+
+static const char *BRIDGES = "Bridges";
+
+#define BRIDGE_BUF_SIZE 4096
+
+typedef struct {
+	char name[96];
+	char endpoint[MAX_PATH];
+} bridge_conf_t;
+
+typedef struct bridge {
+	char device[32];
+	char endpoint[MAX_PATH];
+	char fmt[64];
+	HANDLE stop;             // manual reset, set when the device goes away
+	SRWLOCK lock;            // guards client and sub
+	SOCKET client;
+	broker_t *broker;
+	broker_sub_t *sub;
+	volatile LONG closing;   // current client session is ending
+	uint64_t started_ns;
+	volatile LONG64 rx;      // port to socket bytes
+	volatile LONG64 tx;      // socket to port bytes
+	volatile LONG64 lat_sum_us;
+	volatile LONG64 lat_count;
+	volatile LONG64 lat_max_us;
+	struct bridge *next;
+} bridge_t;
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static bridge_t *g_bridges = NULL;
+static bridge_conf_t *g_conf = NULL;
+static int g_nconf = 0;
+
+static void bridge_report(FILE *f) {
+	uint64_t now = evclock_now();
+	AcquireSRWLockShared(&g_lock);
+	for(bridge_t *b = g_bridges; b; b = b->next) {
+		double secs = (double)(now - b->started_ns) / 1e9;
+		if(secs <= 0) secs = 1;
+		LONG64 n = b->lat_count;
+		fprintf(f, "bridge %s %s client=%d rx_bytes=%lld tx_bytes=%lld rx_Bps=%.0f tx_Bps=%.0f latency_avg_us=%lld latency_max_us=%lld\n",
+			b->device, b->endpoint, b->client != INVALID_SOCKET ? 1 : 0,
+			(long long)b->rx, (long long)b->tx, (double)b->rx / secs, (double)b->tx / secs,
+			(long long)(n ? b->lat_sum_us / n : 0), (long long)b->lat_max_us);
+	}
+	ReleaseSRWLockShared(&g_lock);
+}
+
+// settings_values callback, ctx is the capacity of g_conf
+static void add_conf(const char *name, const char *value, void *ctx) {
+	if(!value || g_nconf >= *(int *)ctx) return;
+	bridge_conf_t *c = &g_conf[g_nconf];
+	if(strlen(name) >= sizeof(c->name) || strlen(value) >= sizeof(c->endpoint)) return;
+	strcpy(c->name, name);
+	strcpy(c->endpoint, value);
+	g_nconf++;
+}
+
+void bridge_load() {
+	static bool started = false;
+	if(!started) {
+		WSADATA wsa;
+		if(WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return;
+		metrics_section(bridge_report);
+		started = true;
+	}
+	free(g_conf);
+	g_conf = NULL;
+	g_nconf = 0;
+	int count = (int)settings_values(BRIDGES, NULL, NULL);
+	if(!count) return;
+	g_conf = (bridge_conf_t *)calloc(count, sizeof(bridge_conf_t));
+	if(g_conf) settings_values(BRIDGES, add_conf, &count);
+}
+
+static SOCKET listen_on(const char *endpoint) {
+	SOCKET s = INVALID_SOCKET;
+	if(strncmp(endpoint, "unix:", 5) == 0) {
+		SOCKADDR_UN sa;
+		ZeroMemory(&sa, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, endpoint + 5, sizeof(sa.sun_path) - 1);
+		DeleteFileA(sa.sun_path); // stale socket file from an earlier run
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(s == INVALID_SOCKET) return s;
+		if(bind(s, (sockaddr *)&sa, sizeof(sa)) != 0 || listen(s, 1) != 0) {
+			closesocket(s);
+			return INVALID_SOCKET;
+		}
+		return s;
+	}
+	if(strncmp(endpoint, "tcp:", 4) != 0) return INVALID_SOCKET;
+	char addr[64] = "127.0.0.1";
+	const char *p = endpoint + 4;
+	const char *colon = strrchr(p, ':');
+	if(colon) {
+		size_t len = (size_t)(colon - p);
+		if(len >= sizeof(addr)) return INVALID_SOCKET;
+		memcpy(addr, p, len);
+		addr[len] = '\0';
+		p = colon + 1;
+	}
+	sockaddr_in sa;
+	ZeroMemory(&sa, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons((u_short)atoi(p));
+	if(inet_pton(AF_INET, addr, &sa.sin_addr) != 1) return INVALID_SOCKET;
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(s == INVALID_SOCKET) return s;
+	if(bind(s, (sockaddr *)&sa, sizeof(sa)) != 0 || listen(s, 1) != 0) {
+		closesocket(s);
+		return INVALID_SOCKET;
+	}
+	return s;
+}
+
+// End the current client session from any thread
+static void end_session(bridge_t *b) {
+	InterlockedExchange(&b->closing, 1);
+	AcquireSRWLockShared(&b->lock);
+	if(b->client != INVALID_SOCKET) shutdown(b->client, SD_BOTH);
+	if(b->sub) broker_wake(b->sub);
+	ReleaseSRWLockShared(&b->lock);
+}
+
+// Port to socket direction
+static DWORD WINAPI port_to_socket(LPVOID param) {
+	bridge_t *b = (bridge_t *)param;
+	uint8_t data[BRIDGE_BUF_SIZE];
+	while(!b->closing) {
+		int32_t n = broker_read(b->sub, data, sizeof(data), INFINITE);
+		if(n < 0) break;
+		if(n == 0) continue;
+		uint64_t t0 = evclock_now();
+		int off = 0;
+		while(off < n) {
+			int sent = send(b->client, (const char *)data + off, n - off, 0);
+			if(sent <= 0) break;
+			off += sent;
+		}
+		if(off < n) break;
+		int64_t us = (int64_t)((evclock_now() - t0) / 1000);
+		metrics_record(H_BRIDGE, (uint64_t)us);
+		InterlockedAdd64(&b->rx, n);
+		InterlockedAdd64(&b->lat_sum_us, us);
+		InterlockedIncrement64(&b->lat_count);
+		if(us > b->lat_max_us) InterlockedExchange64(&b->lat_max_us, us);
+	}
+	end_session(b);
+	return 0;
+}
+
+// Serve one client, socket to port direction runs on this thread
+static void serve(bridge_t *b, SOCKET c) {
+	broker_t *broker = NULL;
+	for(int i = 0; i < 20 && WaitForSingleObject(b->stop, 0) != WAIT_OBJECT_0; i++) {
+		broker = broker_acquire(b->device, b->fmt);
+		if(broker) break;
+		Sleep(50);
+	}
+	// an interactive client wants what the device says now, not a backlog
+	broker_sub_t *sub = broker ? broker_subscribe(broker, BROKER_LAG_LATEST) : NULL;
+	if(!sub) {
+		if(broker) broker_release(broker);
+		closesocket(c);
+		return;
+	}
+	BOOL one = TRUE;
+	setsockopt(c, IPPROTO_TCP, TCP_NODELAY, (const char *)&one, sizeof(one));
+	AcquireSRWLockExclusive(&b->lock);
+	b->client = c;
+	b->broker = broker;
+	b->sub = sub;
+	b->closing = 0;
+	ReleaseSRWLockExclusive(&b->lock);
+	metrics_count(M_BRIDGE_CLIENTS, 1);
+
+	HANDLE reader = CreateThread(NULL, 64 * 1024, port_to_socket, b, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	char *buf = reader ? (char *)malloc(BRIDGE_BUF_SIZE) : NULL;
+	while(buf && !b->closing) {
+		int n = recv(c, buf, BRIDGE_BUF_SIZE, 0);
+		if(n <= 0) break;
+		if(broker_write(broker, buf, (uint16_t)n) < 0) break;
+		InterlockedAdd64(&b->tx, n);
+	}
+	free(buf);
+	end_session(b);
+	if(reader) {
+		WaitForSingleObject(reader, INFINITE);
+		CloseHandle(reader);
+	}
+	AcquireSRWLockExclusive(&b->lock);
+	b->client = INVALID_SOCKET;
+	b->broker = NULL;
+	b->sub = NULL;
+	ReleaseSRWLockExclusive(&b->lock);
+	closesocket(c);
+	broker_unsubscribe(sub);
+	broker_release(broker);
+}
+
+static DWORD WINAPI bridge_thread(LPVOID param) {
+	bridge_t *b = (bridge_t *)param;
+	SOCKET ls = listen_on(b->endpoint);
+	// the bridge of a previous connection may still be letting go of the endpoint
+	for(int i = 0; i < 20 && ls == INVALID_SOCKET && WaitForSingleObject(b->stop, 50) == WAIT_TIMEOUT; i++) {
+		ls = listen_on(b->endpoint);
+	}
+	WSAEVENT ev = WSACreateEvent();
+	if(ls != INVALID_SOCKET && ev != WSA_INVALID_EVENT && WSAEventSelect(ls, ev, FD_ACCEPT) == 0) {
+		HANDLE waits[2] = { b->stop, ev };
+		while(WaitForMultipleObjects(2, waits, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+			WSAResetEvent(ev);
+			SOCKET c = accept(ls, NULL, NULL);
+			if(c == INVALID_SOCKET) continue;
+			// accepted sockets inherit the event selection, make this one plain blocking
+			WSAEventSelect(c, NULL, 0);
+			u_long nonblocking = 0;
+			ioctlsocket(c, FIONBIO, &nonblocking);
+			serve(b, c);
+		}
+	}
+	if(ev != WSA_INVALID_EVENT) WSACloseEvent(ev);
+	if(ls != INVALID_SOCKET) closesocket(ls);
+	if(strncmp(b->endpoint, "unix:", 5) == 0) DeleteFileA(b->endpoint + 5);
+
+	AcquireSRWLockExclusive(&g_lock);
+	for(bridge_t **pp = &g_bridges; *pp; pp = &(*pp)->next) {
+		if(*pp == b) {
+			*pp = b->next;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	CloseHandle(b->stop);
+	free(b);
+	return 0;
+}
+
+// Configured endpoint for a device, most specific name first
+static const char *find_endpoint(const char *device, const devid_t *id) {
+	char names[3][96];
+	snprintf(names[0], sizeof(names[0]), "%04x:%04x:%s", id->vid, id->pid, id->serial);
+	snprintf(names[1], sizeof(names[1]), "%04x:%04x", id->vid, id->pid);
+	sname(device, names[2], sizeof(names[2]));
+	for(int n = id->serial[0] ? 0 : 1; n < 3; n++) {
+		if(n < 2 && !id->vid && !id->pid) continue;
+		for(int i = 0; i < g_nconf; i++) {
+			if(_stricmp(g_conf[i].name, names[n]) == 0) return g_conf[i].endpoint;
+		}
+	}
+	return NULL;
+}
+
+void bridge_start(const char *device, const devid_t *id) {
+	if(!g_nconf) return;
+	const char *endpoint = find_endpoint(device, id);
+	if(!endpoint) return;
+	bridge_t *b = (bridge_t *)calloc(1, sizeof(bridge_t));
+	if(!b) return;
+	strncpy(b->device, device, sizeof(b->device) - 1);
+	strncpy(b->endpoint, endpoint, sizeof(b->endpoint) - 1);
+	profile_format(id, b->fmt, sizeof(b->fmt));
+	InitializeSRWLock(&b->lock);
+	b->client = INVALID_SOCKET;
+	b->started_ns = evclock_now();
+	b->stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(!b->stop) {
+		free(b);
+		return;
+	}
+	AcquireSRWLockExclusive(&g_lock);
+	bridge_t *cur = g_bridges;
+	while(cur && strcmp(cur->device, device) != 0) cur = cur->next;
+	if(!cur) {
+		b->next = g_bridges;
+		g_bridges = b;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	if(cur) {
+		// already bridged
+		CloseHandle(b->stop);
+		free(b);
+		return;
+	}
+	HANDLE h = CreateThread(NULL, 64 * 1024, bridge_thread, b, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	if(!h) {
+		AcquireSRWLockExclusive(&g_lock);
+		for(bridge_t **pp = &g_bridges; *pp; pp = &(*pp)->next) {
+			if(*pp == b) {
+				*pp = b->next;
+				break;
+			}
+		}
+		ReleaseSRWLockExclusive(&g_lock);
+		CloseHandle(b->stop);
+		free(b);
+		return;
+	}
+	CloseHandle(h);
+}
+
+void bridge_stop(const char *device) {
+	AcquireSRWLockExclusive(&g_lock);
+	for(bridge_t **pp = &g_bridges; *pp; pp = &(*pp)->next) {
+		bridge_t *b = *pp;
+		if(strcmp(b->device, device) == 0) {
+			*pp = b->next;
+			SetEvent(b->stop);
+			end_session(b);
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+}
@@ -0,0 +1,34 @@
+// Serial to socket bridge
+//
+// Exposes selected ports on a TCP or AF_UNIX socket, ser2net style. A
+// bridge listens while its device is connected and goes away when it is
+// removed. One client at a time, the port is opened through the port
+// broker (see broker.h) when a client connects and let go when it leaves.
+//
+// Bridges are REG_SZ values under HKCU\Software\ComPortNotify\Bridges,
+// named after the device identity ("<vid>:<pid>:<serial>", "<vid>:<pid>")
+// or the port ("COM5"):
+//
+//   tcp:<port>             listen on 127.0.0.1
+//   tcp:<address>:<port>   listen on address (0.0.0.0 for all)
+//   unix:<path>            listen on an AF_UNIX socket
+//
+// The serial format comes from the device profile (see profile.h).
+// Per-bridge byte counts, throughput and forwarding latency are written
+// to the metrics snapshot.
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+#include "devid.h"
+
+// initialize sockets and read bridge configuration
+void bridge_load();
+
+// start a bridge for device if one is configured
+void bridge_start(const char *device, const devid_t *id);
+
+// stop the bridge of device, dropping its client
+void bridge_stop(const char *device);
+
+#endif
@@ -0,0 +1,558 @@
+// Port broker
+//
+// See broker.h
+//
+// Ring positions are absolute byte counts. The reader thread announces
+// the region it is about to read into (limit) before the read and
+// publishes it (head) after, so everything from limit - ring size up to
+// head is valid. A subscriber below that has been lapped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "broker.h"
+#include "serial.h"
+#include "profile.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "settings.h"
+
+static const char *BROKERS = "Brokers";
+static const DWORD DEFAULT_RING_SIZE = 256 * 1024;
+static const DWORD MIN_RING_SIZE = 4096;
+
+#define BROKER_READ_SIZE 4096
+#define BROKER_WAIT_MS   100
+
+struct broker_sub {
+	broker_t *b;
+	uint64_t pos;            // next byte to read, only touched by the owner
+	int policy;
+	volatile uint64_t dropped;
+	volatile LONG woken;
+	struct broker_sub *next;
+};
+
+struct broker {
+	char device[32];
+	sport_t *port;
+	LONG refs;               // guarded by g_lock
+	HANDLE thread;
+	volatile LONG stop;
+	SRWLOCK lock;            // guards head, limit, dead and subs
+	CONDITION_VARIABLE data;
+	SRWLOCK wlock;           // one writer at a time
+	uint8_t *ring;
+	uint32_t size;           // power of two
+	uint64_t head;           // bytes published
+	uint64_t limit;          // end of the region being read into
+	bool dead;               // port went away
+	uint64_t started_ns;
+	broker_sub_t *subs;
+	struct broker *next;
+};
+
+typedef struct {
+	char name[96];
+} broker_conf_t;
+
+// Named pipe client, owned by the exposure thread
+typedef struct pipe_client {
+	broker_t *broker;
+	broker_sub_t *sub;
+	HANDLE pipe;
+	HANDLE thread;
+	volatile LONG closing;
+	struct pipe_client *next;
+} pipe_client_t;
+
+typedef struct exposure {
+	char device[32];
+	char fmt[64];
+	char pipe[64];
+	HANDLE stop;             // manual reset, set when the device goes away
+	pipe_client_t *clients;
+	struct exposure *next;
+} exposure_t;
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static broker_t *g_brokers = NULL;
+static exposure_t *g_exposed = NULL;
+static broker_conf_t *g_conf = NULL;
+static int g_nconf = 0;
+static DWORD g_ring_size = DEFAULT_RING_SIZE;
+
+static void broker_report(FILE *f) {
+	uint64_t now = evclock_now();
+	AcquireSRWLockShared(&g_lock);
+	for(broker_t *b = g_brokers; b; b = b->next) {
+		int subs = 0;
+		uint64_t dropped = 0;
+		AcquireSRWLockShared(&b->lock);
+		uint64_t bytes = b->head;
+		for(broker_sub_t *s = b->subs; s; s = s->next) {
+			subs++;
+			dropped += s->dropped;
+		}
+		ReleaseSRWLockShared(&b->lock);
+		double secs = (double)(now - b->started_ns) / 1e9;
+		if(secs <= 0) secs = 1;
+		fprintf(f, "broker %s subscribers=%d bytes=%llu Bps=%.0f dropped_bytes=%llu\n",
+			b->device, subs, (unsigned long long)bytes, (double)bytes / secs, (unsigned long long)dropped);
+	}
+	ReleaseSRWLockShared(&g_lock);
+}
+
+// settings_values callback, ctx is the capacity of g_conf, only names matter
+static void add_conf(const char *name, const char *value, void *ctx) {
+	if(g_nconf >= *(int *)ctx || strlen(name) >= sizeof(g_conf[g_nconf].name)) return;
+	strcpy(g_conf[g_nconf].name, name);
+	g_nconf++;
+}
+
+void broker_load() {
+	static bool started = false;
+	if(!started) {
+		metrics_section(broker_report);
+		started = true;
+	}
+	g_ring_size = DEFAULT_RING_SIZE;
+	DWORD value = settings_dword("", "BrokerRingSize", 0);
+	if(value) {
+		// round down to a power of two
+		while(value & (value - 1)) value &= value - 1;
+		g_ring_size = value < MIN_RING_SIZE ? MIN_RING_SIZE : value;
+	}
+
+	free(g_conf);
+	g_conf = NULL;
+	g_nconf = 0;
+	int count = (int)settings_values(BROKERS, NULL, NULL);
+	if(!count) return;
+	g_conf = (broker_conf_t *)calloc(count, sizeof(broker_conf_t));
+	if(g_conf) settings_values(BROKERS, add_conf, &count);
+}
+
+static void unlink_broker(broker_t *b) {
+	for(broker_t **pp = &g_brokers; *pp; pp = &(*pp)->next) {
+		if(*pp == b) {
+			*pp = b->next;
+			break;
+		}
+	}
+}
+
+static DWORD WINAPI reader_thread(LPVOID param) {
+	broker_t *b = (broker_t *)param;
+	uint32_t mask = b->size - 1;
+	while(!b->stop) {
+		// head is only written here, no lock needed to read it
+		uint32_t off = (uint32_t)(b->head & mask);
+		uint32_t chunk = b->size - off;
+		if(chunk > BROKER_READ_SIZE) chunk = BROKER_READ_SIZE;
+		AcquireSRWLockExclusive(&b->lock);
+		b->limit = b->head + chunk;
+		ReleaseSRWLockExclusive(&b->lock);
+		int32_t n = sread_port(b->port, b->ring + off, (uint16_t)chunk);
+		if(n < 0) break;
+		AcquireSRWLockExclusive(&b->lock);
+		b->head += (uint32_t)n;
+		b->limit = b->head;
+		ReleaseSRWLockExclusive(&b->lock);
+		if(n) WakeAllConditionVariable(&b->data);
+	}
+	AcquireSRWLockExclusive(&b->lock);
+	b->dead = true;
+	ReleaseSRWLockExclusive(&b->lock);
+	WakeAllConditionVariable(&b->data);
+	// later users get a fresh broker once the device is back
+	AcquireSRWLockExclusive(&g_lock);
+	unlink_broker(b);
+	ReleaseSRWLockExclusive(&g_lock);
+	return 0;
+}
+
+broker_t *broker_acquire(const char *device, const char *fmt) {
+	AcquireSRWLockExclusive(&g_lock);
+	broker_t *b = g_brokers;
+	// a dead broker is on its way out, its device may be back already
+	while(b && (b->dead || strcmp(b->device, device) != 0)) b = b->next;
+	if(b) b->refs++;
+	ReleaseSRWLockExclusive(&g_lock);
+	if(b) return b;
+
+	// the handle is exclusive, so nobody can link a broker for device
+	// between here and the insert below
+	sport_t *port = sopen_port(device);
+	if(!port) return NULL;
+	// read once, a settings reload may change it meanwhile
+	DWORD size = g_ring_size;
+	b = (broker_t *)calloc(1, sizeof(broker_t));
+	if(b) b->ring = (uint8_t *)malloc(size);
+	if(!b || !b->ring || !sconfig_port(port, fmt) || !swait_port(port, BROKER_WAIT_MS)) {
+		if(b) free(b->ring);
+		free(b);
+		sclose_port(port);
+		return NULL;
+	}
+	strncpy(b->device, device, sizeof(b->device) - 1);
+	b->port = port;
+	b->refs = 1;
+	b->size = size;
+	b->started_ns = evclock_now();
+	InitializeSRWLock(&b->lock);
+	InitializeSRWLock(&b->wlock);
+	InitializeConditionVariable(&b->data);
+	b->thread = CreateThread(NULL, 64 * 1024, reader_thread, b, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	if(!b->thread) {
+		sclose_port(port);
+		free(b->ring);
+		free(b);
+		return NULL;
+	}
+	AcquireSRWLockExclusive(&g_lock);
+	b->next = g_brokers;
+	g_brokers = b;
+	ReleaseSRWLockExclusive(&g_lock);
+	return b;
+}
+
+void broker_release(broker_t *b) {
+	AcquireSRWLockExclusive(&g_lock);
+	bool last = --b->refs == 0;
+	if(last) unlink_broker(b);
+	ReleaseSRWLockExclusive(&g_lock);
+	if(!last) return;
+	InterlockedExchange(&b->stop, 1);
+	scancel_port(b->port);
+	WaitForSingleObject(b->thread, INFINITE);
+	CloseHandle(b->thread);
+	sclose_port(b->port);
+	free(b->ring);
+	free(b);
+}
+
+broker_sub_t *broker_subscribe(broker_t *b, int lag_policy) {
+	broker_sub_t *s = (broker_sub_t *)calloc(1, sizeof(broker_sub_t));
+	if(!s) return NULL;
+	s->b = b;
+	s->policy = lag_policy;
+	AcquireSRWLockExclusive(&b->lock);
+	s->pos = b->head;
+	s->next = b->subs;
+	b->subs = s;
+	ReleaseSRWLockExclusive(&b->lock);
+	return s;
+}
+
+void broker_unsubscribe(broker_sub_t *s) {
+	broker_t *b = s->b;
+	AcquireSRWLockExclusive(&b->lock);
+	for(broker_sub_t **pp = &b->subs; *pp; pp = &(*pp)->next) {
+		if(*pp == s) {
+			*pp = s->next;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&b->lock);
+	free(s);
+}
+
+static void lost(broker_sub_t *s, uint64_t n) {
+	s->dropped += n;
+	metrics_count(M_BROKER_DROPPED, n);
+}
+
+// Wait for input, point data at it in the ring
+static int32_t peek(broker_sub_t *s, const uint8_t **data, uint32_t ms) {
+	broker_t *b = s->b;
+	AcquireSRWLockShared(&b->lock);
+	if(s->pos == b->head && !b->dead && !s->woken) {
+		SleepConditionVariableSRW(&b->data, &b->lock, ms, CONDITION_VARIABLE_LOCKMODE_SHARED);
+	}
+	uint64_t head = b->head;
+	uint64_t lowest = b->limit > b->size ? b->limit - b->size : 0;
+	bool dead = b->dead;
+	ReleaseSRWLockShared(&b->lock);
+	InterlockedExchange(&s->woken, 0);
+
+	if(s->pos < lowest) {
+		uint64_t to = s->policy == BROKER_LAG_LATEST ? head : lowest;
+		lost(s, to - s->pos);
+		s->pos = to;
+	}
+	uint64_t avail = head - s->pos;
+	if(!avail) return dead ? -1 : 0;
+	uint32_t off = (uint32_t)(s->pos & (b->size - 1));
+	if(avail > b->size - off) avail = b->size - off;
+	*data = b->ring + off;
+	return (int32_t)avail;
+}
+
+// Release n bytes returned by peek, false if the ring overwrote them meanwhile
+static bool consume(broker_sub_t *s, uint32_t n) {
+	broker_t *b = s->b;
+	AcquireSRWLockShared(&b->lock);
+	uint64_t lowest = b->limit > b->size ? b->limit - b->size : 0;
+	ReleaseSRWLockShared(&b->lock);
+	bool ok = s->pos >= lowest;
+	if(!ok) lost(s, n);
+	s->pos += n;
+	return ok;
+}
+
+int32_t broker_read(broker_sub_t *s, uint8_t *buf, uint32_t len, uint32_t ms) {
+	const uint8_t *data;
+	int32_t n = peek(s, &data, ms);
+	if(n <= 0) return n;
+	if((uint32_t)n > len) n = (int32_t)len;
+	memcpy(buf, data, (size_t)n);
+	return consume(s, (uint32_t)n) ? n : 0;
+}
+
+uint64_t broker_dropped(const broker_sub_t *s) {
+	return s->dropped;
+}
+
+void broker_wake(broker_sub_t *s) {
+	broker_t *b = s->b;
+	InterlockedExchange(&s->woken, 1);
+	// taking the lock orders this after a peek that is about to sleep
+	AcquireSRWLockExclusive(&b->lock);
+	ReleaseSRWLockExclusive(&b->lock);
+	WakeAllConditionVariable(&b->data);
+}
+
+int32_t broker_write(broker_t *b, const void *data, uint16_t len) {
+	if(b->dead) return -1;
+	uint16_t off = 0;
+	AcquireSRWLockExclusive(&b->wlock);
+	while(off < len) {
+		int32_t n = swrite_port(b->port, (const uint8_t *)data + off, (uint16_t)(len - off));
+		if(n <= 0) break;
+		off += (uint16_t)n;
+	}
+	ReleaseSRWLockExclusive(&b->wlock);
+	return off < len ? -1 : (int32_t)len;
+}
+
+int32_t broker_lines(broker_t *b) {
+	return slines_port(b->port);
+}
+
+int32_t broker_wait_lines(broker_t *b, uint32_t *lines, uint32_t *changed) {
+	if(b->dead) return -1;
+	return swait_lines_port(b->port, lines, changed);
+}
+
+void broker_cancel_lines(broker_t *b) {
+	scancel_lines_port(b->port);
+}
+
+// Overlapped read or write on a pipe, waiting for completion
+static int32_t pipe_io(HANDLE pipe, HANDLE ev, void *buf, DWORD len, bool write) {
+	OVERLAPPED ov;
+	ZeroMemory(&ov, sizeof(ov));
+	ov.hEvent = ev;
+	BOOL ok = write ? WriteFile(pipe, buf, len, NULL, &ov) : ReadFile(pipe, buf, len, NULL, &ov);
+	if(!ok && GetLastError() != ERROR_IO_PENDING) return -1;
+	DWORD n = 0;
+	if(!GetOverlappedResult(pipe, &ov, &n, TRUE)) return -1;
+	return (int32_t)n;
+}
+
+// End a pipe client session from any thread
+static void end_client(pipe_client_t *c) {
+	InterlockedExchange(&c->closing, 1);
+	CancelIoEx(c->pipe, NULL);
+	broker_wake(c->sub);
+}
+
+// Port to pipe direction
+static DWORD WINAPI ring_to_pipe(LPVOID param) {
+	pipe_client_t *c = (pipe_client_t *)param;
+	HANDLE ev = CreateEvent(NULL, TRUE, FALSE, NULL);
+	uint8_t buf[BROKER_READ_SIZE];
+	while(ev && !c->closing) {
+		int32_t n = broker_read(c->sub, buf, sizeof(buf), INFINITE);
+		if(n < 0) break;
+		if(n == 0) continue;
+		if(pipe_io(c->pipe, ev, buf, (DWORD)n, true) != n) break;
+	}
+	if(ev) CloseHandle(ev);
+	end_client(c);
+	return 0;
+}
+
+// Pipe to port direction runs on this thread
+static DWORD WINAPI client_thread(LPVOID param) {
+	pipe_client_t *c = (pipe_client_t *)param;
+	HANDLE writer = CreateThread(NULL, 64 * 1024, ring_to_pipe, c, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	HANDLE ev = CreateEvent(NULL, TRUE, FALSE, NULL);
+	uint8_t *buf = writer && ev ? (uint8_t *)malloc(BROKER_READ_SIZE) : NULL;
+	while(buf && !c->closing) {
+		int32_t n = pipe_io(c->pipe, ev, buf, BROKER_READ_SIZE, false);
+		if(n < 0) break;
+		if(n == 0) continue;
+		if(broker_write(c->broker, buf, (uint16_t)n) < 0) break;
+	}
+	free(buf);
+	if(ev) CloseHandle(ev);
+	end_client(c);
+	if(writer) {
+		WaitForSingleObject(writer, INFINITE);
+		CloseHandle(writer);
+	}
+	return 0;
+}
+
+static bool start_client(exposure_t *x, HANDLE pipe) {
+	broker_t *b = broker_acquire(x->device, x->fmt);
+	if(!b) return false;
+	pipe_client_t *c = (pipe_client_t *)calloc(1, sizeof(pipe_client_t));
+	if(c) c->sub = broker_subscribe(b, BROKER_LAG_OLDEST);
+	if(c && c->sub) {
+		c->broker = b;
+		c->pipe = pipe;
+		c->thread = CreateThread(NULL, 64 * 1024, client_thread, c, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+		if(c->thread) {
+			c->next = x->clients;
+			x->clients = c;
+			metrics_count(M_BROKER_CLIENTS, 1);
+			return true;
+		}
+		broker_unsubscribe(c->sub);
+	}
+	free(c);
+	broker_release(b);
+	return false;
+}
+
+// Free finished clients, with all end and wait for every client
+static void reap_clients(exposure_t *x, bool all) {
+	pipe_client_t **pp = &x->clients;
+	while(*pp) {
+		pipe_client_t *c = *pp;
+		if(all) end_client(c);
+		if(WaitForSingleObject(c->thread, all ? INFINITE : 0) != WAIT_OBJECT_0) {
+			pp = &c->next;
+			continue;
+		}
+		*pp = c->next;
+		CloseHandle(c->thread);
+		CloseHandle(c->pipe);
+		broker_unsubscribe(c->sub);
+		broker_release(c->broker);
+		free(c);
+	}
+}
+
+static DWORD WINAPI expose_thread(LPVOID param) {
+	exposure_t *x = (exposure_t *)param;
+	HANDLE ev = CreateEvent(NULL, TRUE, FALSE, NULL);
+	HANDLE waits[2] = { x->stop, ev };
+	while(ev) {
+		HANDLE pipe = CreateNamedPipeA(x->pipe, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+			PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+			PIPE_UNLIMITED_INSTANCES, BROKER_READ_SIZE, BROKER_READ_SIZE, 0, NULL);
+		if(pipe == INVALID_HANDLE_VALUE) break;
+		OVERLAPPED ov;
+		ZeroMemory(&ov, sizeof(ov));
+		ov.hEvent = ev;
+		DWORD err = ConnectNamedPipe(pipe, &ov) ? ERROR_SUCCESS : GetLastError();
+		if(err == ERROR_IO_PENDING) {
+			DWORD n = 0;
+			if(WaitForMultipleObjects(2, waits, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) {
+				CancelIoEx(pipe, &ov);
+				GetOverlappedResult(pipe, &ov, &n, TRUE);
+				CloseHandle(pipe);
+				break;
+			}
+			err = GetOverlappedResult(pipe, &ov, &n, FALSE) ? ERROR_SUCCESS : GetLastError();
+		} else if(err == ERROR_PIPE_CONNECTED) {
+			// client got in between create and connect
+			err = ERROR_SUCCESS;
+		}
+		reap_clients(x, false);
+		if(err != ERROR_SUCCESS || !start_client(x, pipe)) CloseHandle(pipe);
+	}
+	reap_clients(x, true);
+	if(ev) CloseHandle(ev);
+	CloseHandle(x->stop);
+	free(x);
+	return 0;
+}
+
+// true if device is listed under Brokers, most specific name first
+static bool configured(const char *device, const devid_t *id) {
+	char names[3][96];
+	snprintf(names[0], sizeof(names[0]), "%04x:%04x:%s", id->vid, id->pid, id->serial);
+	snprintf(names[1], sizeof(names[1]), "%04x:%04x", id->vid, id->pid);
+	sname(device, names[2], sizeof(names[2]));
+	for(int n = id->serial[0] ? 0 : 1; n < 3; n++) {
+		if(n < 2 && !id->vid && !id->pid) continue;
+		for(int i = 0; i < g_nconf; i++) {
+			if(_stricmp(g_conf[i].name, names[n]) == 0) return true;
+		}
+	}
+	return false;
+}
+
+void broker_expose(const char *device, const devid_t *id) {
+	if(!g_nconf || !configured(device, id)) return;
+	exposure_t *x = (exposure_t *)calloc(1, sizeof(exposure_t));
+	if(!x) return;
+	char port[32];
+	sname(device, port, sizeof(port));
+	strncpy(x->device, device, sizeof(x->device) - 1);
+	snprintf(x->pipe, sizeof(x->pipe), "\\\\.\\pipe\\cpnotify-%s", port);
+	profile_format(id, x->fmt, sizeof(x->fmt));
+	x->stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(!x->stop) {
+		free(x);
+		return;
+	}
+	AcquireSRWLockExclusive(&g_lock);
+	exposure_t *cur = g_exposed;
+	while(cur && strcmp(cur->device, device) != 0) cur = cur->next;
+	if(!cur) {
+		x->next = g_exposed;
+		g_exposed = x;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	if(cur) {
+		// already served
+		CloseHandle(x->stop);
+		free(x);
+		return;
+	}
+	HANDLE h = CreateThread(NULL, 64 * 1024, expose_thread, x, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	if(!h) {
+		AcquireSRWLockExclusive(&g_lock);
+		for(exposure_t **pp = &g_exposed; *pp; pp = &(*pp)->next) {
+			if(*pp == x) {
+				*pp = x->next;
+				break;
+			}
+		}
+		ReleaseSRWLockExclusive(&g_lock);
+		CloseHandle(x->stop);
+		free(x);
+		return;
+	}
+	CloseHandle(h);
+}
+
+void broker_unexpose(const char *device) {
+	AcquireSRWLockExclusive(&g_lock);
+	for(exposure_t **pp = &g_exposed; *pp; pp = &(*pp)->next) {
+		exposure_t *x = *pp;
+		if(strcmp(x->device, device) == 0) {
+			*pp = x->next;
+			SetEvent(x->stop);
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+}
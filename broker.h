@@ -0,0 +1,88 @@
+// Port broker
+//
+// Holds the single OS handle of a port and fans its input out to any
+// number of subscribers. One reader thread reads straight into a shared
+// ring, subscribers copy out of it through their own cursor. The ring
+// never waits for anyone: a subscriber that falls a full ring behind loses
+// data according to its lag policy, so a slow reader can never stall the
+// fast ones. A copy that the ring overwrote while it was being taken is
+// thrown away and counted as lost, so readers only ever see intact data.
+//
+// Fan-out is therefore not copy free, on purpose: every subscriber copies
+// its data out once instead of reading it in place. The ring can lap a
+// slow reader at any time, and only a copy can be checked afterwards as
+// not overwritten. Handing out pointers into the ring would need readers
+// to hold back the writer, which is what the ring is built to avoid.
+//
+// Writes from all clients go through broker_write and are serialized,
+// each call reaches the port in one piece.
+//
+// Capture and bridges open ports through the broker, so they coexist.
+// Other programs share a port through a named pipe
+//   \\.\pipe\cpnotify-<port>
+// served while the device is connected, for devices listed under
+// HKCU\Software\ComPortNotify\Brokers (value named "<vid>:<pid>:<serial>",
+// "<vid>:<pid>" or "COM5", any type). Pipe clients read the port output
+// and their writes go to the port.
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devid.h"
+
+typedef struct broker broker_t;
+typedef struct broker_sub broker_sub_t;
+
+enum {
+	BROKER_LAG_OLDEST = 0,   // lagging subscriber resumes at the oldest data still in the ring
+	BROKER_LAG_LATEST        // lagging subscriber skips to the newest data
+};
+
+// open device through the broker, sharing an existing handle if there is
+// one (fmt is only applied by the first user), NULL if the port won't open
+broker_t *broker_acquire(const char *device, const char *fmt);
+
+// drop a reference, the port is closed with the last one
+void broker_release(broker_t *b);
+
+// start reading at the current end of the ring
+broker_sub_t *broker_subscribe(broker_t *b, int lag_policy);
+void broker_unsubscribe(broker_sub_t *s);
+
+// wait up to ms for input, copy up to len bytes of it to buf
+// returns bytes copied, 0 on timeout, wake or when the data was lost while
+// being copied, -1 once the port is gone and everything has been read
+// a change of broker_dropped between calls means the data has a hole
+int32_t broker_read(broker_sub_t *s, uint8_t *buf, uint32_t len, uint32_t ms);
+
+// bytes this subscriber lost by lagging
+uint64_t broker_dropped(const broker_sub_t *s);
+
+// make a broker_peek blocked in another thread return 0
+void broker_wake(broker_sub_t *s);
+
+// write to the port, serialized with other writers
+int32_t broker_write(broker_t *b, const void *data, uint16_t len);
+
+// modem input lines of the port (SLINE_*), see slines_port
+int32_t broker_lines(broker_t *b);
+
+// wait for a modem line change, see swait_lines_port
+// one waiter per broker
+int32_t broker_wait_lines(broker_t *b, uint32_t *lines, uint32_t *changed);
+
+// make broker_wait_lines return 0 for good
+void broker_cancel_lines(broker_t *b);
+
+// read broker configuration
+void broker_load();
+
+// serve the named pipe for device if it is configured
+void broker_expose(const char *device, const devid_t *id);
+
+// stop serving the named pipe of device
+void broker_unexpose(const char *device);
+
+#endif
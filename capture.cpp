@@ -0,0 +1,307 @@
+// Port capture
+//
+// See capture.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "capture.h"
+#include "serial.h"
+#include "broker.h"
+#include "frame.h"
+#include "crc.h"
+#include "alert.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "profile.h"
+#include "settings.h"
+
+static const DWORD DEFAULT_LOG_SIZE = 16 * 1024 * 1024;
+static const DWORD MIN_LOG_SIZE = 64 * 1024;
+static const DWORD DEFAULT_GENERATIONS = 4;
+
+#define CAPTURE_WAIT_MS   100
+#define CAPTURE_CHUNK_MAX 4096   // longest chunk, also longest frame
+#define CAPTURE_RETRY_NS  (1 * EVCLOCK_NS_PER_SEC)
+
+// Memory mapped log file
+typedef struct {
+	char path[MAX_PATH];
+	HANDLE file;
+	HANDLE map;
+	uint8_t *view;
+	uint64_t used;
+	uint64_t lost;           // bytes not logged since the last chunk, for the gap chunk
+	uint64_t retry_ns;       // next attempt to reopen a log that failed to open
+	bool opened;             // a file of this session is open or was
+} caplog_t;
+
+typedef struct capture {
+	char device[32];
+	char fmt[64];
+	devid_t id;
+	volatile LONG stop;
+	caplog_t log;
+	framer_t framer;
+	alert_stream_t alert;
+	int64_t wall_ns;         // of the data being framed
+	uint8_t buf[CAPTURE_CHUNK_MAX];
+	struct capture *next;
+} capture_t;
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static capture_t *g_sessions = NULL;
+static char g_dir[MAX_PATH];
+static bool g_all = true;
+static DWORD g_log_size = DEFAULT_LOG_SIZE;
+static DWORD g_generations = DEFAULT_GENERATIONS;
+static int g_framing = -1;
+static int g_crc = -1;
+
+void capture_load() {
+	if(!settings_string("", "CaptureDir", g_dir, sizeof(g_dir))) g_dir[0] = '\0';
+	g_all = settings_dword("", "CaptureAll", 1) != 0;
+	g_log_size = settings_dword("", "CaptureLogSize", DEFAULT_LOG_SIZE);
+	if(g_log_size < MIN_LOG_SIZE) g_log_size = MIN_LOG_SIZE;
+	g_generations = settings_dword("", "CaptureGenerations", DEFAULT_GENERATIONS);
+	char framing[16];
+	g_framing = -1;
+	if(settings_string("", "CaptureFraming", framing, sizeof(framing))) g_framing = frame_mode(framing);
+	g_crc = -1;
+	if(settings_string("", "CaptureCrc", framing, sizeof(framing))) g_crc = crc_algo(framing);
+	if(g_crc >= 0) crc_init();
+}
+
+// Shift name.log -> name.1.log -> name.2.log ..., dropping the oldest
+static void log_shift(caplog_t *log) {
+	char from[MAX_PATH + 8];
+	char to[MAX_PATH + 8];
+	size_t base = strlen(log->path) - 4; // strip ".log"
+	for(DWORD g = g_generations; g > 0; g--) {
+		snprintf(to, sizeof(to), "%.*s.%lu.log", (int)base, log->path, (unsigned long)g);
+		if(g == 1) {
+			snprintf(from, sizeof(from), "%s", log->path);
+		} else {
+			snprintf(from, sizeof(from), "%.*s.%lu.log", (int)base, log->path, (unsigned long)(g - 1));
+		}
+		MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+	}
+	if(!g_generations) DeleteFileA(log->path);
+}
+
+static bool log_open(caplog_t *log) {
+	log->used = 0;
+	log->view = NULL;
+	// the log of the previous session on this port, with whatever the board
+	// said before it reset, becomes a generation instead of being overwritten
+	if(!log->opened) log_shift(log);
+	log->file = CreateFileA(log->path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(log->file == INVALID_HANDLE_VALUE) return false;
+	log->map = CreateFileMappingA(log->file, NULL, PAGE_READWRITE, 0, g_log_size, NULL);
+	if(!log->map) {
+		CloseHandle(log->file);
+		return false;
+	}
+	log->view = (uint8_t *)MapViewOfFile(log->map, FILE_MAP_WRITE, 0, 0, g_log_size);
+	if(!log->view) {
+		CloseHandle(log->map);
+		CloseHandle(log->file);
+		return false;
+	}
+	log->opened = true;
+	return true;
+}
+
+// Unmap and cut the file down to what was written
+static void log_close(caplog_t *log) {
+	if(!log->view) return;
+	FlushViewOfFile(log->view, (SIZE_T)log->used);
+	UnmapViewOfFile(log->view);
+	CloseHandle(log->map);
+	LARGE_INTEGER pos;
+	pos.QuadPart = (LONGLONG)log->used;
+	SetFilePointerEx(log->file, pos, NULL, FILE_BEGIN);
+	SetEndOfFile(log->file);
+	CloseHandle(log->file);
+	log->view = NULL;
+}
+
+// Start the next file once this one is full
+static void log_rotate(caplog_t *log) {
+	log_close(log);
+	log_shift(log);
+	log_open(log);
+}
+
+static void log_chunk(caplog_t *log, uint32_t magic, int64_t wall_ns, const void *data, uint32_t len) {
+	capture_chunk_t hdr;
+	hdr.magic = magic;
+	hdr.length = len;
+	hdr.wall_ns = wall_ns;
+	memcpy(log->view + log->used, &hdr, sizeof(hdr));
+	memcpy(log->view + log->used + sizeof(hdr), data, len);
+	log->used += sizeof(hdr) + len;
+}
+
+// Count bytes that could not be logged, the next chunk logged says so
+static void log_lost(caplog_t *log, uint64_t n) {
+	log->lost += n;
+	metrics_count(M_CAPTURE_DROPPED, n);
+}
+
+// Bytes the port sent that never reached us, the next chunk logged says so
+static void log_gap(caplog_t *log, uint64_t n) {
+	log->lost += n;
+}
+
+static void log_append(caplog_t *log, int64_t wall_ns, const uint8_t *data, uint32_t len) {
+	uint64_t gap = log->lost ? sizeof(capture_chunk_t) + sizeof(uint64_t) : 0;
+	uint64_t need = gap + sizeof(capture_chunk_t) + len;
+	if(log->view && log->used + need > g_log_size) log_rotate(log);
+	if(!log->view) {
+		// the file could not be opened, try again now and then
+		uint64_t now = evclock_now();
+		if(now >= log->retry_ns) {
+			log->retry_ns = now + CAPTURE_RETRY_NS;
+			log_open(log);
+		}
+	}
+	if(!log->view) {
+		log_lost(log, len);
+		return;
+	}
+	if(log->lost) {
+		log_chunk(log, CAPTURE_GAP_MAGIC, wall_ns, &log->lost, sizeof(log->lost));
+		log->lost = 0;
+	}
+	log_chunk(log, CAPTURE_CHUNK_MAGIC, wall_ns, data, len);
+}
+
+// Remove session from the active list, true if it was still there
+static bool unlink_session(capture_t *s) {
+	bool found = false;
+	AcquireSRWLockExclusive(&g_lock);
+	for(capture_t **pp = &g_sessions; *pp; pp = &(*pp)->next) {
+		if(*pp == s) {
+			*pp = s->next;
+			found = true;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	return found;
+}
+
+static void log_frame(void *ctx, const uint8_t *frame, uint32_t len) {
+	capture_t *s = (capture_t *)ctx;
+	if(g_crc >= 0) {
+		metrics_count(M_FRAMES_CHECKED, 1);
+		if(!crc_check_frame(g_crc, frame, len)) metrics_count(M_CRC_ERRORS, 1);
+	}
+	log_append(&s->log, s->wall_ns, frame, len);
+}
+
+static DWORD WINAPI capture_thread(LPVOID param) {
+	capture_t *s = (capture_t *)param;
+	broker_t *broker = NULL;
+	// the broker of a previous connection may still be letting go of the port
+	for(int i = 0; i < 20 && !s->stop; i++) {
+		broker = broker_acquire(s->device, s->fmt);
+		if(broker) break;
+		Sleep(50);
+	}
+	broker_sub_t *sub = broker ? broker_subscribe(broker, BROKER_LAG_OLDEST) : NULL;
+	bool framed = g_framing >= 0;
+	bool ready = sub && (!framed || frame_init(&s->framer, g_framing, CAPTURE_CHUNK_MAX));
+	if(ready) {
+		// the thread of the previous session may still hold the file, what
+		// comes meanwhile is counted and the retry in log_append opens it
+		if(!log_open(&s->log)) s->log.retry_ns = evclock_now() + CAPTURE_RETRY_NS;
+		uint64_t dropped = 0;
+		while(!s->stop) {
+			int32_t n = broker_read(sub, s->buf, sizeof(s->buf), CAPTURE_WAIT_MS);
+			if(n < 0) break;
+			if(broker_dropped(sub) != dropped) {
+				// the ring lapped us, nothing spans the hole
+				uint64_t now = broker_dropped(sub);
+				log_gap(&s->log, now - dropped);
+				dropped = now;
+				s->alert.state = 0;
+				if(framed) frame_skip(&s->framer);
+			}
+			if(n == 0) continue;
+			s->wall_ns = evclock_to_wall_ns(evclock_now());
+			alert_feed(&s->alert, s->device, s->buf, (uint32_t)n);
+			if(framed) {
+				frame_feed(&s->framer, s->buf, (uint32_t)n, log_frame, s);
+			} else {
+				log_append(&s->log, s->wall_ns, s->buf, (uint32_t)n);
+			}
+			metrics_count(M_CAPTURE_BYTES, (uint64_t)n);
+		}
+		log_close(&s->log);
+	}
+	if(framed) frame_free(&s->framer);
+	if(sub) broker_unsubscribe(sub);
+	if(broker) broker_release(broker);
+	unlink_session(s);
+	free(s);
+	return 0;
+}
+
+void capture_start(const char *device, const devid_t *id, bool by_rule) {
+	if(!g_dir[0] || !(g_all || by_rule)) return;
+	capture_t *s = (capture_t *)calloc(1, sizeof(capture_t));
+	if(!s) return;
+	strncpy(s->device, device, sizeof(s->device) - 1);
+	s->id = *id;
+	profile_format(id, s->fmt, sizeof(s->fmt));
+	char port[32];
+	sname(device, port, sizeof(port));
+	int len;
+	if(id->serial[0]) {
+		len = snprintf(s->log.path, sizeof(s->log.path), "%s\\%s_%04x-%04x-%s.log", g_dir, port, id->vid, id->pid, id->serial);
+	} else {
+		len = snprintf(s->log.path, sizeof(s->log.path), "%s\\%s_%04x-%04x.log", g_dir, port, id->vid, id->pid);
+	}
+	if(len >= (int)sizeof(s->log.path)) {
+		free(s);
+		return;
+	}
+
+	AcquireSRWLockExclusive(&g_lock);
+	capture_t *cur = g_sessions;
+	while(cur && strcmp(cur->device, device) != 0) cur = cur->next;
+	if(!cur) {
+		s->next = g_sessions;
+		g_sessions = s;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	if(cur) {
+		// already capturing
+		free(s);
+		return;
+	}
+	HANDLE h = CreateThread(NULL, 64 * 1024, capture_thread, s, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	if(!h) {
+		unlink_session(s);
+		free(s);
+		return;
+	}
+	CloseHandle(h);
+	metrics_count(M_CAPTURES, 1);
+}
+
+void capture_stop(const char *device) {
+	AcquireSRWLockExclusive(&g_lock);
+	for(capture_t **pp = &g_sessions; *pp; pp = &(*pp)->next) {
+		capture_t *s = *pp;
+		if(strcmp(s->device, device) == 0) {
+			InterlockedExchange(&s->stop, 1);
+			*pp = s->next;
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+}
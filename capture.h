@@ -0,0 +1,58 @@
+// Port capture
+//
+// Opens newly connected ports and logs everything they send. Enabled by
+// setting CaptureDir (REG_SZ under HKCU\Software\ComPortNotify). With
+// CaptureAll (DWORD, default 1) every port is captured, with CaptureAll=0
+// only ports matched by a "capture" rule (see rules.h).
+//
+// Each port gets its own thread, reading through the port broker (see
+// broker.h) so other clients can share the port, and its own log file
+//   <CaptureDir>\<port>_<vid>-<pid>[-<serial>].log
+// written through a memory mapping of CaptureLogSize bytes (default 16MB).
+// A full log is rotated to .1.log, .2.log ... up to CaptureGenerations
+// (default 4), and so is the log of the previous connection when the port
+// connects again. The serial format comes from the device profile, a REG_SZ
+// value named "<vid>:<pid>:<serial>" or "<vid>:<pid>" under
+// HKCU\Software\ComPortNotify\Profiles ("115200,N,8,1" if none).
+//
+// With CaptureFraming (REG_SZ "line", "slip" or "cobs", see frame.h) the
+// stream is split into frames and each frame is logged as one chunk,
+// without its delimiter and decoded. Frames over 4KB are dropped.
+// CaptureCrc (REG_SZ "crc16" or "crc32c", see crc.h) checks the checksum
+// at the end of every frame, frames are logged either way and the errors
+// counted in the metrics snapshot.
+//
+// Captured data is also scanned for alert patterns (see alert.h).
+//
+// Log files are a sequence of chunks, one per batch of received data:
+//   capture_chunk_t header, then length bytes of port data
+// Data that could not be logged leaves a gap chunk in its place, magic
+// CAPTURE_GAP_MAGIC and a uint64_t count of the bytes lost as payload.
+// A file cut short by a crash ends at the first header with a zero magic.
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devid.h"
+
+#define CAPTURE_CHUNK_MAGIC 0x434E5043   // "CPNC"
+#define CAPTURE_GAP_MAGIC   0x474E5043   // "CPNG"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t length;    // payload bytes following the header
+	int64_t wall_ns;    // when the data was taken in, ns since the unix epoch
+} capture_chunk_t;
+
+// read capture settings
+void capture_load();
+
+// start capturing device, by_rule if a capture rule matched
+void capture_start(const char *device, const devid_t *id, bool by_rule);
+
+// stop capturing device, the reader closes the port and log on its own
+void capture_stop(const char *device);
+
+#endif
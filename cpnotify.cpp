@@ -0,0 +1,371 @@
+// ComPortNotify library
+//
+// See cpnotify.h
+//
+// Changes are found by the same snapshot merge as the tray (snap.h), over
+// short port names; only ports that came, went or changed touch the
+// history.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <dbt.h>
+#include "cpnotify.h"
+#include "serial.h"
+#include "devid.h"
+#include "evclock.h"
+#include "topo.h"
+#include "snap.h"
+
+#define CPN_TIMER_COALESCE 1
+
+typedef struct entry {
+	char *port;
+	char *name;
+	char *hwid;
+	char slot[TOPO_SLOT_MAX];
+	devid_t id;
+	bool connected;
+	int64_t connected_at;
+	int64_t disconnected_at;
+	struct entry *next;
+} entry_t;
+
+struct cpn_watch {
+	cpn_events_fn fn;
+	void *ctx;
+	HANDLE thread;
+	HANDLE started;
+	HWND hwnd;
+	bool ok;
+	SRWLOCK lock;              // guards history against cpn_history readers
+	uint64_t gen;              // sgeneration() at the last scan
+	snap_t snaps[2];
+	snap_t *prev;              // ports of the last scan
+	snap_t *cur;
+	entry_t *history;          // newest change first, only the watch thread writes
+	cpn_event_t *events;       // batch being built
+	uint32_t nevents;
+	uint32_t cap;
+};
+
+// senum() has no context argument, each thread collects into its own snapshot
+static __thread snap_t *tl_snap = NULL;
+
+static const char *g_class = "ComPortNotifyWatch";
+
+static void add_scan(char *name, char *device, char *hwid, char *instance, char *location) {
+	char port[32];
+	char slot[TOPO_SLOT_MAX];
+	sname(device, port, sizeof(port));
+	if(!topo_slot(location, slot, sizeof(slot))) slot[0] = '\0';
+	snap_add(tl_snap, port, name, hwid, instance, slot);
+}
+
+// Enumerate into s, in enumeration order until sorted
+static void scan_ports(snap_t *s) {
+	snap_clear(s);
+	tl_snap = s;
+	senum(add_scan);
+	tl_snap = NULL;
+}
+
+static void fill_port(cpn_port_t *p, const char *port, const char *name, const char *hwid, const char *slot, const devid_t *id) {
+	memset(p, 0, sizeof(*p));
+	p->port = port;
+	p->name = name;
+	p->hwid = hwid;
+	p->slot = slot;
+	p->serial = id->serial;
+	p->vid = id->vid;
+	p->pid = id->pid;
+}
+
+static void fill_entry(cpn_port_t *p, const entry_t *e) {
+	fill_port(p, e->port, e->name, e->hwid, e->slot, &e->id);
+	p->state = e->connected ? CPN_CONNECTED : CPN_DISCONNECTED;
+	p->connected_at = e->connected_at;
+	p->disconnected_at = e->disconnected_at;
+}
+
+int32_t cpn_abi_version(void) {
+	return CPN_ABI_VERSION;
+}
+
+int32_t cpn_enumerate(cpn_port_fn fn, void *ctx) {
+	snap_t s;
+	memset(&s, 0, sizeof(s));
+	scan_ports(&s);
+	for(uint32_t i = 0; fn && i < s.count; i++) {
+		const snap_str_t *str = snap_port(&s, i);
+		const char *hwid = snap_str(&s, str->hwid);
+		devid_t id;
+		devid_parse(&id, hwid, snap_str(&s, str->instance));
+		cpn_port_t p;
+		fill_port(&p, snap_str(&s, str->device), snap_str(&s, str->name), hwid ? hwid : "", snap_str(&s, str->slot), &id);
+		p.state = CPN_CONNECTED;
+		fn(&p, ctx);
+	}
+	int32_t count = (int32_t)s.count;
+	snap_free(&s);
+	return count;
+}
+
+static void push_event(cpn_watch_t *w, int type, const entry_t *e) {
+	if(w->nevents == w->cap) {
+		uint32_t cap = w->cap ? w->cap * 2 : 16;
+		cpn_event_t *events = (cpn_event_t *)realloc(w->events, cap * sizeof(cpn_event_t));
+		if(!events) return;
+		w->events = events;
+		w->cap = cap;
+	}
+	cpn_event_t *ev = &w->events[w->nevents++];
+	ev->type = type;
+	fill_entry(&ev->port, e);
+}
+
+static entry_t *find_entry(cpn_watch_t *w, const char *port) {
+	for(entry_t *e = w->history; e; e = e->next) {
+		if(strcmp(e->port, port) == 0) return e;
+	}
+	return NULL;
+}
+
+// Move e to the head of the history, lock held
+static void to_head(cpn_watch_t *w, entry_t *e) {
+	if(w->history == e) return;
+	entry_t **pp = &w->history;
+	while(*pp != e) pp = &(*pp)->next;
+	*pp = e->next;
+	e->next = w->history;
+	w->history = e;
+}
+
+static void free_entry(entry_t *e) {
+	free(e->port);
+	free(e->name);
+	free(e->hwid);
+	free(e);
+}
+
+// Drop the oldest disconnected entries beyond CPN_HISTORY_MAX, lock held
+static void trim_history(cpn_watch_t *w) {
+	uint32_t count = 0;
+	entry_t **pp = &w->history;
+	while(*pp) {
+		entry_t *e = *pp;
+		if(++count > CPN_HISTORY_MAX && !e->connected) {
+			*pp = e->next;
+			free_entry(e);
+			count--;
+		} else {
+			pp = &e->next;
+		}
+	}
+}
+
+// Replace *field with a copy of s if it differs, false if out of memory
+static bool set_string(char **field, const char *s) {
+	if(*field && strcmp(*field, s) == 0) return true;
+	char *copy = _strdup(s);
+	if(!copy) return false;
+	free(*field);
+	*field = copy;
+	return true;
+}
+
+// One refresh, for port_changed
+typedef struct {
+	cpn_watch_t *w;
+	bool init;
+	int64_t now;
+} refresh_t;
+
+// snap_diff callback, lock held
+static void port_changed(int change, snap_t *s, uint32_t pos, void *ctx) {
+	refresh_t *r = (refresh_t *)ctx;
+	cpn_watch_t *w = r->w;
+	const snap_str_t *p = snap_port(s, pos);
+	const char *port = snap_str(s, p->device);
+	entry_t *e = find_entry(w, port);
+	if(change == SNAP_REMOVED) {
+		if(!e || !e->connected) return;
+		e->connected = false;
+		e->disconnected_at = r->now;
+		if(!r->init) push_event(w, CPN_EVENT_REMOVED, e);
+		return;
+	}
+	const char *name = snap_str(s, p->name);
+	const char *hwid = snap_str(s, p->hwid);
+	if(!hwid) hwid = "";
+	if(!e) {
+		e = (entry_t *)calloc(1, sizeof(entry_t));
+		if(!e || !set_string(&e->port, port) || !set_string(&e->name, name) || !set_string(&e->hwid, hwid)) {
+			if(e) free_entry(e);
+			// reported as changed next time
+			s->keys[pos].attr = 0;
+			return;
+		}
+		e->next = w->history;
+		w->history = e;
+	} else if(!set_string(&e->name, name) || !set_string(&e->hwid, hwid)) {
+		s->keys[pos].attr = 0;
+	}
+	devid_parse(&e->id, snap_str(s, p->hwid), snap_str(s, p->instance));
+	snprintf(e->slot, sizeof(e->slot), "%s", snap_str(s, p->slot));
+	if(!e->connected) {
+		e->connected = true;
+		e->connected_at = r->init ? 0 : r->now;
+		e->disconnected_at = 0;
+		to_head(w, e);
+		if(!r->init) push_event(w, CPN_EVENT_CONNECTED, e);
+	}
+}
+
+// Enumerate, update the history and report what changed
+static void refresh(cpn_watch_t *w, bool init) {
+	// most device events are about other classes, the port list is as it was
+	uint64_t gen = sgeneration();
+	if(!init && gen && gen == w->gen) return;
+	w->gen = gen;
+	scan_ports(w->cur);
+	snap_sort(w->cur);
+	refresh_t r = { w, init, evclock_to_wall_ns(evclock_now()) };
+	w->nevents = 0;
+
+	// events point into the history, which only this thread changes
+	AcquireSRWLockExclusive(&w->lock);
+	snap_diff(w->prev, w->cur, port_changed, &r);
+	ReleaseSRWLockExclusive(&w->lock);
+	snap_t *done = w->prev;
+	w->prev = w->cur;
+	w->cur = done;
+
+	if(w->nevents && w->fn) w->fn(w->events, w->nevents, w->ctx);
+
+	AcquireSRWLockExclusive(&w->lock);
+	trim_history(w);
+	ReleaseSRWLockExclusive(&w->lock);
+}
+
+static LRESULT CALLBACK watch_proc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+	cpn_watch_t *w = (cpn_watch_t *)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	switch(msg) {
+		case WM_DEVICECHANGE:
+			// (re)start the coalescing window, the burst is handled once it is over
+			if(wParam == DBT_DEVICEARRIVAL || wParam == DBT_DEVICEREMOVECOMPLETE || wParam == DBT_DEVNODES_CHANGED) {
+				SetTimer(hwnd, CPN_TIMER_COALESCE, CPN_COALESCE_MS, NULL);
+			}
+			return TRUE;
+		case WM_TIMER:
+			if(wParam == CPN_TIMER_COALESCE && w) {
+				KillTimer(hwnd, CPN_TIMER_COALESCE);
+				refresh(w, false);
+			}
+			return 0;
+		case WM_CLOSE:
+			DestroyWindow(hwnd);
+			return 0;
+		case WM_DESTROY:
+			PostQuitMessage(0);
+			return 0;
+	}
+	return DefWindowProc(hwnd, msg, wParam, lParam);
+}
+
+static DWORD WINAPI watch_thread(LPVOID param) {
+	cpn_watch_t *w = (cpn_watch_t *)param;
+	HINSTANCE inst = GetModuleHandle(NULL);
+	// fails harmlessly once another watch has registered it
+	WNDCLASSEXA wc;
+	ZeroMemory(&wc, sizeof(wc));
+	wc.cbSize = sizeof(wc);
+	wc.lpfnWndProc = watch_proc;
+	wc.hInstance = inst;
+	wc.lpszClassName = g_class;
+	RegisterClassExA(&wc);
+	w->hwnd = CreateWindowExA(0, g_class, "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, inst, NULL);
+	HDEVNOTIFY notify = NULL;
+	if(w->hwnd) {
+		SetWindowLongPtr(w->hwnd, GWLP_USERDATA, (LONG_PTR)w);
+		// message-only windows get no broadcasts, ask for every interface class
+		DEV_BROADCAST_DEVICEINTERFACE filter;
+		ZeroMemory(&filter, sizeof(filter));
+		filter.dbcc_size = sizeof(filter);
+		filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+		notify = RegisterDeviceNotification(w->hwnd, &filter, DEVICE_NOTIFY_WINDOW_HANDLE | DEVICE_NOTIFY_ALL_INTERFACE_CLASSES);
+	}
+	w->ok = w->hwnd && notify;
+	if(w->ok) refresh(w, true);
+	SetEvent(w->started);
+	if(!w->ok) {
+		if(w->hwnd) DestroyWindow(w->hwnd);
+		return 0;
+	}
+
+	MSG msg;
+	while(GetMessage(&msg, NULL, 0, 0) > 0) {
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+	UnregisterDeviceNotification(notify);
+	return 0;
+}
+
+static void free_watch(cpn_watch_t *w) {
+	entry_t *e = w->history;
+	while(e) {
+		entry_t *next = e->next;
+		free_entry(e);
+		e = next;
+	}
+	if(w->started) CloseHandle(w->started);
+	if(w->thread) CloseHandle(w->thread);
+	snap_free(&w->snaps[0]);
+	snap_free(&w->snaps[1]);
+	free(w->events);
+	free(w);
+}
+
+cpn_watch_t *cpn_watch(cpn_events_fn fn, void *ctx) {
+	cpn_watch_t *w = (cpn_watch_t *)calloc(1, sizeof(cpn_watch_t));
+	if(!w) return NULL;
+	w->fn = fn;
+	w->ctx = ctx;
+	w->prev = &w->snaps[0];
+	w->cur = &w->snaps[1];
+	InitializeSRWLock(&w->lock);
+	w->started = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(w->started) w->thread = CreateThread(NULL, 0, watch_thread, w, 0, NULL);
+	if(!w->thread) {
+		free_watch(w);
+		return NULL;
+	}
+	WaitForSingleObject(w->started, INFINITE);
+	if(!w->ok) {
+		WaitForSingleObject(w->thread, INFINITE);
+		free_watch(w);
+		return NULL;
+	}
+	return w;
+}
+
+void cpn_unwatch(cpn_watch_t *w) {
+	if(!w) return;
+	PostMessage(w->hwnd, WM_CLOSE, 0, 0);
+	WaitForSingleObject(w->thread, INFINITE);
+	free_watch(w);
+}
+
+int32_t cpn_history(cpn_watch_t *w, cpn_port_fn fn, void *ctx) {
+	int32_t count = 0;
+	AcquireSRWLockShared(&w->lock);
+	for(entry_t *e = w->history; e; e = e->next, count++) {
+		cpn_port_t p;
+		fill_entry(&p, e);
+		if(fn) fn(&p, ctx);
+	}
+	ReleaseSRWLockShared(&w->lock);
+	return count;
+}
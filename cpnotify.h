@@ -0,0 +1,100 @@
+// ComPortNotify library
+//
+// The port enumeration and change detection engine as a DLL with a plain
+// C ABI, for tools written in other languages (ctypes, P/Invoke, ...).
+// Built by make.bat as bin/cpnotify.dll with import library
+// bin/libcpnotify.a.
+//
+// A watch runs its own thread with a message-only window. Device change
+// notifications arriving within CPN_COALESCE_MS of each other are handled
+// by one enumeration, and every change it finds is delivered in a single
+// callback, so a hub full of boards costs one call across the language
+// boundary instead of one per port.
+//
+// Structures only ever grow at the end, cpn_abi_version() tells which
+// fields a library has.
+//
+// Changes are found by the same snapshot merge as the tray program
+// (snap.h). The tray does not go through this API: it holds removals back
+// for flap detection, tells ports that arrived before it started from
+// those present all along, and starts capture, bridges and the like on
+// its own event loop while the merge runs, none of which fits a batch of
+// events delivered on a library thread.
+
+#ifndef CPNOTIFY_H
+#define CPNOTIFY_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(CPN_BUILD)
+#define CPN_API __declspec(dllexport)
+#else
+#define CPN_API __declspec(dllimport)
+#endif
+
+#define CPN_ABI_VERSION  2
+#define CPN_COALESCE_MS  50
+#define CPN_HISTORY_MAX  256
+
+enum {
+	CPN_DISCONNECTED = 0,
+	CPN_CONNECTED = 1
+};
+
+enum {
+	CPN_EVENT_CONNECTED = 1,
+	CPN_EVENT_REMOVED = 2
+};
+
+// Strings are UTF-8 or ANSI as reported by SetupDi, valid only during the
+// call they are handed to
+typedef struct {
+	const char *port;          // "COM5"
+	const char *name;          // friendly name
+	const char *hwid;          // first hardware ID, "" if none
+	const char *serial;        // USB serial number, "" if none
+	uint16_t vid;
+	uint16_t pid;
+	int32_t state;             // CPN_CONNECTED or CPN_DISCONNECTED
+	int64_t connected_at;      // unix epoch ns, 0 = present when the watch started
+	int64_t disconnected_at;   // unix epoch ns, 0 = never
+	const char *slot;          // USB socket ("1400-3.2"), "" if unknown (ABI 2)
+} cpn_port_t;
+
+typedef struct {
+	int32_t type;              // CPN_EVENT_*
+	cpn_port_t port;
+} cpn_event_t;
+
+typedef struct cpn_watch cpn_watch_t;
+
+typedef void (*cpn_port_fn)(const cpn_port_t *port, void *ctx);
+typedef void (*cpn_events_fn)(const cpn_event_t *events, uint32_t count, void *ctx);
+
+// CPN_ABI_VERSION the library was built with
+CPN_API int32_t cpn_abi_version(void);
+
+// call fn for every present port, returns the number of ports
+CPN_API int32_t cpn_enumerate(cpn_port_fn fn, void *ctx);
+
+// start watching, fn gets batches of changes on the watch thread
+// the ports present at start are in the history, not reported as events
+// returns NULL on failure
+CPN_API cpn_watch_t *cpn_watch(cpn_events_fn fn, void *ctx);
+
+// stop watching and free w, must not be called from its callback
+CPN_API void cpn_unwatch(cpn_watch_t *w);
+
+// call fn for every connected and remembered port, newest change first
+// returns the number of ports, may be called from any thread
+CPN_API int32_t cpn_history(cpn_watch_t *w, cpn_port_fn fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,252 @@
+// Frame checksums
+//
+// See crc.h
+//
+// CRC-16 is computed most significant bit first. PCLMULQDQ folds the
+// message 16 bytes at a time into a 128 bit value congruent to it modulo
+// the polynomial, whose CRC the tables then finish. CRC-32C is
+// reflected, the SSE4.2 crc32 instruction implements it directly.
+
+#include <string.h>
+#include <windows.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "crc.h"
+
+#define CRC16_POLY  0x1021
+#define CRC32C_POLY 0x82F63B78   // reflected
+
+typedef uint32_t (*crc_fn)(uint32_t state, const uint8_t *p, size_t len);
+
+static uint16_t g_t16[8][256];
+static uint32_t g_t32[8][256];
+static uint64_t g_k128;          // x^128 mod P, CRC-16 folding constants
+static uint64_t g_k192;          // x^192 mod P
+static crc_fn g_fn[CRC_COUNT];
+static const char *g_impl[CRC_COUNT];
+static INIT_ONCE g_once = INIT_ONCE_STATIC_INIT;
+
+static uint32_t crc16_slice8(uint32_t state, const uint8_t *p, size_t len) {
+	uint16_t c = (uint16_t)state;
+	while(len >= 8) {
+		c = g_t16[7][p[0] ^ (c >> 8)] ^ g_t16[6][p[1] ^ (c & 0xFF)] ^
+			g_t16[5][p[2]] ^ g_t16[4][p[3]] ^ g_t16[3][p[4]] ^
+			g_t16[2][p[5]] ^ g_t16[1][p[6]] ^ g_t16[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while(len--) c = (uint16_t)(c << 8) ^ g_t16[0][(c >> 8) ^ *p++];
+	return c;
+}
+
+static uint32_t crc32c_slice8(uint32_t c, const uint8_t *p, size_t len) {
+	while(len >= 8) {
+		uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+		c = g_t32[7][lo & 0xFF] ^ g_t32[6][(lo >> 8) & 0xFF] ^ g_t32[5][(lo >> 16) & 0xFF] ^ g_t32[4][lo >> 24] ^
+			g_t32[3][p[4]] ^ g_t32[2][p[5]] ^ g_t32[1][p[6]] ^ g_t32[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+	while(len--) c = (c >> 8) ^ g_t32[0][(c ^ *p++) & 0xFF];
+	return c;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t c, const uint8_t *p, size_t len) {
+#if defined(__x86_64__)
+	uint64_t c64 = c;
+	while(len >= 8) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		c64 = _mm_crc32_u64(c64, v);
+		p += 8;
+		len -= 8;
+	}
+	c = (uint32_t)c64;
+#endif
+	while(len >= 4) {
+		uint32_t v;
+		memcpy(&v, p, 4);
+		c = _mm_crc32_u32(c, v);
+		p += 4;
+		len -= 4;
+	}
+	while(len--) c = _mm_crc32_u8(c, *p++);
+	return c;
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc16_pclmul(uint32_t state, const uint8_t *p, size_t len) {
+	if(len < 32) return crc16_slice8(state, p, len);
+	// byte 0 of the message becomes the highest order coefficient
+	const __m128i rev = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i k = _mm_set_epi64x((long long)g_k192, (long long)g_k128);
+	__m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), rev);
+	// the running CRC enters as the first two message bytes
+	x = _mm_xor_si128(x, _mm_set_epi64x((long long)((uint64_t)(state & 0xFFFF) << 48), 0));
+	p += 16;
+	len -= 16;
+	while(len >= 16) {
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), rev);
+		__m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+		__m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+		x = _mm_xor_si128(_mm_xor_si128(hi, lo), b);
+		p += 16;
+		len -= 16;
+	}
+	uint8_t folded[16];
+	_mm_storeu_si128((__m128i *)folded, _mm_shuffle_epi8(x, rev));
+	return crc16_slice8(crc16_slice8(0, folded, 16), p, len);
+}
+#endif
+
+// x^n mod P for the 16 bit polynomial, most significant bit first
+static uint64_t xpow_mod16(int n) {
+	uint32_t r = 1;
+	while(n--) {
+		r <<= 1;
+		if(r & 0x10000) r ^= 0x10000 | CRC16_POLY;
+	}
+	return r;
+}
+
+// Run algo's chosen implementation against the tables
+static bool agrees(int algo) {
+	static const char check[] = "123456789";
+	uint8_t buf[1031];
+	uint32_t seed = 0x12345678;
+	for(size_t i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+	crc_fn table = algo == CRC_16_CCITT ? crc16_slice8 : crc32c_slice8;
+	uint32_t expect = algo == CRC_16_CCITT ? 0x29B1 : 0xE3069283;
+	if(crc_end(algo, g_fn[algo](crc_begin(algo), (const uint8_t *)check, 9)) != expect) return false;
+	for(size_t len = 0; len <= sizeof(buf); len += 73) {
+		if(g_fn[algo](crc_begin(algo), buf, len) != table(crc_begin(algo), buf, len)) return false;
+	}
+	return true;
+}
+
+static BOOL CALLBACK setup(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+	for(int i = 0; i < 256; i++) {
+		uint16_t c16 = (uint16_t)(i << 8);
+		uint32_t c32 = (uint32_t)i;
+		for(int b = 0; b < 8; b++) {
+			c16 = (c16 & 0x8000) ? (uint16_t)((c16 << 1) ^ CRC16_POLY) : (uint16_t)(c16 << 1);
+			c32 = (c32 & 1) ? (c32 >> 1) ^ CRC32C_POLY : c32 >> 1;
+		}
+		g_t16[0][i] = c16;
+		g_t32[0][i] = c32;
+	}
+	// table k holds the effect of a byte followed by k zero bytes
+	for(int k = 1; k < 8; k++) {
+		for(int i = 0; i < 256; i++) {
+			uint16_t c16 = g_t16[k - 1][i];
+			g_t16[k][i] = (uint16_t)(c16 << 8) ^ g_t16[0][c16 >> 8];
+			uint32_t c32 = g_t32[k - 1][i];
+			g_t32[k][i] = (c32 >> 8) ^ g_t32[0][c32 & 0xFF];
+		}
+	}
+	g_k128 = xpow_mod16(128);
+	g_k192 = xpow_mod16(192);
+
+	g_fn[CRC_16_CCITT] = crc16_slice8;
+	g_fn[CRC_32C] = crc32c_slice8;
+	g_impl[CRC_16_CCITT] = g_impl[CRC_32C] = "slice8";
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+		g_fn[CRC_16_CCITT] = crc16_pclmul;
+		g_impl[CRC_16_CCITT] = "pclmul";
+	}
+	if(__builtin_cpu_supports("sse4.2")) {
+		g_fn[CRC_32C] = crc32c_sse42;
+		g_impl[CRC_32C] = "sse4.2";
+	}
+#endif
+	if(!agrees(CRC_16_CCITT)) {
+		g_fn[CRC_16_CCITT] = crc16_slice8;
+		g_impl[CRC_16_CCITT] = "slice8";
+	}
+	if(!agrees(CRC_32C)) {
+		g_fn[CRC_32C] = crc32c_slice8;
+		g_impl[CRC_32C] = "slice8";
+	}
+	return TRUE;
+}
+
+// Tables built and implementations checked, once, before any use
+static void ready() {
+	InitOnceExecuteOnce(&g_once, setup, NULL, NULL);
+}
+
+void crc_init() {
+	ready();
+}
+
+int crc_algo(const char *name) {
+	if(_stricmp(name, "crc16") == 0) return CRC_16_CCITT;
+	if(_stricmp(name, "crc32c") == 0) return CRC_32C;
+	return -1;
+}
+
+uint32_t crc_begin(int algo) {
+	return algo == CRC_16_CCITT ? 0xFFFF : 0xFFFFFFFF;
+}
+
+uint32_t crc_update(int algo, uint32_t state, const void *data, size_t len) {
+	ready();
+	return g_fn[algo](state, (const uint8_t *)data, len);
+}
+
+uint32_t crc_end(int algo, uint32_t state) {
+	return algo == CRC_16_CCITT ? state : ~state;
+}
+
+uint32_t crc_compute(int algo, const void *data, size_t len) {
+	return crc_end(algo, crc_update(algo, crc_begin(algo), data, len));
+}
+
+bool crc_check_frame(int algo, const uint8_t *frame, uint32_t len) {
+	if(algo == CRC_16_CCITT) {
+		if(len < 2) return false;
+		uint32_t sent = (uint32_t)frame[len - 2] << 8 | frame[len - 1];
+		return crc_compute(algo, frame, len - 2) == sent;
+	}
+	if(len < 4) return false;
+	const uint8_t *t = frame + len - 4;
+	uint32_t sent = (uint32_t)t[0] | (uint32_t)t[1] << 8 | (uint32_t)t[2] << 16 | (uint32_t)t[3] << 24;
+	return crc_compute(algo, frame, len - 4) == sent;
+}
+
+const char *crc_impl(int algo) {
+	ready();
+	return g_impl[algo];
+}
+
+bool crc_use(int algo, const char *impl) {
+	ready();
+	crc_fn fn = NULL;
+	const char *name = NULL;
+	if(strcmp(impl, "slice8") == 0) {
+		fn = algo == CRC_16_CCITT ? crc16_slice8 : crc32c_slice8;
+		name = "slice8";
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	if(algo == CRC_16_CCITT && strcmp(impl, "pclmul") == 0 && __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+		fn = crc16_pclmul;
+		name = "pclmul";
+	}
+	if(algo == CRC_32C && strcmp(impl, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2")) {
+		fn = crc32c_sse42;
+		name = "sse4.2";
+	}
+#endif
+	if(!fn) return false;
+	g_fn[algo] = fn;
+	g_impl[algo] = name;
+	return true;
+}
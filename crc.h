@@ -0,0 +1,50 @@
+// Frame checksums
+//
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF, as in CCITT-FALSE) and CRC-32C
+// (Castagnoli). The fastest implementation the CPU supports is picked by
+// crc_init, or the first use if it was not called: the SSE4.2 crc32
+// instruction for CRC-32C, PCLMULQDQ folding for CRC-16, slicing-by-8
+// tables otherwise. An accelerated version that disagrees with the tables
+// on the check vectors is not used; no checksum is computed before the
+// check is done.
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+enum {
+	CRC_16_CCITT = 0,
+	CRC_32C,
+	CRC_COUNT
+};
+
+// build tables and pick implementations now rather than on first use
+void crc_init();
+
+// algorithm from a name ("crc16" or "crc32c"), -1 if unknown
+int crc_algo(const char *name);
+
+// incremental use: crc_end(algo, crc_update(algo, crc_begin(algo), ...))
+uint32_t crc_begin(int algo);
+uint32_t crc_update(int algo, uint32_t state, const void *data, size_t len);
+uint32_t crc_end(int algo, uint32_t state);
+
+// checksum of one buffer
+uint32_t crc_compute(int algo, const void *data, size_t len);
+
+// true if the last bytes of frame hold the checksum of the rest, sent
+// most significant byte first for CRC-16, least significant for CRC-32C
+bool crc_check_frame(int algo, const uint8_t *frame, uint32_t len);
+
+// name of the implementation in use ("sse4.2", "pclmul" or "slice8")
+const char *crc_impl(int algo);
+
+// use the named implementation for algo without checking it against the
+// tables, false if there is none by that name for algo or the CPU lacks
+// it; for tests and benchmarks
+bool crc_use(int algo, const char *impl);
+
+#endif
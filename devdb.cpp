@@ -0,0 +1,314 @@
+// Known device database
+//
+// See devdb.h
+//
+// Records live in one growing array, an open addressing table of indexes
+// by devid hash finds them. The event loop changes records under the
+// exclusive lock and wakes the writer, which lets changes pile up for
+// DEVDB_FLUSH_MS, copies the array under the shared lock and replaces the
+// file with the copy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <windows.h>
+#include <shlobj.h>
+#include "devdb.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "settings.h"
+
+#define DEVDB_MAGIC   0x42445043u   // "CPDB"
+#define DEVDB_VERSION 1
+#define DEVDB_MAX     (1 << 20)     // records, sanity limit for the file
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;            // sizeof(devdb_record_t)
+	uint32_t count;
+} devdb_header_t;
+
+static devdb_record_t *g_records = NULL;
+static int64_t *g_since = NULL;      // wall ns the first of the live connections started, 0 if none
+static uint32_t *g_live = NULL;      // connections open, boards without a serial share a record
+static uint32_t g_count = 0;
+static uint32_t g_cap = 0;
+static int32_t *g_cells = NULL;      // twice the capacity
+static uint32_t g_mask = 0;
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static char g_path[MAX_PATH];
+static HANDLE g_wake = NULL;         // auto reset, set on changes
+static HANDLE g_stop = NULL;         // manual reset
+static HANDLE g_thread = NULL;
+static volatile LONG g_dirty = 0;
+static volatile LONG g_read = 0;     // the file is in, until then it is not written
+static volatile LONG g_flushes = 0;
+static volatile LONG g_flush_errors = 0;
+
+static bool same(const devdb_record_t *r, const devid_t *id) {
+	return r->hash == id->hash && r->vid == id->vid && r->pid == id->pid && strcmp(r->serial, id->serial) == 0;
+}
+
+static int find(const devid_t *id) {
+	if(!g_cells) return -1;
+	for(uint32_t i = id->hash & g_mask;; i = (i + 1) & g_mask) {
+		int e = g_cells[i];
+		if(e < 0) return -1;
+		if(same(&g_records[e], id)) return e;
+	}
+}
+
+static void put_cell(uint32_t e) {
+	uint32_t i = g_records[e].hash & g_mask;
+	while(g_cells[i] >= 0) i = (i + 1) & g_mask;
+	g_cells[i] = (int32_t)e;
+}
+
+static bool grow(uint32_t need) {
+	if(need <= g_cap) return true;
+	uint32_t cap = g_cap ? g_cap : 64;
+	while(cap < need) cap *= 2;
+	devdb_record_t *records = (devdb_record_t *)realloc(g_records, cap * sizeof(devdb_record_t));
+	if(!records) return false;
+	g_records = records;
+	int64_t *since = (int64_t *)realloc(g_since, cap * sizeof(int64_t));
+	if(!since) return false;
+	g_since = since;
+	uint32_t *live = (uint32_t *)realloc(g_live, cap * sizeof(uint32_t));
+	if(!live) return false;
+	g_live = live;
+	int32_t *cells = (int32_t *)malloc(cap * 2 * sizeof(int32_t));
+	if(!cells) return false;
+	free(g_cells);
+	g_cells = cells;
+	g_mask = cap * 2 - 1;
+	g_cap = cap;
+	for(uint32_t i = 0; i <= g_mask; i++) g_cells[i] = -1;
+	for(uint32_t e = 0; e < g_count; e++) put_cell(e);
+	return true;
+}
+
+static int insert(const devdb_record_t *r) {
+	if(!grow(g_count + 1)) return -1;
+	uint32_t e = g_count++;
+	g_records[e] = *r;
+	g_since[e] = 0;
+	g_live[e] = 0;
+	put_cell(e);
+	return (int)e;
+}
+
+// local date of a wall clock time, yyyymmdd
+static uint32_t day_of(int64_t wall_ns) {
+	time_t t = (time_t)(wall_ns / (int64_t)EVCLOCK_NS_PER_SEC);
+	struct tm *tm = localtime(&t);
+	if(!tm) return 0;
+	return (uint32_t)((tm->tm_year + 1900) * 10000 + (tm->tm_mon + 1) * 100 + tm->tm_mday);
+}
+
+static void changed() {
+	InterlockedExchange(&g_dirty, 1);
+	if(g_wake) SetEvent(g_wake);
+}
+
+static void flush() {
+	if(!g_path[0] || !g_read || !InterlockedExchange(&g_dirty, 0)) return;
+	AcquireSRWLockShared(&g_lock);
+	size_t size = sizeof(devdb_header_t) + (size_t)g_count * sizeof(devdb_record_t);
+	uint8_t *buf = (uint8_t *)malloc(size);
+	if(buf) {
+		devdb_header_t h = { DEVDB_MAGIC, DEVDB_VERSION, sizeof(devdb_record_t), g_count };
+		memcpy(buf, &h, sizeof(h));
+		if(g_count) memcpy(buf + sizeof(h), g_records, (size_t)g_count * sizeof(devdb_record_t));
+	}
+	ReleaseSRWLockShared(&g_lock);
+	if(buf && settings_replace_file(g_path, buf, size)) {
+		InterlockedIncrement(&g_flushes);
+	} else {
+		// kept dirty, the next change retries
+		InterlockedExchange(&g_dirty, 1);
+		InterlockedIncrement(&g_flush_errors);
+	}
+	free(buf);
+}
+
+static DWORD WINAPI writer(LPVOID param) {
+	HANDLE both[2] = { g_stop, g_wake };
+	for(;;) {
+		if(WaitForMultipleObjects(2, both, FALSE, INFINITE) != WAIT_OBJECT_0 + 1) break;
+		// a hub full of boards is one write
+		if(WaitForSingleObject(g_stop, DEVDB_FLUSH_MS) == WAIT_OBJECT_0) break;
+		flush();
+	}
+	return 0;
+}
+
+static void devdb_report(FILE *f) {
+	fprintf(f, "devdb devices=%lu flushes=%ld flush_errors=%ld\n", (unsigned long)g_count, (long)g_flushes, (long)g_flush_errors);
+}
+
+static bool db_path(char *out, size_t size) {
+	if(settings_string("", "DeviceDb", out, size) && out[0]) return true;
+	char dir[MAX_PATH];
+	if(settings_portable()) {
+		DWORD n = GetModuleFileNameA(NULL, dir, sizeof(dir));
+		if(!n || n >= sizeof(dir)) return false;
+		char *slash = strrchr(dir, '\\');
+		if(!slash) return false;
+		*slash = '\0';
+	} else {
+		PWSTR wide = NULL;
+		if(FAILED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, NULL, &wide))) return false;
+		int len = WideCharToMultiByte(CP_ACP, 0, wide, -1, dir, sizeof(dir), NULL, NULL);
+		CoTaskMemFree(wide);
+		if(len <= 0 || strlen(dir) + sizeof("\\ComPortNotify") > sizeof(dir)) return false;
+		strcat(dir, "\\ComPortNotify");
+		CreateDirectoryA(dir, NULL);
+	}
+	return snprintf(out, size, "%s\\devices.db", dir) < (int)size;
+}
+
+static void read_file() {
+	HANDLE f = CreateFileA(g_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(f == INVALID_HANDLE_VALUE) return;
+	devdb_header_t h;
+	DWORD got = 0;
+	if(ReadFile(f, &h, sizeof(h), &got, NULL) && got == sizeof(h) && h.magic == DEVDB_MAGIC && h.version == DEVDB_VERSION && h.record_size == sizeof(devdb_record_t) && h.count <= DEVDB_MAX && h.count) {
+		DWORD size = h.count * (DWORD)sizeof(devdb_record_t);
+		devdb_record_t *records = (devdb_record_t *)malloc(size);
+		bool ok = records && ReadFile(f, records, size, &got, NULL) && got == size;
+		// only the merge holds the lock, a menu open meanwhile does not wait for the disk
+		AcquireSRWLockExclusive(&g_lock);
+		if(ok && grow(g_count + h.count)) {
+			for(uint32_t i = 0; i < h.count; i++) {
+				devdb_record_t *r = &records[i];
+				r->serial[sizeof(r->serial) - 1] = '\0';
+				devid_t id;
+				id.vid = r->vid;
+				id.pid = r->pid;
+				id.hash = r->hash;
+				strcpy(id.serial, r->serial);
+				if(find(&id) < 0) insert(r);
+			}
+		}
+		ReleaseSRWLockExclusive(&g_lock);
+		free(records);
+	}
+	CloseHandle(f);
+}
+
+void devdb_load() {
+	metrics_section(devdb_report);
+	if(!db_path(g_path, sizeof(g_path))) {
+		g_path[0] = '\0';
+		return;
+	}
+	g_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	g_stop = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if(g_wake && g_stop) g_thread = CreateThread(NULL, 0, writer, NULL, 0, NULL);
+}
+
+void devdb_read() {
+	if(g_path[0]) read_file();
+	InterlockedExchange(&g_read, 1);
+	if(g_dirty && g_wake) SetEvent(g_wake);
+}
+
+void devdb_close() {
+	if(g_thread) {
+		SetEvent(g_stop);
+		WaitForSingleObject(g_thread, INFINITE);
+		CloseHandle(g_thread);
+		g_thread = NULL;
+	}
+	// connections still open end with us, time we are not running is not counted
+	int64_t wall = evclock_to_wall_ns(evclock_now());
+	AcquireSRWLockExclusive(&g_lock);
+	for(uint32_t e = 0; e < g_count; e++) {
+		if(!g_since[e]) continue;
+		g_records[e].connected_ns += wall - g_since[e];
+		g_since[e] = 0;
+		g_live[e] = 0;
+		g_dirty = 1;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	flush();
+}
+
+void devdb_connected(const devid_t *id, uint64_t now, bool counted) {
+	if(!id->vid && !id->pid) return;
+	int64_t wall = evclock_to_wall_ns(now);
+	AcquireSRWLockExclusive(&g_lock);
+	int e = find(id);
+	if(e < 0) {
+		devdb_record_t r;
+		memset(&r, 0, sizeof(r));
+		r.vid = id->vid;
+		r.pid = id->pid;
+		r.hash = id->hash;
+		strcpy(r.serial, id->serial);
+		r.first_seen = wall;
+		// a device new to us counts even when it was already there at startup
+		counted = true;
+		e = insert(&r);
+	}
+	if(e >= 0) {
+		devdb_record_t *r = &g_records[e];
+		r->last_seen = wall;
+		if(counted) r->connects++;
+		if(!g_live[e]++) g_since[e] = wall;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	changed();
+}
+
+void devdb_removed(const devid_t *id, uint64_t now) {
+	if(!id->vid && !id->pid) return;
+	int64_t wall = evclock_to_wall_ns(now);
+	uint32_t day = day_of(wall);
+	AcquireSRWLockExclusive(&g_lock);
+	int e = find(id);
+	if(e >= 0) {
+		devdb_record_t *r = &g_records[e];
+		// a removal held back by flap detection comes late
+		if(wall > r->last_seen) r->last_seen = wall;
+		r->removals++;
+		if(r->day != day) {
+			r->day = day;
+			r->removals_today = 0;
+		}
+		r->removals_today++;
+		// connected time runs while any board of the record is
+		if(g_live[e] && !--g_live[e] && g_since[e]) {
+			r->connected_ns += wall - g_since[e];
+			g_since[e] = 0;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	if(e >= 0) changed();
+}
+
+void devdb_flapped(const devid_t *id) {
+	AcquireSRWLockExclusive(&g_lock);
+	int e = find(id);
+	if(e >= 0) g_records[e].flaps++;
+	ReleaseSRWLockExclusive(&g_lock);
+	if(e >= 0) changed();
+}
+
+bool devdb_find(const devid_t *id, devdb_record_t *out) {
+	int64_t wall = evclock_to_wall_ns(evclock_now());
+	AcquireSRWLockShared(&g_lock);
+	int e = find(id);
+	if(e >= 0) {
+		*out = g_records[e];
+		if(g_since[e]) out->connected_ns += wall - g_since[e];
+	}
+	ReleaseSRWLockShared(&g_lock);
+	if(e < 0) return false;
+	if(out->day != day_of(wall)) out->removals_today = 0;
+	return true;
+}
@@ -0,0 +1,68 @@
+// Known device database
+//
+// Every device with a USB identity (VID, PID and serial, see devid.h) that
+// was ever connected: when it was first and last seen, how often it
+// connected, was removed (in total and today) and re-enumerated, and for
+// how long it has been connected in all. Devices without a serial number
+// share one record per VID:PID, its connected time runs while any of them
+// is connected.
+//
+// Records are kept in memory with a hash index by identity and written
+// to a file by a background thread a few seconds after they change, so
+// the event loop never waits for the disk. The file is devices.db in
+// %LOCALAPPDATA%\ComPortNotify, next to the executable in the portable
+// build (see settings.h), or DeviceDb (REG_SZ path).
+
+#ifndef DEVDB_H
+#define DEVDB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devid.h"
+
+#define DEVDB_FLUSH_MS 5000
+
+// file record, the in memory one is the same
+typedef struct {
+	uint16_t vid;
+	uint16_t pid;
+	uint32_t hash;                   // devid hash
+	char serial[DEVID_SERIAL_MAX];
+	int64_t first_seen;              // wall clock ns since the unix epoch
+	int64_t last_seen;               // last connect or removal
+	int64_t connected_ns;            // time connected, ended connections only in the file
+	uint32_t connects;
+	uint32_t removals;
+	uint32_t flaps;                  // re-enumerations
+	uint32_t day;                    // local date removals_today counts, yyyymmdd
+	uint32_t removals_today;
+	uint32_t reserved[3];
+} devdb_record_t;
+
+// find the file and start the writer, cheap enough for the UI thread
+void devdb_load();
+
+// read the file, once, before the first devdb_connected, it may be large
+// and is read off the UI thread. Nothing is written until it is in.
+void devdb_read();
+
+// write pending changes and stop the writer
+void devdb_close();
+
+// device connected at now (evclock ns), counted as a connect unless it was
+// just found present at startup
+void devdb_connected(const devid_t *id, uint64_t now, bool counted);
+
+// device removed at now, which is in the past for a removal flap detection
+// held back. A removal merged into a re-enumeration is not reported, its
+// connection goes on.
+void devdb_removed(const devid_t *id, uint64_t now);
+
+// device re-enumerated, the connect that completed it is not reported
+void devdb_flapped(const devid_t *id);
+
+// copy of the record of a device, connected_ns includes a connection in
+// progress and removals_today is 0 on another day, false if unknown
+bool devdb_find(const devid_t *id, devdb_record_t *out);
+
+#endif
@@ -0,0 +1,76 @@
+// Stable device identity
+//
+// See devid.h
+
+#include <string.h>
+#include <ctype.h>
+#include "devid.h"
+
+// Parse four hex digits following tag ("VID_", "PID_") in s
+static bool hex_after(const char *s, const char *tag, uint16_t *out) {
+	const char *p = strstr(s, tag);
+	if(!p) return false;
+	p += strlen(tag);
+	uint16_t v = 0;
+	for(int i = 0; i < 4; i++) {
+		char c = p[i];
+		int d;
+		if(c >= '0' && c <= '9') d = c - '0';
+		else if(c >= 'a' && c <= 'f') d = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F') d = c - 'A' + 10;
+		else return false;
+		v = (uint16_t)((v << 4) | d);
+	}
+	*out = v;
+	return true;
+}
+
+// Serial number from an instance ID
+// USB\VID_16C0&PID_0483\12345              -> 12345
+// FTDIBUS\VID_0403+PID_6001+A50285BIA\0000 -> A50285BI (FTDI appends the port letter)
+// Windows generated instance IDs contain '&' and carry no serial
+static void serial_from_instance(const char *instance, char *out, size_t size) {
+	out[0] = '\0';
+	const char *p = strstr(instance, "+PID_");
+	if(p && strlen(p) > 10 && p[9] == '+') {
+		p += 10;
+		size_t len = strcspn(p, "\\");
+		if(len > 1 && isalpha((unsigned char)p[len - 1])) len--;
+		if(len >= size) len = size - 1;
+		memcpy(out, p, len);
+		out[len] = '\0';
+		return;
+	}
+	p = strrchr(instance, '\\');
+	if(!p || strchr(p, '&')) return;
+	p++;
+	size_t len = strlen(p);
+	if(len >= size) len = size - 1;
+	memcpy(out, p, len);
+	out[len] = '\0';
+}
+
+uint32_t devid_hash(uint16_t vid, uint16_t pid, const char *serial) {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	uint8_t head[4] = { (uint8_t)(vid >> 8), (uint8_t)vid, (uint8_t)(pid >> 8), (uint8_t)pid };
+	for(int i = 0; i < 4; i++) h = (h ^ head[i]) * 16777619u;
+	if(serial) {
+		for(const char *p = serial; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+	}
+	return h;
+}
+
+bool devid_parse(devid_t *id, const char *hwid, const char *instance) {
+	memset(id, 0, sizeof(*id));
+	bool ok = false;
+	if(hwid) ok = hex_after(hwid, "VID_", &id->vid) && hex_after(hwid, "PID_", &id->pid);
+	if(!ok && instance) ok = hex_after(instance, "VID_", &id->vid) && hex_after(instance, "PID_", &id->pid);
+	if(instance) serial_from_instance(instance, id->serial, sizeof(id->serial));
+	id->hash = devid_hash(id->vid, id->pid, id->serial);
+	return ok;
+}
+
+bool devid_equal(const devid_t *a, const devid_t *b) {
+	return a->hash == b->hash && a->vid == b->vid && a->pid == b->pid && strcmp(a->serial, b->serial) == 0;
+}
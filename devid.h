@@ -0,0 +1,32 @@
+// Stable device identity
+//
+// VID, PID and USB serial number parsed from the hardware and instance IDs
+// that senum() reports. Unlike the COM port name these survive the device
+// moving to another port.
+
+#ifndef DEVID_H
+#define DEVID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DEVID_SERIAL_MAX 64
+
+typedef struct {
+	uint16_t vid;
+	uint16_t pid;
+	char serial[DEVID_SERIAL_MAX];   // empty if the device has none
+	uint32_t hash;                   // of vid, pid and serial
+} devid_t;
+
+// fill id from hwid (first hardware ID) and instance (device instance ID)
+// returns true if a VID/PID pair was found, either may be NULL
+bool devid_parse(devid_t *id, const char *hwid, const char *instance);
+
+// hash of vid, pid and serial, serial may be NULL
+uint32_t devid_hash(uint16_t vid, uint16_t pid, const char *serial);
+
+// true if a and b name the same device
+bool devid_equal(const devid_t *a, const devid_t *b);
+
+#endif
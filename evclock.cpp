@@ -0,0 +1,86 @@
+// Event clock
+//
+// See evclock.h
+
+#include <stddef.h>
+#include <windows.h>
+#include "evclock.h"
+
+static LARGE_INTEGER g_freq;
+
+static uint64_t system_mono_ns(void *ctx) {
+	(void)ctx;
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	uint64_t f = (uint64_t)g_freq.QuadPart;
+	uint64_t c = (uint64_t)t.QuadPart;
+	return (c / f) * EVCLOCK_NS_PER_SEC + (c % f) * EVCLOCK_NS_PER_SEC / f;
+}
+
+static int64_t system_wall_ns(void *ctx) {
+	(void)ctx;
+	FILETIME ft;
+	GetSystemTimePreciseAsFileTime(&ft);
+	ULARGE_INTEGER u;
+	u.LowPart = ft.dwLowDateTime;
+	u.HighPart = ft.dwHighDateTime;
+	// FILETIME counts 100ns intervals since 1601
+	return ((int64_t)u.QuadPart - 116444736000000000LL) * 100;
+}
+
+static const evclock_source_t system_source = { system_mono_ns, system_wall_ns, NULL };
+
+static evclock_source_t g_src = system_source;
+static uint64_t g_anchor_mono = 0;
+static int64_t g_anchor_wall = 0;
+static INIT_ONCE g_once = INIT_ONCE_STATIC_INIT;
+
+static void anchor() {
+	g_anchor_mono = g_src.mono_ns(g_src.ctx);
+	g_anchor_wall = g_src.wall_ns(g_src.ctx);
+}
+
+static BOOL CALLBACK init_once(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+	QueryPerformanceFrequency(&g_freq);
+	anchor();
+	return TRUE;
+}
+
+// First use from any thread anchors exactly once, the others wait for it
+static void ready() {
+	InitOnceExecuteOnce(&g_once, init_once, NULL, NULL);
+}
+
+void evclock_use(const evclock_source_t *src) {
+	ready();
+	g_src = src ? *src : system_source;
+	anchor();
+}
+
+static uint64_t manual_mono_ns(void *ctx) {
+	return ((evclock_manual_t *)ctx)->mono_ns;
+}
+
+static int64_t manual_wall_ns(void *ctx) {
+	return ((evclock_manual_t *)ctx)->wall_ns;
+}
+
+evclock_source_t evclock_manual_source(evclock_manual_t *m) {
+	evclock_source_t src = { manual_mono_ns, manual_wall_ns, m };
+	return src;
+}
+
+uint64_t evclock_now() {
+	ready();
+	return g_src.mono_ns(g_src.ctx);
+}
+
+int64_t evclock_to_wall_ns(uint64_t mono) {
+	ready();
+	return g_anchor_wall + (int64_t)(mono - g_anchor_mono);
+}
+
+time_t evclock_to_time(uint64_t mono) {
+	int64_t wall = evclock_to_wall_ns(mono);
+	return (time_t)(wall / (int64_t)EVCLOCK_NS_PER_SEC);
+}
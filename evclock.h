@@ -0,0 +1,41 @@
+// Event clock
+//
+// Monotonic nanosecond timestamps with a wall clock anchor taken once,
+// so events can be ordered and timed exactly while still being shown as
+// local time. The source is injectable for deterministic tests and replays.
+
+#ifndef EVCLOCK_H
+#define EVCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define EVCLOCK_NS_PER_SEC 1000000000ULL
+
+typedef struct {
+	uint64_t (*mono_ns)(void *ctx);   // monotonic, never goes back
+	int64_t (*wall_ns)(void *ctx);    // nanoseconds since the unix epoch
+	void *ctx;
+} evclock_source_t;
+
+// Manually driven source, set the fields and time is whatever they say
+typedef struct {
+	uint64_t mono_ns;
+	int64_t wall_ns;
+} evclock_manual_t;
+
+// switch clock source and re-anchor, NULL selects the system clock
+// call before other threads use the clock (startup, tests, replays)
+void evclock_use(const evclock_source_t *src);
+
+// source reading from a evclock_manual_t
+evclock_source_t evclock_manual_source(evclock_manual_t *m);
+
+// current monotonic timestamp in nanoseconds
+uint64_t evclock_now();
+
+// wall clock time of a monotonic timestamp
+int64_t evclock_to_wall_ns(uint64_t mono);
+time_t evclock_to_time(uint64_t mono);
+
+#endif
@@ -0,0 +1,165 @@
+// Flap detection
+//
+// See flap.h
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "flap.h"
+#include "serial.h"
+#include "topo.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "settings.h"
+
+static const DWORD DEFAULT_FLAP_WINDOW = 1500;
+static const DWORD DEFAULT_FLAP_LIMIT = 5;
+static const DWORD DEFAULT_FLAP_QUARANTINE = 300;
+
+#define FLAP_SLOTS  64
+#define FLAP_PERIOD (60 * EVCLOCK_NS_PER_SEC)
+
+// One tracked device, slots are recycled least recently used first, slots
+// holding a removal never
+typedef struct {
+	uint32_t key;
+	char label[96];          // identity for the metrics report
+	uint64_t last_ns;        // last event, 0 = free slot
+	char pending[32];        // device of a held removal, empty if none
+	devid_t pending_id;
+	uint64_t pending_at;     // when it was removed
+	uint64_t pending_until;
+	uint64_t period_start;   // start of the current flap counting period
+	uint32_t period_flaps;
+	uint32_t flaps;          // re-enumerations seen in total
+	uint64_t quiet_until;    // quarantined until, 0 if not
+} flap_t;
+
+static flap_t g_flaps[FLAP_SLOTS];
+static uint64_t g_window_ns = (uint64_t)DEFAULT_FLAP_WINDOW * 1000000;
+static DWORD g_limit = DEFAULT_FLAP_LIMIT;
+static uint64_t g_quarantine_ns = (uint64_t)DEFAULT_FLAP_QUARANTINE * EVCLOCK_NS_PER_SEC;
+
+static void flap_report(FILE *f) {
+	uint64_t now = evclock_now();
+	for(int i = 0; i < FLAP_SLOTS; i++) {
+		flap_t *fl = &g_flaps[i];
+		if(!fl->last_ns || !fl->flaps) continue;
+		fprintf(f, "flap %s reenumerations=%lu quarantined=%d\n", fl->label, (unsigned long)fl->flaps, fl->quiet_until > now ? 1 : 0);
+	}
+}
+
+void flap_load() {
+	static bool started = false;
+	if(!started) {
+		metrics_section(flap_report);
+		started = true;
+	}
+	g_window_ns = (uint64_t)settings_dword("", "FlapWindow", DEFAULT_FLAP_WINDOW) * 1000000;
+	g_limit = settings_dword("", "FlapLimit", DEFAULT_FLAP_LIMIT);
+	g_quarantine_ns = (uint64_t)settings_dword("", "FlapQuarantine", DEFAULT_FLAP_QUARANTINE) * EVCLOCK_NS_PER_SEC;
+}
+
+// Slot for a device, devices without VID/PID are known by their port,
+// devices without a serial number also by where they are plugged in
+// NULL if every slot holds a removal
+static flap_t *lookup(const devid_t *id, const char *device, const char *slot, uint64_t now) {
+	char label[96];
+	uint32_t key;
+	if(id->serial[0] && (id->vid || id->pid)) {
+		key = id->hash;
+		snprintf(label, sizeof(label), "%04x:%04x:%s", id->vid, id->pid, id->serial);
+	} else {
+		char where[TOPO_SLOT_MAX];
+		if(slot[0]) snprintf(where, sizeof(where), "%s", slot);
+		else sname(device, where, sizeof(where));
+		if(id->vid || id->pid) snprintf(label, sizeof(label), "%04x:%04x@%s", id->vid, id->pid, where);
+		else snprintf(label, sizeof(label), "%s", where);
+		key = devid_hash(id->vid, id->pid, where);
+	}
+	flap_t *lru = NULL;
+	for(int i = 0; i < FLAP_SLOTS; i++) {
+		flap_t *fl = &g_flaps[i];
+		if(fl->last_ns && fl->key == key && strcmp(fl->label, label) == 0) {
+			fl->last_ns = now;
+			return fl;
+		}
+		if(!fl->pending[0] && (!lru || fl->last_ns < lru->last_ns)) lru = fl;
+	}
+	if(!lru) return NULL;
+	memset(lru, 0, sizeof(*lru));
+	lru->key = key;
+	strcpy(lru->label, label);
+	lru->last_ns = now;
+	return lru;
+}
+
+int flap_removed(const devid_t *id, const char *device, const char *slot, uint64_t now) {
+	flap_t *fl = lookup(id, device, slot, now);
+	if(!fl) return FLAP_FRESH;
+	bool quiet = fl->quiet_until > now;
+	// one removal is held per device, another port of it (a dual port
+	// adapter) going meanwhile is reported at once rather than replacing it
+	if(!g_window_ns || fl->pending[0]) return quiet ? FLAP_QUIET : FLAP_FRESH;
+	// held while quarantined too, so continued flapping is still counted
+	strncpy(fl->pending, device, sizeof(fl->pending) - 1);
+	fl->pending[sizeof(fl->pending) - 1] = '\0';
+	fl->pending_id = *id;
+	fl->pending_at = now;
+	fl->pending_until = now + g_window_ns;
+	return FLAP_HOLD;
+}
+
+int flap_connected(const devid_t *id, const char *device, const char *slot, uint64_t now, char *old, size_t size) {
+	if(size) old[0] = '\0';
+	flap_t *fl = lookup(id, device, slot, now);
+	if(!fl) return FLAP_FRESH;
+	bool quiet = fl->quiet_until > now;
+	if(!fl->pending[0]) return quiet ? FLAP_QUIET : FLAP_FRESH;
+
+	// the held removal and this connect are one re-enumeration
+	snprintf(old, size, "%s", fl->pending);
+	fl->pending[0] = '\0';
+	fl->flaps++;
+	metrics_count(M_REENUMS, 1);
+	if(now - fl->period_start > FLAP_PERIOD) {
+		fl->period_start = now;
+		fl->period_flaps = 0;
+	}
+	fl->period_flaps++;
+	if(quiet) {
+		// still flapping, stay quarantined
+		fl->quiet_until = now + g_quarantine_ns;
+		return FLAP_QUIET;
+	}
+	if(g_limit && fl->period_flaps >= g_limit) {
+		fl->quiet_until = now + g_quarantine_ns;
+		fl->period_flaps = 0;
+		metrics_count(M_QUARANTINES, 1);
+		return FLAP_QUARANTINE;
+	}
+	return FLAP_REENUM;
+}
+
+uint64_t flap_next() {
+	uint64_t next = UINT64_MAX;
+	for(int i = 0; i < FLAP_SLOTS; i++) {
+		if(g_flaps[i].pending[0] && g_flaps[i].pending_until < next) next = g_flaps[i].pending_until;
+	}
+	return next;
+}
+
+bool flap_due(uint64_t now, flap_removal_t *out) {
+	for(int i = 0; i < FLAP_SLOTS; i++) {
+		flap_t *fl = &g_flaps[i];
+		if(fl->pending[0] && fl->pending_until <= now) {
+			snprintf(out->device, sizeof(out->device), "%s", fl->pending);
+			out->id = fl->pending_id;
+			out->removed_ns = fl->pending_at;
+			out->quiet = fl->quiet_until > now;
+			fl->pending[0] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,62 @@
+// Flap detection
+//
+// Boards that reset into a bootloader (Arduino 1200 baud touch, Teensy,
+// ESP32 auto-reset) vanish and come back within a second, often on
+// another port. Removals are held back for FlapWindow ms (DWORD under
+// HKCU\Software\ComPortNotify, default 1500, 0 disables): if a device with
+// the same identity connects meanwhile, both steps are reported as one
+// re-enumeration. Otherwise the removal is reported when the window ends.
+//
+// Devices are told apart by VID, PID and serial number. Boards without a
+// serial number are also told apart by the USB slot they are plugged into,
+// or their port if the slot is unknown, so identical boards do not share
+// a history. A device holds back one removal at a time, so when another
+// of its ports goes meanwhile, or every tracked device has a removal held
+// back, further removals are reported at once rather than held.
+//
+// A device that re-enumerates FlapLimit times (default 5) within a minute
+// is quarantined: its events are not announced until it has been quiet
+// for FlapQuarantine seconds (default 300).
+
+#ifndef FLAP_H
+#define FLAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "devid.h"
+
+enum {
+	FLAP_FRESH = 0,   // report as usual
+	FLAP_HOLD,        // removal held back, see flap_due
+	FLAP_REENUM,      // connect completes a held removal
+	FLAP_QUARANTINE,  // device just got quarantined
+	FLAP_QUIET        // device is quarantined, say nothing
+};
+
+// read flap settings
+void flap_load();
+
+// a held removal whose window ended
+typedef struct {
+	char device[32];
+	devid_t id;
+	uint64_t removed_ns;     // evclock time of the removal
+	bool quiet;              // device is quarantined, not to be announced
+} flap_removal_t;
+
+// device with identity id was removed from slot ("" if unknown) at now
+// returns FLAP_FRESH, FLAP_HOLD (quarantined devices too) or FLAP_QUIET
+int flap_removed(const devid_t *id, const char *device, const char *slot, uint64_t now);
+
+// device with identity id connected at slot at now, when it completes a
+// held removal old is set to the device it was removed from, else to ""
+// returns FLAP_FRESH, FLAP_REENUM, FLAP_QUARANTINE or FLAP_QUIET
+int flap_connected(const devid_t *id, const char *device, const char *slot, uint64_t now, char *old, size_t size);
+
+// evclock time the next held removal is due, UINT64_MAX if none
+uint64_t flap_next();
+
+// take a held removal that is due at now, true if out was set
+bool flap_due(uint64_t now, flap_removal_t *out);
+
+#endif
@@ -0,0 +1,233 @@
+// Frame delimiting
+//
+// See frame.h
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "frame.h"
+
+#define SLIP_END     0xC0
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+static const uint8_t *scan_bytes(const uint8_t *p, const uint8_t *end, uint8_t a, uint8_t b) {
+	while(p < end && *p != a && *p != b) p++;
+	return p;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static const uint8_t *scan_sse2(const uint8_t *p, const uint8_t *end, uint8_t a, uint8_t b) {
+	__m128i va = _mm_set1_epi8((char)a);
+	__m128i vb = _mm_set1_epi8((char)b);
+	while(end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+		if(m) return p + __builtin_ctz(m);
+		p += 16;
+	}
+	return scan_bytes(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *scan_avx2(const uint8_t *p, const uint8_t *end, uint8_t a, uint8_t b) {
+	__m256i va = _mm256_set1_epi8((char)a);
+	__m256i vb = _mm256_set1_epi8((char)b);
+	while(end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+		if(m) return p + __builtin_ctz(m);
+		p += 32;
+	}
+	return scan_sse2(p, end, a, b);
+}
+#endif
+
+typedef const uint8_t *(*scan_fn)(const uint8_t *p, const uint8_t *end, uint8_t a, uint8_t b);
+
+static const struct {
+	const char *name;
+	scan_fn fn;
+} g_scans[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ "avx2", scan_avx2 },
+	{ "sse2", scan_sse2 },
+#endif
+	{ "bytes", scan_bytes }
+};
+
+#define SCANS (sizeof(g_scans) / sizeof(g_scans[0]))
+
+// chosen on first use, racing threads pick the same one
+static int g_scan = -1;
+
+static bool supported(int i) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(g_scans[i].fn == scan_avx2) return __builtin_cpu_supports("avx2");
+	if(g_scans[i].fn == scan_sse2) return __builtin_cpu_supports("sse2");
+#endif
+	return true;
+}
+
+const uint8_t *frame_scan(const uint8_t *p, const uint8_t *end, uint8_t a, uint8_t b) {
+	if(g_scan < 0) {
+		int i = 0;
+		while(!supported(i)) i++;
+		g_scan = i;
+	}
+	return g_scans[g_scan].fn(p, end, a, b);
+}
+
+const char *frame_impl() {
+	frame_scan(NULL, NULL, 0, 0);
+	return g_scans[g_scan].name;
+}
+
+bool frame_use(const char *impl) {
+	for(int i = 0; i < (int)SCANS; i++) {
+		if(strcmp(g_scans[i].name, impl) == 0 && supported(i)) {
+			g_scan = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+int frame_mode(const char *name) {
+	if(_stricmp(name, "line") == 0) return FRAME_LINE;
+	if(_stricmp(name, "slip") == 0) return FRAME_SLIP;
+	if(_stricmp(name, "cobs") == 0) return FRAME_COBS;
+	return -1;
+}
+
+bool frame_init(framer_t *f, int mode, uint32_t max_frame) {
+	memset(f, 0, sizeof(*f));
+	f->mode = mode;
+	f->size = max_frame;
+	f->buf = (uint8_t *)malloc(max_frame);
+	return f->buf != NULL;
+}
+
+void frame_free(framer_t *f) {
+	free(f->buf);
+	f->buf = NULL;
+}
+
+static void append(framer_t *f, const uint8_t *p, uint32_t n) {
+	if(f->overflow || !n) return;
+	if(n > f->size - f->used) {
+		f->overflow = true;
+		return;
+	}
+	memcpy(f->buf + f->used, p, n);
+	f->used += n;
+}
+
+// Decode a COBS frame into f->buf, which may also be the source
+// returns decoded length, -1 if malformed
+static int32_t cobs_decode(framer_t *f, const uint8_t *in, uint32_t len) {
+	uint32_t i = 0;
+	uint32_t o = 0;
+	while(i < len) {
+		uint8_t code = in[i++];
+		if(!code || code - 1u > len - i) return -1;
+		// output never overtakes input, so decoding in place is safe
+		for(uint8_t k = 1; k < code; k++) f->buf[o++] = in[i++];
+		if(code != 0xFF && i < len) f->buf[o++] = 0;
+	}
+	return (int32_t)o;
+}
+
+// Complete a frame, data is either a view or f->buf
+static void emit(framer_t *f, const uint8_t *data, uint32_t len, frame_fn fn, void *ctx) {
+	bool overflow = f->overflow;
+	f->used = 0;
+	f->overflow = false;
+	if(overflow) {
+		f->dropped++;
+		return;
+	}
+	if(f->mode == FRAME_LINE && len && data[len - 1] == '\r') len--;
+	if(f->mode == FRAME_COBS && len) {
+		int32_t n = cobs_decode(f, data, len);
+		if(n < 0) {
+			f->dropped++;
+			return;
+		}
+		data = f->buf;
+		len = (uint32_t)n;
+	}
+	if(!len) return;
+	f->frames++;
+	fn(ctx, data, len);
+}
+
+// Newline or COBS: one delimiter, frame bytes are taken as they are
+static void feed_plain(framer_t *f, const uint8_t *p, const uint8_t *end, frame_fn fn, void *ctx) {
+	uint8_t delim = f->mode == FRAME_LINE ? '\n' : 0;
+	while(p < end) {
+		const uint8_t *d = frame_scan(p, end, delim, delim);
+		if(d == end) {
+			append(f, p, (uint32_t)(end - p));
+			return;
+		}
+		if(f->used || f->overflow) {
+			append(f, p, (uint32_t)(d - p));
+			emit(f, f->buf, f->used, fn, ctx);
+		} else if(d - p > f->size) {
+			f->dropped++;
+		} else {
+			emit(f, p, (uint32_t)(d - p), fn, ctx);
+		}
+		p = d + 1;
+	}
+}
+
+// SLIP: frames without escapes are views, the rest are decoded into f->buf
+static void feed_slip(framer_t *f, const uint8_t *p, const uint8_t *end, frame_fn fn, void *ctx) {
+	while(p < end) {
+		if(f->esc) {
+			f->esc = false;
+			if(*p != SLIP_END) {
+				// RFC 1055 keeps bytes after a bad escape as they are
+				uint8_t c = *p == SLIP_ESC_END ? SLIP_END : *p == SLIP_ESC_ESC ? SLIP_ESC : *p;
+				append(f, &c, 1);
+				p++;
+				continue;
+			}
+		}
+		const uint8_t *d = frame_scan(p, end, SLIP_END, SLIP_ESC);
+		if(d < end && *d == SLIP_END && !f->used && !f->overflow && d - p <= f->size) {
+			emit(f, p, (uint32_t)(d - p), fn, ctx);
+			p = d + 1;
+			continue;
+		}
+		append(f, p, (uint32_t)(d - p));
+		if(d == end) return;
+		if(*d == SLIP_END) {
+			emit(f, f->buf, f->used, fn, ctx);
+		} else {
+			f->esc = true;
+		}
+		p = d + 1;
+	}
+}
+
+void frame_skip(framer_t *f) {
+	f->used = 0;
+	f->esc = false;
+	f->overflow = true;
+}
+
+void frame_feed(framer_t *f, const uint8_t *data, uint32_t len, frame_fn fn, void *ctx) {
+	if(f->mode == FRAME_SLIP) {
+		feed_slip(f, data, data + len, fn, ctx);
+	} else {
+		feed_plain(f, data, data + len, fn, ctx);
+	}
+}
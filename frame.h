@@ -0,0 +1,65 @@
+// Frame delimiting
+//
+// Splits a serial byte stream into frames: newline terminated text, SLIP
+// (RFC 1055) or COBS, each ended by a delimiter byte. Finding delimiters
+// is the hot loop, it runs 32 or 16 bytes at a time with AVX2 or SSE2,
+// picked at runtime, and byte by byte elsewhere.
+//
+// Frames that lie entirely within one frame_feed call and need no
+// decoding are handed out as views into the fed data, no copy. Frames
+// that span feeds, SLIP frames containing escapes and COBS frames are
+// assembled in the framer's own buffer. Empty frames are skipped, a
+// trailing '\r' is stripped from lines.
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum {
+	FRAME_LINE = 0,
+	FRAME_SLIP,
+	FRAME_COBS
+};
+
+// called for each complete frame, valid until the callback returns
+typedef void (*frame_fn)(void *ctx, const uint8_t *frame, uint32_t len);
+
+typedef struct {
+	int mode;
+	uint8_t *buf;       // frame being assembled
+	uint32_t size;      // longest frame accepted
+	uint32_t used;
+	bool esc;           // SLIP escape was the last byte fed
+	bool overflow;      // frame too long, skipping to the next delimiter
+	uint64_t frames;    // frames delivered
+	uint64_t dropped;   // frames dropped as too long or malformed
+} framer_t;
+
+// mode from a name ("line", "slip" or "cobs"), -1 if unknown
+int frame_mode(const char *name);
+
+// set up framer for frames of up to max_frame bytes
+bool frame_init(framer_t *f, int mode, uint32_t max_frame);
+
+void frame_free(framer_t *f);
+
+// feed len bytes of stream, calling fn for each frame completed
+void frame_feed(framer_t *f, const uint8_t *data, uint32_t len, frame_fn fn, void *ctx);
+
+// the stream lost bytes before the next feed: the frame being assembled
+// and whatever precedes the next delimiter are dropped
+void frame_skip(framer_t *f);
+
+// first byte in [p, end) equal to a or b, end if there is none
+const uint8_t *frame_scan(const uint8_t *p, const uint8_t *end, uint8_t a, uint8_t b);
+
+// name of the scan in use ("avx2", "sse2" or "bytes")
+const char *frame_impl();
+
+// use the named scan from now on, false if the CPU lacks it; for tests
+// and benchmarks, framers in use switch along
+bool frame_use(const char *impl);
+
+#endif
@@ -0,0 +1,181 @@
+// Port history
+//
+// See history.h
+//
+// Entries are on the list and in a chained hash index, both doubly
+// linked through a pointer to the link that points at them, so any entry
+// is unlinked in place. The index doubles once entries outnumber its
+// buckets and is freed with the last entry.
+
+#include <string.h>
+#include "history.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "mem.h"
+
+#define HISTORY_BUCKETS 64
+
+hport_t *history = NULL;
+
+static twheel_t g_expiry;
+static hport_t **g_index = NULL;
+static uint32_t g_buckets = 0;
+static uint32_t g_count = 0;
+
+static uint64_t expiry_tick(uint64_t ns) {
+	return ns / EVCLOCK_NS_PER_SEC;
+}
+
+// FNV-1a of a port name
+static uint32_t device_hash(const char *device) {
+	uint32_t h = 2166136261u;
+	for(const char *p = device; *p; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+	return h;
+}
+
+static void list_push(hport_t *hp) {
+	hp->next = history;
+	if(history) history->pprev = &hp->next;
+	hp->pprev = &history;
+	history = hp;
+}
+
+static void list_remove(hport_t *hp) {
+	*hp->pprev = hp->next;
+	if(hp->next) hp->next->pprev = hp->pprev;
+}
+
+static void index_insert(hport_t *hp) {
+	hport_t **head = &g_index[hp->hash & (g_buckets - 1)];
+	hp->hash_next = *head;
+	if(*head) (*head)->hash_pprev = &hp->hash_next;
+	hp->hash_pprev = head;
+	*head = hp;
+}
+
+static void index_remove(hport_t *hp) {
+	*hp->hash_pprev = hp->hash_next;
+	if(hp->hash_next) hp->hash_next->hash_pprev = hp->hash_pprev;
+}
+
+// Double the buckets and rehash, false if out of memory (chains just get longer)
+static bool index_grow() {
+	uint32_t n = g_buckets ? g_buckets * 2 : HISTORY_BUCKETS;
+	hport_t **index = (hport_t **)mem_alloc(MEM_HISTORY, n * sizeof(hport_t *));
+	if(!index) return false;
+	memset(index, 0, n * sizeof(hport_t *));
+	mem_free(g_index);
+	g_index = index;
+	g_buckets = n;
+	for(hport_t *hp = history; hp; hp = hp->next) index_insert(hp);
+	return true;
+}
+
+void history_init(uint64_t now) {
+	tw_init(&g_expiry, expiry_tick(now));
+}
+
+hport_t *history_find(const char *device) {
+	if(!g_index) return NULL;
+	uint32_t h = device_hash(device);
+	for(hport_t *hp = g_index[h & (g_buckets - 1)]; hp; hp = hp->hash_next) {
+		if(hp->hash == h && strcmp(hp->device, device) == 0) return hp;
+	}
+	return NULL;
+}
+
+hport_t *history_add(const char *device, const char *name, const char *hwid) {
+	if(g_count >= g_buckets && !index_grow() && !g_index) return NULL;
+	hport_t *n = (hport_t *)mem_alloc(MEM_HISTORY, sizeof(hport_t));
+	if(!n) return NULL;
+	memset(n, 0, sizeof(hport_t));
+	n->device = mem_strdup(MEM_HISTORY, device);
+	n->name = mem_strdup(MEM_HISTORY, name);
+	n->hwid = hwid ? mem_strdup(MEM_HISTORY, hwid) : NULL;
+	metrics_count(M_ALLOCS, hwid ? 4 : 3);
+	if(!n->device || !n->name || (hwid && !n->hwid)) {
+		mem_free(n->device);
+		mem_free(n->name);
+		mem_free(n->hwid);
+		mem_free(n);
+		return NULL;
+	}
+	n->hash = device_hash(device);
+	list_push(n);
+	index_insert(n);
+	g_count++;
+	return n;
+}
+
+void history_to_head(hport_t *hp) {
+	if(hp == history) return;
+	list_remove(hp);
+	list_push(hp);
+}
+
+// Unlink and free an entry, the index goes with the last one
+static void drop(hport_t *hp) {
+	list_remove(hp);
+	index_remove(hp);
+	tw_cancel(&g_expiry, &hp->expiry);
+	mem_free(hp->device);
+	mem_free(hp->name);
+	if(hp->hwid) mem_free(hp->hwid);
+	mem_free(hp);
+	if(--g_count == 0) {
+		mem_free(g_index);
+		g_index = NULL;
+		g_buckets = 0;
+	}
+}
+
+static uint32_t g_expired;
+
+static void expire_hport(tw_node_t *n) {
+	hport_t *hp = (hport_t *)n->ctx;
+	if(hp->connected) return;
+	drop(hp);
+	g_expired++;
+}
+
+void history_schedule(hport_t *hp, int timeout) {
+	if(hp->connected || timeout < 0) {
+		tw_cancel(&g_expiry, &hp->expiry);
+		return;
+	}
+	uint64_t deadline = expiry_tick(hp->disconnected_at + EVCLOCK_NS_PER_SEC - 1) + (uint64_t)timeout;
+	tw_schedule(&g_expiry, &hp->expiry, deadline, hp);
+}
+
+uint32_t history_expire(uint64_t now) {
+	g_expired = 0;
+	tw_advance(&g_expiry, expiry_tick(now), expire_hport);
+	return g_expired;
+}
+
+uint64_t history_next_expiry() {
+	uint64_t next = tw_next_tick(&g_expiry);
+	return next == UINT64_MAX ? UINT64_MAX : next * EVCLOCK_NS_PER_SEC;
+}
+
+uint32_t history_trim(int limit) {
+	if(g_count <= (uint32_t)limit) return 0;
+	int disconnected = 0;
+	for(hport_t *hp = history; hp; hp = hp->next) {
+		if(!hp->connected) disconnected++;
+	}
+	// the list is newest first: keep the newest disconnected entries that
+	// fit and drop the rest on the way, connected ones always stay
+	int keep = disconnected - (int)(g_count - limit);
+	uint32_t dropped = 0;
+	hport_t *hp = history;
+	while(hp) {
+		hport_t *next = hp->next;
+		if(!hp->connected && keep-- <= 0) {
+			drop(hp);
+			dropped++;
+		}
+		hp = next;
+	}
+	return dropped;
+}
@@ -0,0 +1,70 @@
+// Port history
+//
+// Every port seen since startup, newest change first. Connected ports
+// stay, disconnected ones until their "Hide after" time runs out or
+// HistoryLimit pushes them out, least recently changed first. Entries and
+// their strings are MEM_HISTORY allocations. Entries are indexed by a
+// hash of the port name, so finding, moving and dropping one does not
+// walk the list. Expiry runs on a timer wheel with ticks of whole evclock
+// seconds. UI thread only.
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devid.h"
+#include "topo.h"
+#include "timerwheel.h"
+
+typedef struct hport {
+	char * device;
+	char * name;
+	char * hwid;
+	uint64_t connected_at;     // evclock ns of the OS event, 0 = present at startup
+	uint64_t disconnected_at;  // evclock ns of the OS event
+	devid_t id;
+	uint32_t lines;            // modem input lines (SLINE_*), if watched
+	char slot[TOPO_SLOT_MAX];  // USB socket it is or was plugged into
+	bool connected;
+	bool muted;                // flapping, capture, bridges and the like are not run
+	tw_node_t expiry;
+	struct hport *next;
+	struct hport **pprev;      // list and index links, see history.cpp
+	struct hport *hash_next;
+	struct hport **hash_pprev;
+	uint32_t hash;             // of device
+} hport_t;
+
+// newest change first
+extern hport_t *history;
+
+// start the expiry wheel at evclock time now
+void history_init(uint64_t now);
+
+// entry of device, NULL if it is not in history
+hport_t *history_find(const char *device);
+
+// new entry at the head with copies of the strings, hwid may be NULL
+// other fields are zero, NULL if out of memory
+hport_t *history_add(const char *device, const char *name, const char *hwid);
+
+// move hp to the head, it changed last
+void history_to_head(hport_t *hp);
+
+// drop hp timeout seconds after it was disconnected, a connected hp or a
+// timeout < 0 is never dropped
+void history_schedule(hport_t *hp, int timeout);
+
+// drop disconnected entries whose time ran out by evclock time now,
+// returns how many
+uint32_t history_expire(uint64_t now);
+
+// evclock time of the next expiry, UINT64_MAX if none is pending
+uint64_t history_next_expiry();
+
+// drop disconnected entries beyond limit, least recently changed first,
+// returns how many
+uint32_t history_trim(int limit);
+
+#endif
@@ -0,0 +1,207 @@
+// Modem line watch
+//
+// See lines.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "lines.h"
+#include "serial.h"
+#include "broker.h"
+#include "profile.h"
+#include "evclock.h"
+#include "metrics.h"
+#include "mem.h"
+#include "settings.h"
+
+static const char *LINES = "Lines";
+
+typedef struct {
+	char name[96];
+	uint32_t notify;         // SLINE_* that raise a notification
+} lines_conf_t;
+
+typedef struct watch {
+	char device[32];
+	char fmt[64];
+	uint32_t notify;
+	bool stop;               // guarded by g_lock
+	broker_t *broker;        // guarded by g_lock, set while waiting on the port
+	struct watch *next;
+} watch_t;
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static watch_t *g_watches = NULL;
+static lines_conf_t *g_conf = NULL;
+static int g_nconf = 0;
+static HWND g_hwnd = NULL;
+static UINT g_msg = 0;
+
+static const struct {
+	const char *name;
+	uint32_t line;
+} g_names[] = {
+	{ "CTS", SLINE_CTS }, { "DSR", SLINE_DSR }, { "DCD", SLINE_DCD }, { "RI", SLINE_RI }
+};
+
+// "dcd,ri" or "all" to SLINE_*
+static uint32_t parse_lines(char *s) {
+	uint32_t lines = 0;
+	for(char *tok = strtok(s, ", "); tok; tok = strtok(NULL, ", ")) {
+		if(_stricmp(tok, "all") == 0) lines |= SLINE_CTS | SLINE_DSR | SLINE_DCD | SLINE_RI;
+		for(size_t i = 0; i < sizeof(g_names) / sizeof(g_names[0]); i++) {
+			if(_stricmp(tok, g_names[i].name) == 0) lines |= g_names[i].line;
+		}
+	}
+	return lines;
+}
+
+// settings_values callback, ctx is the capacity of g_conf
+static void add_conf(const char *name, const char *value, void *ctx) {
+	if(!value || g_nconf >= *(int *)ctx) return;
+	lines_conf_t *c = &g_conf[g_nconf];
+	char data[64];
+	if(strlen(name) >= sizeof(c->name) || strlen(value) >= sizeof(data)) return;
+	strcpy(c->name, name);
+	strcpy(data, value);
+	c->notify = parse_lines(data);
+	g_nconf++;
+}
+
+void lines_load(HWND hwnd, UINT msg) {
+	g_hwnd = hwnd;
+	g_msg = msg;
+	free(g_conf);
+	g_conf = NULL;
+	g_nconf = 0;
+	int count = (int)settings_values(LINES, NULL, NULL);
+	if(!count) return;
+	g_conf = (lines_conf_t *)calloc(count, sizeof(lines_conf_t));
+	if(g_conf) settings_values(LINES, add_conf, &count);
+}
+
+// Configuration for a device, most specific name first
+static const lines_conf_t *find_conf(const char *device, const devid_t *id) {
+	char names[3][96];
+	snprintf(names[0], sizeof(names[0]), "%04x:%04x:%s", id->vid, id->pid, id->serial);
+	snprintf(names[1], sizeof(names[1]), "%04x:%04x", id->vid, id->pid);
+	sname(device, names[2], sizeof(names[2]));
+	for(int n = id->serial[0] ? 0 : 1; n < 3; n++) {
+		if(n < 2 && !id->vid && !id->pid) continue;
+		for(int i = 0; i < g_nconf; i++) {
+			if(_stricmp(g_conf[i].name, names[n]) == 0) return &g_conf[i];
+		}
+	}
+	return NULL;
+}
+
+static void post(watch_t *w, uint32_t lines, uint32_t changed, uint64_t at) {
+	lines_event_t *e = (lines_event_t *)mem_alloc(MEM_NOTIFY, sizeof(lines_event_t));
+	if(!e) return;
+	strncpy(e->device, w->device, sizeof(e->device) - 1);
+	e->device[sizeof(e->device) - 1] = '\0';
+	e->lines = lines;
+	e->changed = changed;
+	e->notify = changed & w->notify;
+	e->at = at;
+	if(!PostMessage(g_hwnd, g_msg, 0, (LPARAM)e)) mem_free(e);
+}
+
+static void unlink_watch(watch_t *w) {
+	for(watch_t **pp = &g_watches; *pp; pp = &(*pp)->next) {
+		if(*pp == w) {
+			*pp = w->next;
+			break;
+		}
+	}
+}
+
+static DWORD WINAPI watch_thread(LPVOID param) {
+	watch_t *w = (watch_t *)param;
+	broker_t *b = broker_acquire(w->device, w->fmt);
+	AcquireSRWLockExclusive(&g_lock);
+	bool stop = w->stop;
+	if(!stop) w->broker = b;
+	ReleaseSRWLockExclusive(&g_lock);
+	if(b && !stop) {
+		int32_t now = broker_lines(b);
+		uint32_t last = now < 0 ? 0 : (uint32_t)now;
+		// initial state, for the port tables
+		post(w, last, 0, evclock_now());
+		uint32_t lines, changed;
+		while(broker_wait_lines(b, &lines, &changed) > 0) {
+			uint64_t at = evclock_now();
+			// edges in the event mask and level changes both count
+			changed |= lines ^ last;
+			last = lines;
+			if(!changed) continue;
+			metrics_count(M_LINE_EVENTS, 1);
+			post(w, lines, changed, at);
+		}
+	}
+	AcquireSRWLockExclusive(&g_lock);
+	unlink_watch(w);
+	w->broker = NULL;
+	ReleaseSRWLockExclusive(&g_lock);
+	if(b) broker_release(b);
+	free(w);
+	return 0;
+}
+
+void lines_start(const char *device, const devid_t *id) {
+	if(!g_nconf || !g_hwnd) return;
+	const lines_conf_t *c = find_conf(device, id);
+	if(!c) return;
+	watch_t *w = (watch_t *)calloc(1, sizeof(watch_t));
+	if(!w) return;
+	strncpy(w->device, device, sizeof(w->device) - 1);
+	profile_format(id, w->fmt, sizeof(w->fmt));
+	w->notify = c->notify;
+	AcquireSRWLockExclusive(&g_lock);
+	watch_t *cur = g_watches;
+	while(cur && strcmp(cur->device, device) != 0) cur = cur->next;
+	if(!cur) {
+		w->next = g_watches;
+		g_watches = w;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	if(cur) {
+		// already watched
+		free(w);
+		return;
+	}
+	HANDLE h = CreateThread(NULL, 64 * 1024, watch_thread, w, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	if(!h) {
+		AcquireSRWLockExclusive(&g_lock);
+		unlink_watch(w);
+		ReleaseSRWLockExclusive(&g_lock);
+		free(w);
+		return;
+	}
+	CloseHandle(h);
+}
+
+void lines_stop(const char *device) {
+	AcquireSRWLockExclusive(&g_lock);
+	for(watch_t *w = g_watches; w; w = w->next) {
+		if(strcmp(w->device, device) == 0) {
+			unlink_watch(w);
+			w->stop = true;
+			if(w->broker) broker_cancel_lines(w->broker);
+			break;
+		}
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+}
+
+void lines_describe(const lines_event_t *e, char *out, size_t size) {
+	size_t len = 0;
+	out[0] = '\0';
+	for(size_t i = 0; i < sizeof(g_names) / sizeof(g_names[0]); i++) {
+		if(!(e->changed & g_names[i].line)) continue;
+		int n = snprintf(out + len, size - len, "%s%s %s", len ? ", " : "", g_names[i].name, (e->lines & g_names[i].line) ? "on" : "off");
+		if(n < 0 || (size_t)n >= size - len) break;
+		len += (size_t)n;
+	}
+}
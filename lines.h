@@ -0,0 +1,44 @@
+// Modem line watch
+//
+// Reports changes of the modem input lines (CTS, DSR, DCD, RI) of
+// selected ports, for boards that signal "ready" or "fault" on a line.
+// Add a REG_SZ value under HKCU\Software\ComPortNotify\Lines named after
+// the device ("<vid>:<pid>:<serial>", "<vid>:<pid>" or "COM5"); its data
+// lists the lines that raise a notification ("dcd,ri", "all", or empty
+// to only track them).
+//
+// The port is opened through the broker and a thread waits in an
+// overlapped WaitCommEvent, so edges arrive as they happen and nothing
+// polls. Each change is timestamped on that thread and posted to the
+// window; the line state goes into the published port table and the
+// shared memory table.
+
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdint.h>
+#include <windows.h>
+#include "devid.h"
+
+typedef struct {
+	char device[32];
+	uint32_t lines;       // SLINE_* after the change
+	uint32_t changed;     // SLINE_* that changed
+	uint32_t notify;      // changed lines configured to notify
+	uint64_t at;          // evclock ns of the change
+} lines_event_t;
+
+// read configuration, changes are posted to hwnd as msg with a
+// lines_event_t in lParam that the receiver releases with mem_free
+void lines_load(HWND hwnd, UINT msg);
+
+// watch device if it is configured
+void lines_start(const char *device, const devid_t *id);
+
+// stop watching device
+void lines_stop(const char *device);
+
+// "DCD on, RI off" for the changed lines of e
+void lines_describe(const lines_event_t *e, char *out, size_t size);
+
+#endif
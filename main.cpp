@@ -3,6 +3,25 @@
 #include <time.h>
 #include "resource.h"
 #include "serial.h"
+#include "metrics.h"
+#include "evclock.h"
+#include "devid.h"
+#include "rules.h"
+#include "capture.h"
+#include "bridge.h"
+#include "broker.h"
+#include "alert.h"
+#include "flap.h"
+#include "mem.h"
+#include "ptable.h"
+#include "portshm.h"
+#include "await.h"
+#include "lines.h"
+#include "topo.h"
+#include "settings.h"
+#include "devdb.h"
+#include "snap.h"
+#include "history.h"
 #include <shlobj.h>
 #include <shobjidl.h>
 #include <propkey.h>
@@ -16,7 +35,8 @@ char * mpprintf(const char *fmt, ...) {
     va_copy(args2, args);
 	size_t needed = vsnprintf(NULL, 0, fmt, args2) + 1;
     va_end(args2);
-    char * buffer = (char *)malloc(needed);
+    char * buffer = (char *)mem_alloc(MEM_NOTIFY, needed);
+    metrics_count(M_ALLOCS, 1);
     if(buffer) vsnprintf(buffer, needed, fmt, args);
     va_end(args);
 	return buffer;
@@ -54,36 +74,25 @@ int get_disconnected_mode();
 int get_disconnected_timeout();
 bool set_disconnected_mode(int mode);
 bool set_disconnected_timeout(int seconds);
+int get_history_limit();
 
-// Port linked list
-typedef struct lport {
-	char * device;
-	char * name;
-	char * hwid;
-	struct lport *next;
-} lport_t;
-
-// Port history list
-typedef struct hport {
-	char * device;
-	char * name;
-	char * hwid;
-	time_t connected_at;
-	time_t disconnected_at;
-	bool connected;
-	bool seen;
-	struct hport *next;
-} hport_t;
-
-static hport_t *find_hport(const char *device);
-static void move_hport_to_head(hport_t *prev, hport_t *cur);
+static void schedule_expiry(hport_t *hp);
+static void run_expiry();
+static void reschedule_expiry();
+static void enforce_history_limit();
+static void announce_connect(hport_t *hp, int flap, const char *old, char *tooltip, size_t size, uint64_t now);
+static void announce_removal(hport_t *hp, char *tooltip, size_t size, uint64_t now);
+static void arm_flap_timer();
+static void run_flap();
+static void publish_ports();
 
 // Toast settings
-static const char *SETTINGS_KEY = "Software\\ComPortNotify";
 static const char *TOAST_AUMID = "DSp.Tools.CPNotify.1";
 static const char *SETTINGS_STARTUP_LINK = "StartupLinkName";
 static const char *DEFAULT_STARTUP_LINK = "ComPortNotify.lnk";
 static const char *SETTINGS_NOTIF_MODE = "NotificationMode";
+static const char *SETTINGS_HISTORY_LIMIT = "HistoryLimit";
+static const int DEFAULT_HISTORY_LIMIT = 256;
 
 enum {
 	NOTIF_MODE_OFF = 0,
@@ -108,97 +117,45 @@ static bool get_startup_dir(char *buffer, DWORD size) {
 }
 
 static bool get_startup_link_name(char *buffer, DWORD size) {
-	HKEY hKey;
-	if(RegOpenKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) return false;
-	DWORD type = 0;
-	DWORD bufSize = size;
-	LONG result = RegQueryValueExA(hKey, SETTINGS_STARTUP_LINK, NULL, &type, (LPBYTE)buffer, &bufSize);
-	RegCloseKey(hKey);
-	return (result == ERROR_SUCCESS && type == REG_SZ && buffer[0]);
+	return settings_string("", SETTINGS_STARTUP_LINK, buffer, size) && buffer[0];
 }
 
 static void set_startup_link_name(const char *name) {
-	HKEY hKey;
-	if(RegCreateKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, NULL, 0, KEY_SET_VALUE, NULL, &hKey, NULL) != ERROR_SUCCESS) {
-		return;
-	}
-	if(name && name[0]) {
-		RegSetValueExA(hKey, SETTINGS_STARTUP_LINK, 0, REG_SZ, (const BYTE *)name, (DWORD)(strlen(name) + 1));
-	} else {
-		RegDeleteValueA(hKey, SETTINGS_STARTUP_LINK);
-	}
-	RegCloseKey(hKey);
+	settings_set_string("", SETTINGS_STARTUP_LINK, name && name[0] ? name : NULL);
 }
 
 int get_notification_mode() {
-	HKEY hKey;
-	if(RegOpenKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) return NOTIF_MODE_BALLOON;
-	DWORD value = 0;
-	DWORD size = sizeof(value);
-	DWORD type = 0;
-	LONG result = RegQueryValueExA(hKey, SETTINGS_NOTIF_MODE, NULL, &type, (LPBYTE)&value, &size);
-	RegCloseKey(hKey);
-	if(result != ERROR_SUCCESS || type != REG_DWORD) return NOTIF_MODE_BALLOON;
+	DWORD value = settings_dword("", SETTINGS_NOTIF_MODE, NOTIF_MODE_BALLOON);
 	if(value > NOTIF_MODE_TOAST) return NOTIF_MODE_BALLOON;
 	return (int)value;
 }
 
 bool set_notification_mode(int mode) {
-	HKEY hKey;
-	if(RegCreateKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, NULL, 0, KEY_SET_VALUE, NULL, &hKey, NULL) != ERROR_SUCCESS) {
-		return false;
-	}
-	DWORD value = (DWORD)mode;
-	bool ok = (RegSetValueExA(hKey, SETTINGS_NOTIF_MODE, 0, REG_DWORD, (const BYTE *)&value, sizeof(value)) == ERROR_SUCCESS);
-	RegCloseKey(hKey);
-	return ok;
+	return settings_set_dword("", SETTINGS_NOTIF_MODE, (uint32_t)mode);
 }
 
 int get_disconnected_mode() {
-	HKEY hKey;
-	if(RegOpenKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) return 0;
-	DWORD value = 0;
-	DWORD size = sizeof(value);
-	DWORD type = 0;
-	LONG result = RegQueryValueExA(hKey, "DisconnectedMode", NULL, &type, (LPBYTE)&value, &size);
-	RegCloseKey(hKey);
-	if(result != ERROR_SUCCESS || type != REG_DWORD) return 0;
+	DWORD value = settings_dword("", "DisconnectedMode", 0);
 	if(value > 2) return 0;
 	return (int)value;
 }
 
 int get_disconnected_timeout() {
-	HKEY hKey;
-	if(RegOpenKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, KEY_QUERY_VALUE, &hKey) != ERROR_SUCCESS) return 60;
-	DWORD value = 60;
-	DWORD size = sizeof(value);
-	DWORD type = 0;
-	LONG result = RegQueryValueExA(hKey, "DisconnectedTimeout", NULL, &type, (LPBYTE)&value, &size);
-	RegCloseKey(hKey);
-	if(result != ERROR_SUCCESS || type != REG_DWORD) return 60;
-	return (int)value;
+	return (int)settings_dword("", "DisconnectedTimeout", 60);
 }
 
 bool set_disconnected_mode(int mode) {
-	HKEY hKey;
-	if(RegCreateKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, NULL, 0, KEY_SET_VALUE, NULL, &hKey, NULL) != ERROR_SUCCESS) {
-		return false;
-	}
-	DWORD value = (DWORD)mode;
-	bool ok = (RegSetValueExA(hKey, "DisconnectedMode", 0, REG_DWORD, (const BYTE *)&value, sizeof(value)) == ERROR_SUCCESS);
-	RegCloseKey(hKey);
-	return ok;
+	return settings_set_dword("", "DisconnectedMode", (uint32_t)mode);
 }
 
 bool set_disconnected_timeout(int seconds) {
-	HKEY hKey;
-	if(RegCreateKeyExA(HKEY_CURRENT_USER, SETTINGS_KEY, 0, NULL, 0, KEY_SET_VALUE, NULL, &hKey, NULL) != ERROR_SUCCESS) {
-		return false;
-	}
-	DWORD value = (DWORD)seconds;
-	bool ok = (RegSetValueExA(hKey, "DisconnectedTimeout", 0, REG_DWORD, (const BYTE *)&value, sizeof(value)) == ERROR_SUCCESS);
-	RegCloseKey(hKey);
-	return ok;
+	return settings_set_dword("", "DisconnectedTimeout", (uint32_t)seconds);
+}
+
+int get_history_limit() {
+	DWORD value = settings_dword("", SETTINGS_HISTORY_LIMIT, 0);
+	if(value == 0) return DEFAULT_HISTORY_LIMIT;
+	return (int)value;
 }
 
 static bool shortcut_matches_toast(const char *path) {
@@ -477,179 +434,237 @@ bool delete_startup_shortcut() {
 	return false;
 }
 
-// Free ports linked list
-void free_lports(lport_t *p) {
-	while(p) {
-		free(p->device);
-		free(p->name);
-		free(p->hwid);
-		lport_t *_p = p;
-		p = p->next;
-		free(_p);
-	}
+// Previous and current enumeration, for change detection (see snap.h)
+// Ports of the startup scan that arrived after we started are SNAP_LATE
+static snap_t g_snaps[2];
+static snap_t *g_prev = &g_snaps[0];
+static snap_t *g_cur = &g_snaps[1];
+
+// History changed since it was last published to other threads
+static bool g_ports_dirty = false;
+
+// Startup: the first enumeration runs on a worker thread while the tray
+// icon is already up. Device events meanwhile are only noted, a refresh
+// after the scan picks up what they changed.
+static bool g_scanning = false;
+static uint64_t g_buffered_ns = 0;   // first device event during the scan, 0 = none
+static int64_t g_start_wall_ns = 0;  // wall clock at process start
+
+// sgeneration() at the last enumeration, events that leave it unchanged
+// concern other devices and skip the refresh
+static uint64_t g_ports_gen = 0;
+static uint64_t g_gen_checks = 0;    // refreshes that took the generation
+static uint64_t g_gen_skips = 0;     // ... and found nothing to enumerate
+
+// how many device events the generation check kept from a full scan
+static void enum_report(FILE *f) {
+	fprintf(f, "enum_avoided checks=%llu skipped=%llu percent=%llu\n",
+		(unsigned long long)g_gen_checks, (unsigned long long)g_gen_skips,
+		(unsigned long long)(g_gen_checks ? g_gen_skips * 100 / g_gen_checks : 0));
+}
+
+// Instrumentation: snapshot file (--metrics=<path>), notification time
+static char g_metrics_path[MAX_PATH];
+static int64_t g_notify_ticks = 0;
+
+// Add a port to the current snapshot
+void add_port(char *name, char *device, char *hwid, char *instance, char *location) {
+	char slot[TOPO_SLOT_MAX];
+	if(!topo_slot(location, slot, sizeof(slot))) slot[0] = '\0';
+	if(snap_add(g_cur, device, name, hwid, instance, slot)) metrics_count(M_PORTS, 1);
 }
 
-// Previous and current port list, for change detection
-lport_t * volatile _ports;
-hport_t *history;
-
-// Add new port to linked list
-void add_lport(char *name, char *device, char *hwid) {
-	lport_t * temp = (lport_t *)malloc(sizeof(lport_t));
-	char *dev = (char *)malloc(strlen(device) + 1);
-	char *nam = (char *)malloc(strlen(name) + 1);
-	char *hid = hwid ? _strdup(hwid) : NULL;
-	if(!temp || !dev || !nam || (hwid && !hid)) {
-		if(hid) free(hid);
-		if(nam) free(nam);
-		if(dev) free(dev);
-		if(temp) free(temp);
-		return;
+// Announce a port change: first change goes to the tooltip, each one to a notification
+// event_ns is when the OS reported the change, for latency stats
+static void notify_change(const char *text, char *tooltip, size_t size, uint64_t event_ns) {
+	int64_t t0 = metrics_ticks();
+	if(!tooltip[0]) {
+		strncpy(tooltip, text, size);
+		tooltip[size - 1] = '\0';
 	}
-	ZeroMemory(temp, sizeof(lport_t));
-	strcpy(dev, device);
-	strcpy(nam, name);
-	temp->device = dev;
-	temp->name = nam;
-	temp->hwid = hid;
-	temp->next = _ports;
-	_ports = temp;
+	wchar_t wtext[512];
+	MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 512);
+	show_notification(L"ComPortNotify", wtext);
+	metrics_record(H_EVENT_LATENCY, (evclock_now() - event_ns) / 1000);
+	g_notify_ticks += metrics_ticks() - t0;
 }
-
-// Refresh the ports list
-void refresh_ports(bool init = false) {
-	// TODO: List should note time of new connections
-	// TODO: Should show recent history and times on popup menu (disabled/grayed for disconnected ports, with timeout?)
-	char szTooltip[sizeof(notifyIconData.szTip)] = {0};
-	senum(add_lport); // List current ports to _ports
-	{
-		time_t now = time(NULL);
-		hport_t *hp = history;
-		while(hp) {
-			hp->seen = false;
-			hp = hp->next;
-		}
 
-		lport_t *a = _ports;
-		while(a) {
-		hport_t *found = find_hport(a->device);
-		if(found) {
-			found->seen = true;
-			if(strcmp(found->name, a->name) != 0) {
-				char *new_name = _strdup(a->name);
-				if(new_name) {
-					free(found->name);
-					found->name = new_name;
-				}
+// One refresh, for port_changed
+typedef struct {
+	bool init;
+	uint64_t now;
+	char *tooltip;
+	size_t size;
+} refresh_t;
+
+// Port hp came, start what runs for connected ports unless it is flapping
+static void port_up(hport_t *hp, refresh_t *r, bool late) {
+	uint64_t now = r->now;
+	bool counted = !r->init || late;
+	char old[32] = "";
+	int flap = counted ? flap_connected(&hp->id, hp->device, hp->slot, now, old, sizeof(old)) : FLAP_FRESH;
+	hp->muted = flap == FLAP_QUARANTINE || flap == FLAP_QUIET;
+	if(!hp->muted) {
+		capture_start(hp->device, &hp->id, false);
+		bridge_start(hp->device, &hp->id);
+		lines_start(hp->device, &hp->id);
+		broker_expose(hp->device, &hp->id);
+	}
+	// completing a held removal, the known device record never saw it go
+	if(old[0]) devdb_flapped(&hp->id);
+	else devdb_connected(&hp->id, now, counted);
+	await_connected(hp->device, &hp->id);
+	if(counted) announce_connect(hp, flap, old, r->tooltip, r->size, now);
+}
+
+// Port at pos of the new snapshot is new or has other details
+static void port_present(snap_t *s, uint32_t pos, refresh_t *r) {
+	const snap_str_t *p = snap_port(s, pos);
+	const char *device = snap_str(s, p->device);
+	const char *name = snap_str(s, p->name);
+	const char *hwid = snap_str(s, p->hwid);
+	const char *instance = snap_str(s, p->instance);
+	const char *slot = snap_str(s, p->slot);
+	bool late = (s->keys[pos].flags & SNAP_LATE) != 0;
+	uint64_t now = r->now;
+	hport_t *found = history_find(device);
+	if(found) {
+		devid_parse(&found->id, hwid, instance);
+		if(strcmp(found->slot, slot) != 0) {
+			strcpy(found->slot, slot);
+			// moved while connected, a hub that re-enumerated without the port going
+			if(found->connected) {
+				if(slot[0]) topo_set(found->device, slot);
+				else topo_remove(found->device);
 			}
-			if((found->hwid && a->hwid && strcmp(found->hwid, a->hwid) != 0) || (!found->hwid && a->hwid)) {
-				char *new_hwid = a->hwid ? _strdup(a->hwid) : NULL;
-				if(a->hwid == NULL || new_hwid) {
-					if(found->hwid) free(found->hwid);
-					found->hwid = new_hwid;
-				}
+		}
+		if(strcmp(found->name, name) != 0) {
+			char *new_name = mem_strdup(MEM_HISTORY, name);
+			if(new_name) {
+				mem_free(found->name);
+				found->name = new_name;
 			}
-			if(!found->connected) {
-					found->connected = true;
-					found->connected_at = now;
-					found->disconnected_at = 0;
-					if(found != history) {
-						hport_t *prev = history;
-						while(prev && prev->next != found) prev = prev->next;
-						move_hport_to_head(prev, found);
-					}
-					if(!init) {
-						char * text = mpprintf("Connected %s %s\n", found->device, found->name);
-						if(text) {
-							if(!szTooltip[0]) {
-								strncpy(szTooltip, text, sizeof(szTooltip));
-								szTooltip[sizeof(szTooltip) - 1] = '\0';
-							}
-							wchar_t wtext[512];
-							MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 512);
-							show_notification(L"ComPortNotify", wtext);
-							free(text);
-						}
-					}
-				}
-			} else {
-			hport_t *n = (hport_t *)malloc(sizeof(hport_t));
-			if(n) {
-				ZeroMemory(n, sizeof(hport_t));
-				n->device = _strdup(a->device);
-				n->name = _strdup(a->name);
-				n->hwid = a->hwid ? _strdup(a->hwid) : NULL;
-				if(n->device && n->name && (!a->hwid || n->hwid)) {
-					n->connected = true;
-					n->connected_at = init ? 0 : now;
-					n->disconnected_at = 0;
-					n->seen = true;
-					n->next = history;
-					history = n;
-						if(!init) {
-							char * text = mpprintf("Connected %s %s\n", n->device, n->name);
-							if(text) {
-								if(!szTooltip[0]) {
-									strncpy(szTooltip, text, sizeof(szTooltip));
-									szTooltip[sizeof(szTooltip) - 1] = '\0';
-								}
-								wchar_t wtext[512];
-								MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 512);
-								show_notification(L"ComPortNotify", wtext);
-								free(text);
-							}
-						}
-				} else {
-					if(n->device) free(n->device);
-					if(n->name) free(n->name);
-					if(n->hwid) free(n->hwid);
-					free(n);
-				}
-				}
+		}
+		if((found->hwid && hwid && strcmp(found->hwid, hwid) != 0) || (!found->hwid && hwid)) {
+			char *new_hwid = hwid ? mem_strdup(MEM_HISTORY, hwid) : NULL;
+			if(hwid == NULL || new_hwid) {
+				if(found->hwid) mem_free(found->hwid);
+				found->hwid = new_hwid;
 			}
-			a = a->next;
 		}
+		if(!found->connected) {
+			found->connected = true;
+			found->connected_at = now;
+			found->disconnected_at = 0;
+			schedule_expiry(found);
+			if(found->slot[0]) topo_set(found->device, found->slot);
+			metrics_count(M_CONNECTS, 1);
+			history_to_head(found);
+			port_up(found, r, late);
+		}
+		return;
+	}
+	hport_t *n = history_add(device, name, hwid);
+	if(n) {
+		devid_parse(&n->id, hwid, instance);
+		strcpy(n->slot, slot);
+		n->connected = true;
+		n->connected_at = r->init && !late ? 0 : now;
+		if(n->slot[0]) topo_set(n->device, n->slot);
+		metrics_count(M_CONNECTS, 1);
+		port_up(n, r, late);
+		return;
+	}
+	// not in history, the next enumeration reports the port as changed and retries
+	s->keys[pos].attr = 0;
+}
 
-		hp = history;
-		while(hp) {
-			if(hp->connected && !hp->seen) {
-				hp->connected = false;
-				hp->disconnected_at = now;
-				if(!init) {
-					if(hp != history) {
-						hport_t *pp = history;
-						while(pp && pp->next != hp) pp = pp->next;
-						move_hport_to_head(pp, hp);
-					}
-					char * text = mpprintf("Removed %s %s\n", hp->device, hp->name);
-					if(text) {
-						if(!szTooltip[0]) {
-							strncpy(szTooltip, text, sizeof(szTooltip));
-							szTooltip[sizeof(szTooltip) - 1] = '\0';
-						}
-						wchar_t wtext[512];
-						MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 512);
-						show_notification(L"ComPortNotify", wtext);
-						free(text);
-					}
-				}
-			}
+// Port gone since the previous snapshot
+static void port_gone(const char *device, refresh_t *r) {
+	hport_t *hp = history_find(device);
+	if(!hp || !hp->connected) return;
+	uint64_t now = r->now;
+	hp->connected = false;
+	hp->disconnected_at = now;
+	schedule_expiry(hp);
+	if(!hp->muted) {
+		capture_stop(hp->device);
+		bridge_stop(hp->device);
+		lines_stop(hp->device);
+		broker_unexpose(hp->device);
+	}
+	hp->lines = 0;
+	topo_remove(hp->device);
+	await_removed(hp->device, &hp->id);
+	metrics_count(M_REMOVALS, 1);
+	// a removal may be the first half of a re-enumeration, flap holds it
+	// back and the known device record waits for the verdict
+	int flap = r->init ? FLAP_FRESH : flap_removed(&hp->id, hp->device, hp->slot, now);
+	if(flap != FLAP_HOLD) devdb_removed(&hp->id, now);
+	if(flap == FLAP_FRESH) announce_removal(hp, r->tooltip, r->size, now);
+}
+
+static void port_changed(int change, snap_t *s, uint32_t pos, void *ctx) {
+	refresh_t *r = (refresh_t *)ctx;
+	if(change == SNAP_REMOVED) {
+		port_gone(snap_str(s, snap_port(s, pos)->device), r);
+	} else {
+		port_present(s, pos, r);
+	}
+}
 
-			hp = hp->next;
+// Refresh the ports list
+// event_ns is the evclock time the triggering OS event was received
+// scanned: g_cur already holds the current list (startup scan)
+void refresh_ports(bool init = false, uint64_t event_ns = 0, bool scanned = false) {
+	// TODO: List should note time of new connections
+	// TODO: Should show recent history and times on popup menu (disabled/grayed for disconnected ports, with timeout?)
+	char szTooltip[sizeof(notifyIconData.szTip)] = {0};
+	if(!scanned) {
+		uint64_t gen = sgeneration();
+		if(!init) g_gen_checks++;
+		if(!init && gen && gen == g_ports_gen) {
+			metrics_count(M_ENUMS_SKIPPED, 1);
+			g_gen_skips++;
+			return;
 		}
+		g_ports_gen = gen;
+		int64_t t_enum = metrics_ticks();
+		senum(add_port); // List current ports to g_cur
+		metrics_record_since(H_ENUM, t_enum);
+		metrics_count(M_ENUMS, 1);
+	}
+	int64_t t_diff = metrics_ticks();
+	g_notify_ticks = 0;
+	g_ports_dirty = true;
+	{
+		// the sorted snapshots are merged, ports that did not change cost a compare
+		refresh_t r = { init, event_ns ? event_ns : evclock_now(), szTooltip, sizeof(szTooltip) };
+		snap_sort(g_cur);
+		snap_diff(g_prev, g_cur, port_changed, &r);
 
-		if(!init && szTooltip[0]) {
+		if(szTooltip[0]) {
 			strncpy(notifyIconData.szTip, szTooltip, sizeof(notifyIconData.szTip));
 			notifyIconData.szTip[sizeof(notifyIconData.szTip) - 1] = '\0';
 			Shell_NotifyIcon(NIM_MODIFY, &notifyIconData);
 		}
 	}
 
-	free_lports(_ports);
-	_ports = NULL;
+	snap_t *done = g_prev;
+	g_prev = g_cur;
+	g_cur = done;
+	snap_clear(g_cur);
+
+	enforce_history_limit();
+	run_expiry();
+	arm_flap_timer();
+	await_dispatch();
 
+	// Diff time excludes notification dispatch, which has its own histogram
+	metrics_record_ticks(H_DIFF, metrics_ticks() - t_diff - g_notify_ticks);
+	if(g_metrics_path[0]) metrics_write(g_metrics_path);
 }
-
+
 // Populate the popup menu
 typedef struct menu_text {
 	char *prefix;
@@ -693,10 +708,10 @@ static void reset_menu_font() {
 static void free_menu_texts(menu_text_t *p) {
 	while(p) {
 		menu_text_t *n = p->next;
-		free(p->prefix);
-		free(p->desc);
-		free(p->right);
-		free(p);
+		mem_free(p->prefix);
+		mem_free(p->desc);
+		mem_free(p->right);
+		mem_free(p);
 		p = n;
 	}
 }
@@ -704,8 +719,8 @@ static void free_menu_texts(menu_text_t *p) {
 static void free_menu_clips(menu_clip_t *p) {
 	while(p) {
 		menu_clip_t *n = p->next;
-		free(p->text);
-		free(p);
+		mem_free(p->text);
+		mem_free(p);
 		p = n;
 	}
 }
@@ -734,33 +749,33 @@ static bool copy_to_clipboard(const char *text) {
 }
 
 static char *format_time_label(time_t now, time_t t, bool just_now_allowed) {
-	if(t == 0) return _strdup("Startup");
+	if(t == 0) return mem_strdup(MEM_MENU, "Startup");
 	if(t > now) t = now;
 
 	int age = (int)difftime(now, t);
 	if(age < 0) age = 0;
 
 	if(just_now_allowed && age < 30) {
-		return _strdup("Just now");
+		return mem_strdup(MEM_MENU, "Just now");
 	}
 	if(!just_now_allowed && age < 60) {
 		char buf[32];
 		snprintf(buf, sizeof(buf), "%ds", age);
-		return _strdup(buf);
+		return mem_strdup(MEM_MENU, buf);
 	}
 	if(age < 60) {
-		return _strdup("1 minute ago");
+		return mem_strdup(MEM_MENU, "1 minute ago");
 	}
 	if(age < 3600) {
 		int minutes = age / 60;
 		char buf[64];
 		snprintf(buf, sizeof(buf), "%d minute%s ago", minutes, minutes == 1 ? "" : "s");
-		return _strdup(buf);
+		return mem_strdup(MEM_MENU, buf);
 	}
 
 	struct tm tm_now;
 	struct tm tm_t;
-	if(localtime_s(&tm_now, &now) != 0 || localtime_s(&tm_t, &t) != 0) return _strdup("");
+	if(localtime_s(&tm_now, &now) != 0 || localtime_s(&tm_t, &t) != 0) return mem_strdup(MEM_MENU, "");
 
 	if(tm_now.tm_year == tm_t.tm_year && tm_now.tm_yday == tm_t.tm_yday) {
 		SYSTEMTIME st = {0};
@@ -772,13 +787,13 @@ static char *format_time_label(time_t now, time_t t, bool just_now_allowed) {
 		st.wSecond = (WORD)tm_t.tm_sec;
 		char buf[64];
 		if(GetTimeFormatA(LOCALE_USER_DEFAULT, 0, &st, NULL, buf, (int)sizeof(buf))) {
-			return _strdup(buf);
+			return mem_strdup(MEM_MENU, buf);
 		}
-		return _strdup("");
+		return mem_strdup(MEM_MENU, "");
 	}
 
 	if(tm_now.tm_year == tm_t.tm_year && tm_now.tm_yday == tm_t.tm_yday + 1) {
-		return _strdup("Yesterday");
+		return mem_strdup(MEM_MENU, "Yesterday");
 	}
 
 	SYSTEMTIME st = {0};
@@ -787,15 +802,47 @@ static char *format_time_label(time_t now, time_t t, bool just_now_allowed) {
 	st.wDay = (WORD)tm_t.tm_mday;
 	char buf[64];
 	if(GetDateFormatA(LOCALE_USER_DEFAULT, DATE_SHORTDATE, &st, NULL, buf, (int)sizeof(buf))) {
-		return _strdup(buf);
+		return mem_strdup(MEM_MENU, buf);
 	}
-	return _strdup("");
+	return mem_strdup(MEM_MENU, "");
+}
+
+// Known device statistics as grayed rows of a port submenu
+static void append_device_stats(HMENU sub, const devid_t *id) {
+	devdb_record_t r;
+	if(!devdb_find(id, &r)) return;
+	char buf[128];
+	char date[64];
+	time_t first = (time_t)(r.first_seen / (int64_t)EVCLOCK_NS_PER_SEC);
+	struct tm *tm = localtime(&first);
+	if(tm) {
+		SYSTEMTIME st = {0};
+		st.wYear = (WORD)(tm->tm_year + 1900);
+		st.wMonth = (WORD)(tm->tm_mon + 1);
+		st.wDay = (WORD)tm->tm_mday;
+		if(GetDateFormatA(LOCALE_USER_DEFAULT, DATE_SHORTDATE, &st, NULL, date, (int)sizeof(date))) {
+			snprintf(buf, sizeof(buf), "First seen %s", date);
+			AppendMenuA(sub, MF_STRING | MF_GRAYED, 0, buf);
+		}
+	}
+	snprintf(buf, sizeof(buf), "%lu connects, %lu removals today, %lu re-enumerations",
+		(unsigned long)r.connects, (unsigned long)r.removals_today, (unsigned long)r.flaps);
+	AppendMenuA(sub, MF_STRING | MF_GRAYED, 0, buf);
+	uint64_t minutes = (uint64_t)(r.connected_ns / (int64_t)EVCLOCK_NS_PER_SEC) / 60;
+	if(minutes >= 60 * 24) {
+		snprintf(buf, sizeof(buf), "Connected %lud %luh in all", (unsigned long)(minutes / (60 * 24)), (unsigned long)(minutes / 60 % 24));
+	} else {
+		snprintf(buf, sizeof(buf), "Connected %luh %lum in all", (unsigned long)(minutes / 60), (unsigned long)(minutes % 60));
+	}
+	AppendMenuA(sub, MF_STRING | MF_GRAYED, 0, buf);
 }
 
 void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
+	int64_t t_menu = metrics_ticks();
 	bool any = false;
 	int dmode = get_disconnected_mode();
-	time_t now = time(NULL);
+	uint64_t now_ns = evclock_now();
+	time_t now = evclock_to_time(now_ns);
 
 	hport_t * p = history;
 	int just_now_count = 0;
@@ -807,13 +854,13 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 		}
 		if(!scan->connected && dmode == 2) {
 			int dtimeout = get_disconnected_timeout();
-			if(now - scan->disconnected_at >= dtimeout) {
+			if(now_ns - scan->disconnected_at >= (uint64_t)dtimeout * EVCLOCK_NS_PER_SEC) {
 				scan = scan->next;
 				continue;
 			}
 		}
-		time_t t = scan->connected ? scan->connected_at : scan->disconnected_at;
-		if(t > 0 && difftime(now, t) >= 0 && difftime(now, t) < 30) {
+		uint64_t t = scan->connected ? scan->connected_at : scan->disconnected_at;
+		if(t > 0 && now_ns >= t && now_ns - t < 30 * EVCLOCK_NS_PER_SEC) {
 			just_now_count++;
 		}
 		scan = scan->next;
@@ -826,7 +873,7 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 		}
 		if(!p->connected && dmode == 2) {
 			int dtimeout = get_disconnected_timeout();
-			if(now - p->disconnected_at >= dtimeout) {
+			if(now_ns - p->disconnected_at >= (uint64_t)dtimeout * EVCLOCK_NS_PER_SEC) {
 				p = p->next;
 				continue;
 			}
@@ -835,18 +882,24 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 		char * prefix = NULL;
 		char * desc = NULL;
 		char * right = NULL;
-		time_t t = p->connected ? p->connected_at : p->disconnected_at;
-		prefix = _strdup(p->device);
-		desc = _strdup(p->name);
-		right = format_time_label(now, t, just_now_allowed);
+		uint64_t t = p->connected ? p->connected_at : p->disconnected_at;
+		prefix = mem_strdup(MEM_MENU, p->device);
+		if(p->slot[0]) {
+			char buf[256];
+			snprintf(buf, sizeof(buf), "%s @ %s", p->name, topo_label(p->slot));
+			desc = mem_strdup(MEM_MENU, buf);
+		} else {
+			desc = mem_strdup(MEM_MENU, p->name);
+		}
+		right = format_time_label(now, t ? evclock_to_time(t) : 0, just_now_allowed);
 		if(prefix && desc) {
 			UINT flags = MF_OWNERDRAW | MF_POPUP;
 			if(!p->connected) flags |= MF_GRAYED;
-			menu_text_t *mt = (menu_text_t *)malloc(sizeof(menu_text_t));
+			menu_text_t *mt = (menu_text_t *)mem_alloc(MEM_MENU, sizeof(menu_text_t));
 			if(mt) {
 				mt->prefix = prefix;
 				mt->desc = desc;
-				mt->right = right ? right : _strdup("");
+				mt->right = right ? right : mem_strdup(MEM_MENU, "");
 				mt->has_submenu = true;
 				mt->grayed = !p->connected;
 				mt->next = *allocs;
@@ -855,10 +908,10 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 				if(p->hwid && p->hwid[0]) {
 					UINT id = (*next_id)++;
 					AppendMenuA(sub, MF_STRING, id, p->hwid);
-					menu_clip_t *mc = (menu_clip_t *)malloc(sizeof(menu_clip_t));
+					menu_clip_t *mc = (menu_clip_t *)mem_alloc(MEM_MENU, sizeof(menu_clip_t));
 					if(mc) {
 						mc->id = id;
-						mc->text = _strdup(p->hwid);
+						mc->text = mem_strdup(MEM_MENU, p->hwid);
 						mc->next = *clips;
 						*clips = mc;
 					}
@@ -866,14 +919,29 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 				if(p->device && p->device[0]) {
 					UINT id = (*next_id)++;
 					AppendMenuA(sub, MF_STRING, id, p->device);
-					menu_clip_t *mc = (menu_clip_t *)malloc(sizeof(menu_clip_t));
+					menu_clip_t *mc = (menu_clip_t *)mem_alloc(MEM_MENU, sizeof(menu_clip_t));
+					if(mc) {
+						mc->id = id;
+						mc->text = mem_strdup(MEM_MENU, p->device);
+						mc->next = *clips;
+						*clips = mc;
+					}
+				}
+				if(p->slot[0]) {
+					UINT id = (*next_id)++;
+					AppendMenuA(sub, MF_STRING, id, p->slot);
+					menu_clip_t *mc = (menu_clip_t *)mem_alloc(MEM_MENU, sizeof(menu_clip_t));
 					if(mc) {
 						mc->id = id;
-						mc->text = _strdup(p->device);
+						mc->text = mem_strdup(MEM_MENU, p->slot);
 						mc->next = *clips;
 						*clips = mc;
 					}
 				}
+				if(p->id.vid || p->id.pid) {
+					AppendMenuA(sub, MF_SEPARATOR, 0, NULL);
+					append_device_stats(sub, &p->id);
+				}
 				if(!p->hwid || !p->hwid[0]) {
 					// If no hardware ID, ensure submenu isn't empty.
 					// (COM item above will typically exist.)
@@ -888,19 +956,19 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 				mii.hSubMenu = sub;
 				InsertMenuItemA(Hmenu, (UINT)-1, TRUE, &mii);
 			} else {
-				free(prefix);
-				free(desc);
-				if(right) free(right);
+				mem_free(prefix);
+				mem_free(desc);
+				if(right) mem_free(right);
 			}
 		}
 		p = p->next;
 	}
 	if(!any) {
-		menu_text_t *mt = (menu_text_t *)malloc(sizeof(menu_text_t));
+		menu_text_t *mt = (menu_text_t *)mem_alloc(MEM_MENU, sizeof(menu_text_t));
 		if(mt) {
-			mt->prefix = _strdup("");
-			mt->desc = _strdup("No serial ports detected");
-			mt->right = _strdup("");
+			mt->prefix = mem_strdup(MEM_MENU, "");
+			mt->desc = mem_strdup(MEM_MENU, g_scanning ? "Looking for serial ports..." : "No serial ports detected");
+			mt->right = mem_strdup(MEM_MENU, "");
 			mt->has_submenu = false;
 			mt->grayed = true;
 			mt->next = *allocs;
@@ -915,13 +983,46 @@ void populate_menu(menu_text_t **allocs, menu_clip_t **clips, UINT *next_id) {
 			InsertMenuItemA(Hmenu, (UINT)-1, TRUE, &mii);
 		}
 	}
+	metrics_record_since(H_MENU, t_menu);
+	metrics_count(M_MENUS, 1);
 }
 
+// Startup scan worker, hands the list to the event loop with WM_SCANNED
+static DWORD WINAPI initial_scan(LPVOID param) {
+	// the known devices are in before the scan result reaches the UI thread
+	devdb_read();
+	g_ports_gen = sgeneration();
+	int64_t t_enum = metrics_ticks();
+	senum(add_port);
+	metrics_record_since(H_ENUM, t_enum);
+	metrics_count(M_ENUMS, 1);
+	PostMessage(Hwnd, WM_SCANNED, 0, 0);
+	return 0;
+}
+
 // Application entry point
 int WINAPI WinMain(HINSTANCE hThisInstance, HINSTANCE hPrevInstance, LPSTR lpszArgument, int nCmdShow) {
     MSG messages;            // Messages to the application are saved here
     WNDCLASSEX wincl;        // Data structure for the windowclass
+	int64_t t_start = metrics_ticks();
+	g_start_wall_ns = evclock_to_wall_ns(evclock_now());
     WM_TASKBAR = RegisterWindowMessageA("TaskbarCreated");
+
+	// --metrics=<path> keeps a metrics snapshot file up to date
+	const char *marg = lpszArgument ? strstr(lpszArgument, "--metrics=") : NULL;
+	if(marg) {
+		marg += strlen("--metrics=");
+		const char *end = " ";
+		if(*marg == '"') {
+			marg++;
+			end = "\"";
+		}
+		size_t len = strcspn(marg, end);
+		if(len >= sizeof(g_metrics_path)) len = sizeof(g_metrics_path) - 1;
+		memcpy(g_metrics_path, marg, len);
+		g_metrics_path[len] = '\0';
+		metrics_section(enum_report);
+	}
     
 	// The Window structure
     wincl.hInstance = hThisInstance;
@@ -990,7 +1091,35 @@ int WINAPI WinMain(HINSTANCE hThisInstance, HINSTANCE hPrevInstance, LPSTR lpszA
 	Shell_NotifyIcon(NIM_ADD, &notifyIconData);
     
 	// Initialize port list
-	refresh_ports(true);
+	settings_load(Hwnd, WM_SETTINGS);
+	mem_load();
+	history_init(evclock_now());
+	rules_load();
+	capture_load();
+	bridge_load();
+	topo_load();
+	lines_load(Hwnd, WM_LINES);
+	broker_load();
+	alert_load(Hwnd, WM_ALERT);
+	flap_load();
+	devdb_load();
+	portshm_open();
+	await_load(Hwnd, ID_TIMER_AWAIT);
+
+	// First enumeration in the background, device notifications are
+	// already registered so nothing between scan and loop goes unseen
+	g_scanning = true;
+	HANDLE scan = CreateThread(NULL, 0, initial_scan, NULL, 0, NULL);
+	if(scan) {
+		CloseHandle(scan);
+	} else {
+		g_scanning = false;
+		devdb_read();
+		refresh_ports(true);
+	}
+	// the loads above read a few settings each, the device file and the
+	// first scan are on the scan thread
+	metrics_record_since(H_STARTUP, t_start);
 	
     // Message loop
     while(!die) {
@@ -1005,6 +1134,8 @@ int WINAPI WinMain(HINSTANCE hThisInstance, HINSTANCE hPrevInstance, LPSTR lpszA
 		}
     }
 
+	devdb_close();
+	if(g_metrics_path[0]) metrics_write(g_metrics_path);
     return messages.wParam;
 }
 
@@ -1036,23 +1167,118 @@ LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM
 					return 0;
 					break;
 			}
+			break;
+
+		case WM_TIMER:
+			if(wParam == ID_TIMER_EXPIRY) run_expiry();
+			else if(wParam == ID_TIMER_FLAP) run_flap();
+			else if(wParam == ID_TIMER_AWAIT) await_timer();
 			break;
+
+		case WM_ALERT: {
+			// Alert text posted by a capture thread, ours to free
+			char *text = (char *)lParam;
+			wchar_t wtext[512];
+			MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 512);
+			show_notification(L"ComPortNotify", wtext);
+			mem_free(text);
+		} break;
+
+		case WM_LINES: {
+			// Modem line change posted by a line watch thread, ours to free
+			lines_event_t *e = (lines_event_t *)lParam;
+			hport_t *hp = history_find(e->device);
+			if(hp && hp->connected) {
+				hp->lines = e->lines;
+				g_ports_dirty = true;
+				publish_ports();
+				if(e->notify) {
+					char desc[64];
+					lines_describe(e, desc, sizeof(desc));
+					char *text = mpprintf("%s %s\n%s", hp->device, hp->name, desc);
+					if(text) {
+						wchar_t wtext[512];
+						MultiByteToWideChar(CP_ACP, 0, text, -1, wtext, 512);
+						show_notification(L"ComPortNotify", wtext);
+						mem_free(text);
+					}
+				}
+			}
+			mem_free(e);
+		} break;
+
+		case WM_SETTINGS:
+			// cpnotify.ini changed, menu choices and profiles are read as used,
+			// the rest is cached. Rules, lines, bridges and brokers are looked up
+			// on connect and apply to the next one. Capture and alert settings
+			// are read by running capture threads, they and FixedFootprint and
+			// DeviceDb wait for a restart.
+			topo_load();
+			flap_load();
+			rules_load();
+			lines_load(hwnd, WM_LINES);
+			bridge_load();
+			broker_load();
+			reschedule_expiry();
+			enforce_history_limit();
+			g_ports_dirty = true;
+			publish_ports();
+			break;
 
+		case WM_ENDSESSION:
+			// logoff or shutdown ends the process without leaving the loop
+			if(wParam) devdb_close();
+			break;
+
+		case WM_SCANNED: {
+			// Startup scan done, its list is in g_cur
+			g_scanning = false;
+			if(g_buffered_ns) {
+				// a port that arrived during the scan may be in the list already, it is
+				// announced if the system says it arrived after we started
+				for(uint32_t i = 0; i < g_cur->count; i++) {
+					int64_t arrived;
+					const char *instance = snap_str(g_cur, snap_port(g_cur, i)->instance);
+					if(sarrival(instance, &arrived) && arrived >= g_start_wall_ns) g_cur->keys[i].flags |= SNAP_LATE;
+				}
+			}
+			refresh_ports(true, 0, true);
+			// and the refresh catches everything the scan missed
+			if(g_buffered_ns) refresh_ports(false, g_buffered_ns);
+			g_buffered_ns = 0;
+		} break;
+
 		case WM_DEVICECHANGE: {
 			// Device list has changed
+			uint64_t event_ns = evclock_now();
 			PDEV_BROADCAST_DEVICEINTERFACE b = (PDEV_BROADCAST_DEVICEINTERFACE) lParam;
 
 			// Output some messages to the window
 			switch (wParam) {
 				case DBT_DEVICEARRIVAL:
-					//printf("[info] DBT_DEVICEARRIVAL\n");
-					break;
 				case DBT_DEVICEREMOVECOMPLETE:
-					//printf("[info] DBT_DEVICEREMOVECOMPLETE\n");
+					// Port arrivals are broadcast once PortName is set, which can be
+					// after the last DBT_DEVNODES_CHANGED. The generation check
+					// skips the refresh when that one already saw it.
+					if(b && b->dbcc_devicetype == DBT_DEVTYP_PORT) {
+						metrics_count(M_EVENTS, 1);
+						if(g_scanning) {
+							// reconciled once the startup scan is in
+							if(!g_buffered_ns) g_buffered_ns = event_ns;
+						} else {
+							refresh_ports(false, event_ns);
+						}
+					}
 					break;
 				case DBT_DEVNODES_CHANGED:
 					//printf("[info] DBT_DEVNODES_CHANGED\n");
-					refresh_ports();
+					metrics_count(M_EVENTS, 1);
+					if(g_scanning) {
+						// reconciled once the startup scan is in
+						if(!g_buffered_ns) g_buffered_ns = event_ns;
+					} else {
+						refresh_ports(false, event_ns);
+					}
 					break;
 				default:
 					//printf("[info] WM_DEVICECHANGE %d received\n", wParam);
@@ -1202,23 +1428,30 @@ LRESULT CALLBACK WindowProcedure(HWND hwnd, UINT message, WPARAM wParam, LPARAM
 					MessageBoxA(Hwnd, msg, "ComPortNotify", MB_OK | MB_ICONINFORMATION);
 				} else if(temp == ID_TRAY_DISC_SHOW) {
 					set_disconnected_mode(0);
+					reschedule_expiry();
 				} else if(temp == ID_TRAY_DISC_HIDE) {
 					set_disconnected_mode(1);
+					reschedule_expiry();
 				} else if(temp == ID_TRAY_DISC_AFTER_10) {
 					set_disconnected_mode(2);
 					set_disconnected_timeout(10);
+					reschedule_expiry();
 				} else if(temp == ID_TRAY_DISC_AFTER_60) {
 					set_disconnected_mode(2);
 					set_disconnected_timeout(60);
+					reschedule_expiry();
 				} else if(temp == ID_TRAY_DISC_AFTER_900) {
 					set_disconnected_mode(2);
 					set_disconnected_timeout(900);
+					reschedule_expiry();
 				} else if(temp == ID_TRAY_DISC_AFTER_1800) {
 					set_disconnected_mode(2);
 					set_disconnected_timeout(1800);
+					reschedule_expiry();
 				} else if(temp == ID_TRAY_DISC_AFTER_3600) {
 					set_disconnected_mode(2);
 					set_disconnected_timeout(3600);
+					reschedule_expiry();
 				}
 				free_menu_texts(menu_texts);
 				free_menu_clips(menu_clips);
@@ -1363,34 +1596,159 @@ void show_balloon(const char *title, const char *body) {
 bool show_notification(const wchar_t *title, const wchar_t *body) {
 	int mode = get_notification_mode();
 	if(mode == NOTIF_MODE_OFF) return false;
+	int64_t t0 = metrics_ticks();
+	bool ok = false;
 	if(mode == NOTIF_MODE_BALLOON) {
 		char atitle[128];
 		char abody[256];
 		WideCharToMultiByte(CP_ACP, 0, title ? title : L"", -1, atitle, sizeof(atitle), NULL, NULL);
 		WideCharToMultiByte(CP_ACP, 0, body ? body : L"", -1, abody, sizeof(abody), NULL, NULL);
 		show_balloon(atitle, abody);
-		return true;
+		ok = true;
+	} else if(mode == NOTIF_MODE_TOAST) {
+		ok = toast_show_winrt(title, body);
+	}
+	metrics_record_since(H_NOTIFY, t0);
+	metrics_count(M_NOTIFICATIONS, 1);
+	return ok;
+}
+
+// Disconnected entries are dropped from history once "Hide after" runs out
+static void schedule_expiry(hport_t *hp) {
+	history_schedule(hp, get_disconnected_mode() == 2 ? get_disconnected_timeout() : -1);
+}
+
+// Arm the window timer for the next expiry, no timer runs while nothing is pending
+static void arm_expiry_timer() {
+	uint64_t at = history_next_expiry();
+	if(at == UINT64_MAX) {
+		KillTimer(Hwnd, ID_TIMER_EXPIRY);
+		return;
+	}
+	uint64_t now = evclock_now();
+	UINT ms = at > now ? (UINT)((at - now + 999999) / 1000000) : USER_TIMER_MINIMUM;
+	SetTimer(Hwnd, ID_TIMER_EXPIRY, ms, NULL);
+}
+
+static void run_expiry() {
+	if(history_expire(evclock_now())) g_ports_dirty = true;
+	arm_expiry_timer();
+	publish_ports();
+}
+
+// Publish the history as an immutable table for other threads (see ptable.h)
+static void publish_ports() {
+	if(!g_ports_dirty) return;
+	uint32_t count = 0;
+	for(hport_t *hp = history; hp; hp = hp->next) count++;
+	ptable_entry_t *e = (ptable_entry_t *)mem_alloc(MEM_SNAPSHOT, (count ? count : 1) * sizeof(ptable_entry_t));
+	if(!e) return;
+	uint32_t i = 0;
+	for(hport_t *hp = history; hp; hp = hp->next, i++) {
+		e[i].device = hp->device;
+		e[i].name = hp->name;
+		e[i].hwid = hp->hwid;
+		e[i].id = hp->id;
+		e[i].connected = hp->connected;
+		e[i].lines = hp->lines;
+		e[i].slot = hp->slot;
+		e[i].connected_at = hp->connected_at;
+		e[i].disconnected_at = hp->disconnected_at;
 	}
-	if(mode == NOTIF_MODE_TOAST) {
-		return toast_show_winrt(title, body);
+	if(ptable_publish(e, count)) {
+		g_ports_dirty = false;
+		portshm_publish(ptable_enter());
+		ptable_leave();
 	}
-	return false;
+	mem_free(e);
 }
 
-static hport_t *find_hport(const char *device) {
-	hport_t *p = history;
-	while(p) {
-		if(strcmp(p->device, device) == 0) return p;
-		p = p->next;
+// Disconnected port settings changed, recompute every deadline
+static void reschedule_expiry() {
+	hport_t *hp = history;
+	while(hp) {
+		schedule_expiry(hp);
+		hp = hp->next;
 	}
-	return NULL;
+	run_expiry();
 }
 
-static void move_hport_to_head(hport_t *prev, hport_t *cur) {
-	if(!prev || !cur) return;
-	prev->next = cur->next;
-	cur->next = history;
-	history = cur;
+// Evict disconnected entries beyond the history limit, connected ports are never evicted
+static void enforce_history_limit() {
+	if(history_trim(get_history_limit())) g_ports_dirty = true;
+}
+
+// " @ <slot name>" for notification texts, empty if the slot is unknown
+static const char *at_slot(const hport_t *hp) {
+	static char buf[128];
+	if(!hp->slot[0]) return "";
+	snprintf(buf, sizeof(buf), " @ %s", topo_label(hp->slot));
+	return buf;
+}
+
+// Announce a connect given its flap verdict, a re-enumeration from old is one notification
+static void announce_connect(hport_t *hp, int flap, const char *old, char *tooltip, size_t size, uint64_t now) {
+	if(flap == FLAP_QUIET) return;
+	if(flap != FLAP_QUARANTINE && (hp->id.vid || hp->id.pid)) rules_connected(hp->device, hp->name, &hp->id);
+	char *text;
+	if(flap == FLAP_QUARANTINE) {
+		text = mpprintf("Flapping %s %s%s, muted\n", hp->device, hp->name, at_slot(hp));
+	} else if(flap == FLAP_REENUM && strcmp(old, hp->device) != 0) {
+		text = mpprintf("Re-enumerated %s -> %s %s%s\n", old, hp->device, hp->name, at_slot(hp));
+	} else if(flap == FLAP_REENUM) {
+		text = mpprintf("Re-enumerated %s %s%s\n", hp->device, hp->name, at_slot(hp));
+	} else {
+		text = mpprintf("Connected %s %s%s\n", hp->device, hp->name, at_slot(hp));
+	}
+	if(text) {
+		notify_change(text, tooltip, size, now);
+		mem_free(text);
+	}
+}
+
+static void announce_removal(hport_t *hp, char *tooltip, size_t size, uint64_t now) {
+	history_to_head(hp);
+	char * text = mpprintf("Removed %s %s%s\n", hp->device, hp->name, at_slot(hp));
+	if(text) {
+		notify_change(text, tooltip, size, now);
+		mem_free(text);
+	}
+}
+
+// Arm the window timer for the next held removal
+static void arm_flap_timer() {
+	uint64_t next = flap_next();
+	if(next == UINT64_MAX) {
+		KillTimer(Hwnd, ID_TIMER_FLAP);
+		return;
+	}
+	uint64_t now = evclock_now();
+	UINT ms = next > now ? (UINT)((next - now + 999999) / 1000000) : USER_TIMER_MINIMUM;
+	SetTimer(Hwnd, ID_TIMER_FLAP, ms, NULL);
+}
+
+// Report held removals whose device did not come back in time
+static void run_flap() {
+	char tooltip[sizeof(notifyIconData.szTip)] = {0};
+	flap_removal_t due;
+	// the hold is deliberate, latency is counted from the end of it
+	uint64_t now = evclock_now();
+	while(flap_due(now, &due)) {
+		devdb_removed(&due.id, due.removed_ns);
+		if(due.quiet) continue;
+		hport_t *hp = history_find(due.device);
+		if(hp && !hp->connected) {
+			announce_removal(hp, tooltip, sizeof(tooltip), now);
+			g_ports_dirty = true;
+		}
+	}
+	publish_ports();
+	if(tooltip[0]) {
+		strncpy(notifyIconData.szTip, tooltip, sizeof(notifyIconData.szTip));
+		notifyIconData.szTip[sizeof(notifyIconData.szTip) - 1] = '\0';
+		Shell_NotifyIcon(NIM_MODIFY, &notifyIconData);
+	}
+	arm_flap_timer();
 }
 
 void InitNotifyIconData() {
@@ -1,3 +1,4 @@
 windres -i resource.rc resource.o
-gcc -Os -ffunction-sections -fdata-sections -fno-exceptions -fno-rtti -flto main.cpp serial.cpp toast.cpp -Wl,--gc-sections -Wl,--as-needed -s -lgdi32 -lsetupapi -lshell32 -lshlwapi -lole32 -lpropsys -luuid -lruntimeobject resource.o -mwindows -o bin/cpnotify
+gcc -Os -ffunction-sections -fdata-sections -fno-exceptions -fno-rtti -flto main.cpp serial.cpp toast.cpp timerwheel.cpp history.cpp metrics.cpp evclock.cpp devid.cpp rules.cpp workpool.cpp capture.cpp profile.cpp bridge.cpp broker.cpp frame.cpp crc.cpp alert.cpp flap.cpp mem.cpp ptable.cpp portshm.cpp await.cpp sbatch.cpp lines.cpp topo.cpp settings.cpp devdb.cpp snap.cpp -Wl,--gc-sections -Wl,--as-needed -s -lgdi32 -lsetupapi -lcfgmgr32 -lshell32 -lshlwapi -lole32 -lpropsys -luuid -lruntimeobject -lws2_32 resource.o -mwindows -o bin/cpnotify
+gcc -Os -ffunction-sections -fdata-sections -fno-exceptions -fno-rtti -shared -DCPN_BUILD cpnotify.cpp serial.cpp devid.cpp evclock.cpp topo.cpp settings.cpp snap.cpp metrics.cpp -Wl,--gc-sections -s -static-libgcc -lsetupapi -lcfgmgr32 -o bin/cpnotify.dll -Wl,--out-implib,bin/libcpnotify.a
 del resource.o
@@ -0,0 +1,151 @@
+// Memory accounting
+//
+// See mem.h
+//
+// Every block carries a small header naming its subsystem and size, so
+// mem_free needs nothing else. In fixed mode blocks are never returned to
+// the region, only to the free list of their class, which keeps the
+// steady state allocation free.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "mem.h"
+#include "metrics.h"
+#include "settings.h"
+
+
+#define MEM_CLASSES   16
+#define MEM_MIN_SHIFT 5          // smallest class 32 bytes, largest 1MB
+#define MEM_HEAP      0xFF       // class of a block from the heap
+
+typedef struct mem_hdr {
+	uint32_t size;               // requested size
+	uint8_t sub;
+	uint8_t cls;
+	uint8_t pad[10];             // keep the payload 16 byte aligned
+} mem_hdr_t;
+
+typedef struct mem_block {
+	struct mem_block *next;
+} mem_block_t;
+
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static mem_stats_t g_stats[MEM_COUNT];
+static uint8_t *g_region = NULL;
+static size_t g_region_size = 0;
+static size_t g_region_used = 0;
+static mem_block_t *g_free[MEM_CLASSES];
+
+static const char *sub_names[MEM_COUNT] = {
+	"snapshot", "history", "menu", "notify"
+};
+
+static void mem_report(FILE *f) {
+	for(int i = 0; i < MEM_COUNT; i++) {
+		mem_stats_t s;
+		mem_stats(i, &s);
+		fprintf(f, "mem %s live_bytes=%llu objects=%llu peak_bytes=%llu allocs=%llu failures=%llu\n", sub_names[i],
+			(unsigned long long)s.live_bytes, (unsigned long long)s.live_objects, (unsigned long long)s.peak_bytes,
+			(unsigned long long)s.allocs, (unsigned long long)s.failures);
+	}
+	size_t size, used;
+	mem_region(&size, &used);
+	if(size) fprintf(f, "mem fixed region_bytes=%llu carved_bytes=%llu\n", (unsigned long long)size, (unsigned long long)used);
+}
+
+void mem_load() {
+	metrics_section(mem_report);
+	DWORD kb = settings_dword("", "FixedFootprint", 0);
+	if(kb) mem_reserve((size_t)kb * 1024);
+}
+
+bool mem_reserve(size_t bytes) {
+	g_region = (uint8_t *)VirtualAlloc(NULL, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	g_region_size = g_region ? bytes : 0;
+	return g_region != NULL;
+}
+
+void mem_region(size_t *size, size_t *carved) {
+	AcquireSRWLockShared(&g_lock);
+	*size = g_region_size;
+	*carved = g_region_used;
+	ReleaseSRWLockShared(&g_lock);
+}
+
+static int class_of(size_t total) {
+	for(int c = 0; c < MEM_CLASSES; c++) {
+		if(total <= ((size_t)1 << (MEM_MIN_SHIFT + c))) return c;
+	}
+	return -1;
+}
+
+void *mem_alloc(int sub, size_t size) {
+	size_t total = sizeof(mem_hdr_t) + size;
+	mem_hdr_t *h = NULL;
+	int cls = MEM_HEAP;
+	AcquireSRWLockExclusive(&g_lock);
+	if(g_region) {
+		int c = class_of(total);
+		if(c >= 0) {
+			size_t bytes = (size_t)1 << (MEM_MIN_SHIFT + c);
+			if(g_free[c]) {
+				h = (mem_hdr_t *)g_free[c];
+				g_free[c] = g_free[c]->next;
+			} else if(g_region_size - g_region_used >= bytes) {
+				h = (mem_hdr_t *)(g_region + g_region_used);
+				g_region_used += bytes;
+			}
+			cls = c;
+		}
+	} else {
+		h = (mem_hdr_t *)malloc(total);
+	}
+	mem_stats_t *s = &g_stats[sub];
+	if(h) {
+		h->size = (uint32_t)size;
+		h->sub = (uint8_t)sub;
+		h->cls = (uint8_t)cls;
+		s->live_bytes += size;
+		s->live_objects++;
+		s->allocs++;
+		if(s->live_bytes > s->peak_bytes) s->peak_bytes = s->live_bytes;
+	} else {
+		s->failures++;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	return h ? h + 1 : NULL;
+}
+
+char *mem_strdup(int sub, const char *s) {
+	size_t len = strlen(s) + 1;
+	char *p = (char *)mem_alloc(sub, len);
+	if(p) memcpy(p, s, len);
+	return p;
+}
+
+void mem_free(void *p) {
+	if(!p) return;
+	mem_hdr_t *h = (mem_hdr_t *)p - 1;
+	int cls = h->cls;
+	AcquireSRWLockExclusive(&g_lock);
+	mem_stats_t *s = &g_stats[h->sub];
+	s->live_bytes -= h->size;
+	s->live_objects--;
+	if(cls != MEM_HEAP) {
+		// the free list link overwrites the header
+		mem_block_t *b = (mem_block_t *)h;
+		b->next = g_free[cls];
+		g_free[cls] = b;
+		h = NULL;
+	}
+	ReleaseSRWLockExclusive(&g_lock);
+	free(h);
+}
+
+void mem_stats(int sub, mem_stats_t *out) {
+	AcquireSRWLockShared(&g_lock);
+	*out = g_stats[sub];
+	ReleaseSRWLockShared(&g_lock);
+}
@@ -0,0 +1,60 @@
+// Memory accounting
+//
+// Heap use of the UI side, per subsystem: live bytes and objects, peak
+// and failed allocations, written to the metrics snapshot.
+//
+// With FixedFootprint (DWORD under HKCU\Software\ComPortNotify, in KB, 0
+// = off) one region of that size is reserved at startup and every
+// allocation is served from size class free lists carved out of it, so
+// the process never grows past it and does not touch the heap in steady
+// state. Size classes go from 32 bytes to 1MB in powers of two, so the
+// published port table of a few thousand ports still fits. Allocations
+// that don't fit fail, callers already cope with NULL.
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum {
+	MEM_SNAPSHOT = 0,   // port list of one enumeration
+	MEM_HISTORY,        // history entries and their strings
+	MEM_MENU,           // popup menu texts
+	MEM_NOTIFY,         // notification texts
+	MEM_COUNT
+};
+
+typedef struct {
+	uint64_t live_bytes;
+	uint64_t live_objects;
+	uint64_t peak_bytes;
+	uint64_t allocs;
+	uint64_t failures;
+} mem_stats_t;
+
+// read FixedFootprint and set up the region, call once before allocating
+void mem_load();
+
+// set up a fixed region of bytes, as FixedFootprint does, false if it
+// could not be reserved
+bool mem_reserve(size_t bytes);
+
+// size of the fixed region and how much of it size classes took so far,
+// both 0 without one
+void mem_region(size_t *size, size_t *carved);
+
+// allocate size bytes on behalf of subsystem sub, NULL on failure
+void *mem_alloc(int sub, size_t size);
+
+// copy of s, NULL on failure
+char *mem_strdup(int sub, const char *s);
+
+// free p from mem_alloc or mem_strdup, NULL is ignored
+void mem_free(void *p);
+
+// current figures of subsystem sub
+void mem_stats(int sub, mem_stats_t *out);
+
+#endif
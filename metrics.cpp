@@ -0,0 +1,192 @@
+// Hot path instrumentation
+//
+// See metrics.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "metrics.h"
+
+// One block per recording thread, linked for snapshots. When a thread
+// exits its figures are added to g_retired and its block is kept for the
+// next thread, so threads started per connection don't grow the list.
+typedef struct metrics_block {
+	metrics_snap_t data;
+	struct metrics_block *next;
+} metrics_block_t;
+
+static SRWLOCK g_blocks_lock = SRWLOCK_INIT;
+static metrics_block_t *g_blocks = NULL;
+static metrics_block_t *g_spare = NULL;    // blocks of exited threads
+static metrics_snap_t g_retired;           // what exited threads recorded
+static INIT_ONCE g_fls_once = INIT_ONCE_STATIC_INIT;
+static DWORD g_fls = FLS_OUT_OF_INDEXES;   // slot whose callback retires a block
+static __thread metrics_block_t *tl_block = NULL;
+static LARGE_INTEGER g_freq;
+
+static void add_snap(metrics_snap_t *to, const metrics_snap_t *from) {
+	for(int i = 0; i < M_COUNT; i++) to->counters[i] += from->counters[i];
+	for(int h = 0; h < H_COUNT; h++) {
+		for(int i = 0; i < METRICS_BUCKETS; i++) to->hist[h][i] += from->hist[h][i];
+	}
+}
+
+// Thread exit, on the exiting thread
+static void WINAPI retire(PVOID p) {
+	metrics_block_t *b = (metrics_block_t *)p;
+	AcquireSRWLockExclusive(&g_blocks_lock);
+	metrics_block_t **pp = &g_blocks;
+	while(*pp && *pp != b) pp = &(*pp)->next;
+	if(*pp) *pp = b->next;
+	add_snap(&g_retired, &b->data);
+	b->next = g_spare;
+	g_spare = b;
+	ReleaseSRWLockExclusive(&g_blocks_lock);
+}
+
+static BOOL CALLBACK fls_init(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+	g_fls = FlsAlloc(retire);
+	return TRUE;
+}
+
+static metrics_block_t *block() {
+	if(tl_block) return tl_block;
+	InitOnceExecuteOnce(&g_fls_once, fls_init, NULL, NULL);
+	AcquireSRWLockExclusive(&g_blocks_lock);
+	metrics_block_t *b = g_spare;
+	if(b) {
+		g_spare = b->next;
+		memset(&b->data, 0, sizeof(b->data));
+	} else {
+		b = (metrics_block_t *)calloc(1, sizeof(metrics_block_t));
+	}
+	if(b) {
+		b->next = g_blocks;
+		g_blocks = b;
+	}
+	ReleaseSRWLockExclusive(&g_blocks_lock);
+	if(!b) return NULL;
+	if(g_fls != FLS_OUT_OF_INDEXES) FlsSetValue(g_fls, b);
+	tl_block = b;
+	return b;
+}
+
+static int bucket_of(uint64_t v) {
+	if(v < (1 << METRICS_SUB_BITS)) return (int)v;
+	int msb = 63 - __builtin_clzll(v);
+	int b = ((msb - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + (int)((v >> (msb - METRICS_SUB_BITS)) & ((1 << METRICS_SUB_BITS) - 1));
+	return b < METRICS_BUCKETS ? b : METRICS_BUCKETS - 1;
+}
+
+// Largest value that falls in bucket b
+static uint64_t bucket_max(int b) {
+	if(b < (1 << METRICS_SUB_BITS)) return (uint64_t)b;
+	int shift = (b >> METRICS_SUB_BITS) - 1;
+	uint64_t sub = (uint64_t)(b & ((1 << METRICS_SUB_BITS) - 1));
+	return ((((uint64_t)1 << METRICS_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void metrics_count(int counter, uint64_t n) {
+	metrics_block_t *b = block();
+	if(b) b->data.counters[counter] += n;
+}
+
+void metrics_record(int hist, uint64_t us) {
+	metrics_block_t *b = block();
+	if(b) b->data.hist[hist][bucket_of(us)]++;
+}
+
+int64_t metrics_ticks() {
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+}
+
+void metrics_record_ticks(int hist, int64_t dt) {
+	if(!g_freq.QuadPart) QueryPerformanceFrequency(&g_freq);
+	if(dt < 0) dt = 0;
+	metrics_record(hist, (uint64_t)(dt * 1000000 / g_freq.QuadPart));
+}
+
+void metrics_record_since(int hist, int64_t t0) {
+	metrics_record_ticks(hist, metrics_ticks() - t0);
+}
+
+void metrics_snapshot(metrics_snap_t *out) {
+	AcquireSRWLockShared(&g_blocks_lock);
+	*out = g_retired;
+	for(metrics_block_t *b = g_blocks; b; b = b->next) add_snap(out, &b->data);
+	ReleaseSRWLockShared(&g_blocks_lock);
+}
+
+uint64_t metrics_quantile(const metrics_snap_t *snap, int hist, double q) {
+	uint64_t total = 0;
+	for(int i = 0; i < METRICS_BUCKETS; i++) total += snap->hist[hist][i];
+	if(!total) return 0;
+	uint64_t rank = (uint64_t)(q * (double)(total - 1)) + 1;
+	uint64_t seen = 0;
+	for(int i = 0; i < METRICS_BUCKETS; i++) {
+		seen += snap->hist[hist][i];
+		if(seen >= rank) return bucket_max(i);
+	}
+	return bucket_max(METRICS_BUCKETS - 1);
+}
+
+static const char *counter_names[M_COUNT] = {
+	"events", "enumerations", "ports_enumerated", "connects", "removals",
+	"notifications", "menus", "allocations", "rules_fired", "rules_dropped",
+	"rule_timeouts", "captures", "capture_bytes", "bridge_clients",
+	"broker_clients", "broker_dropped_bytes", "frames_checked", "crc_errors",
+	"alert_matches", "alerts", "reenumerations", "quarantines",
+	"line_events", "enums_skipped", "capture_dropped_bytes"
+};
+
+static const char *hist_names[H_COUNT] = {
+	"enum_us", "diff_us", "menu_us", "notify_us", "event_latency_us", "bridge_us",
+	"startup_us"
+};
+
+#define METRICS_SECTIONS 8
+static void (*g_sections[METRICS_SECTIONS])(FILE *f);
+static int g_nsections = 0;
+
+void metrics_section(void (*fp_write)(FILE *f)) {
+	if(g_nsections < METRICS_SECTIONS) g_sections[g_nsections++] = fp_write;
+}
+
+bool metrics_write(const char *path) {
+	metrics_snap_t *snap = (metrics_snap_t *)malloc(sizeof(metrics_snap_t));
+	if(!snap) return false;
+	metrics_snapshot(snap);
+
+	char tmp[MAX_PATH];
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+		free(snap);
+		return false;
+	}
+	FILE *f = fopen(tmp, "w");
+	if(!f) {
+		free(snap);
+		return false;
+	}
+	for(int i = 0; i < M_COUNT; i++) {
+		fprintf(f, "%s %llu\n", counter_names[i], (unsigned long long)snap->counters[i]);
+	}
+	for(int h = 0; h < H_COUNT; h++) {
+		uint64_t count = 0;
+		for(int i = 0; i < METRICS_BUCKETS; i++) count += snap->hist[h][i];
+		fprintf(f, "%s count=%llu p50=%llu p90=%llu p99=%llu max=%llu\n", hist_names[h],
+			(unsigned long long)count,
+			(unsigned long long)metrics_quantile(snap, h, 0.50),
+			(unsigned long long)metrics_quantile(snap, h, 0.90),
+			(unsigned long long)metrics_quantile(snap, h, 0.99),
+			(unsigned long long)metrics_quantile(snap, h, 1.0));
+	}
+	free(snap);
+	for(int i = 0; i < g_nsections; i++) g_sections[i](f);
+	bool ok = (fclose(f) == 0);
+	if(ok) ok = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING) != 0;
+	if(!ok) DeleteFileA(tmp);
+	return ok;
+}
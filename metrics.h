@@ -0,0 +1,95 @@
+// Hot path instrumentation
+//
+// Counters and log-linear (HDR style) latency histograms, kept per thread
+// so recording never takes a lock. A snapshot sums all thread blocks and
+// what exited threads recorded.
+// metrics_count and metrics_record cost a thread local load, a branch and
+// one increment, a few nanoseconds over an empty loop. Timing a section adds
+// two QueryPerformanceCounter calls and a division, tens of nanoseconds.
+// Both are negligible next to a SetupDi enumeration. test/metrics_bench
+// measures each call.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum {
+	M_EVENTS = 0,       // device change events received
+	M_ENUMS,            // senum() runs
+	M_PORTS,            // ports delivered by senum()
+	M_CONNECTS,         // connect transitions
+	M_REMOVALS,         // removal transitions
+	M_NOTIFICATIONS,    // notifications dispatched
+	M_MENUS,            // popup menus populated
+	M_ALLOCS,           // heap allocations on the event path
+	M_RULES_FIRED,      // rule actions queued
+	M_RULES_DROPPED,    // rule actions dropped (queue full)
+	M_RULE_TIMEOUTS,    // rule commands killed after RuleTimeout
+	M_CAPTURES,         // capture sessions started
+	M_CAPTURE_BYTES,    // bytes logged by capture
+	M_BRIDGE_CLIENTS,   // bridge client connections accepted
+	M_BROKER_CLIENTS,   // broker pipe client connections accepted
+	M_BROKER_DROPPED,   // bytes lost by lagging broker subscribers
+	M_FRAMES_CHECKED,   // captured frames checksummed
+	M_CRC_ERRORS,       // captured frames with a bad checksum
+	M_ALERT_MATCHES,    // alert patterns matched in captured data
+	M_ALERTS,           // alerts raised (after rate limiting)
+	M_REENUMS,          // removal and connect merged into a re-enumeration
+	M_QUARANTINES,      // devices quarantined for flapping
+	M_LINE_EVENTS,      // modem line changes seen by line watches
+	M_ENUMS_SKIPPED,    // device events that left the port list as it was, no senum()
+	M_CAPTURE_DROPPED,  // captured bytes not logged (log file could not be opened)
+	M_COUNT
+};
+
+enum {
+	H_ENUM = 0,         // senum() duration
+	H_DIFF,             // refresh_ports() diff duration
+	H_MENU,             // populate_menu() duration
+	H_NOTIFY,           // show_notification() duration
+	H_EVENT_LATENCY,    // device event received to notification dispatched
+	H_BRIDGE,           // bridge forwarding, read returned to data sent
+	H_STARTUP,          // process start to tray icon up and message loop running
+	H_COUNT
+};
+
+// histogram values are microseconds, 8 sub-buckets per power of two
+#define METRICS_SUB_BITS 3
+#define METRICS_BUCKETS  (40 << METRICS_SUB_BITS)
+
+typedef struct {
+	uint64_t counters[M_COUNT];
+	uint32_t hist[H_COUNT][METRICS_BUCKETS];
+} metrics_snap_t;
+
+// increment counter
+void metrics_count(int counter, uint64_t n);
+
+// record a value in microseconds
+void metrics_record(int hist, uint64_t us);
+
+// monotonic tick source for timing sections
+int64_t metrics_ticks();
+
+// record a duration given in ticks
+void metrics_record_ticks(int hist, int64_t dt);
+
+// record microseconds elapsed since ticks t0
+void metrics_record_since(int hist, int64_t t0);
+
+// sum all thread blocks into out
+void metrics_snapshot(metrics_snap_t *out);
+
+// value at quantile q (0..1) of a snapshot histogram, 0 if empty
+uint64_t metrics_quantile(const metrics_snap_t *snap, int hist, double q);
+
+// write a text snapshot to path atomically (temp file + rename)
+bool metrics_write(const char *path);
+
+// add a writer for subsystem specific lines in the snapshot file
+void metrics_section(void (*fp_write)(FILE *f));
+
+#endif
@@ -0,0 +1,71 @@
+// Shared memory port table
+//
+// See portshm.h
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "portshm.h"
+#include "ptable.h"
+#include "serial.h"
+#include "evclock.h"
+
+static HANDLE g_section = NULL;
+static portshm_t *g_shm = NULL;
+
+bool portshm_open() {
+	if(g_shm) return true;
+	g_section = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(portshm_t), PORTSHM_NAME);
+	if(!g_section) return false;
+	if(GetLastError() == ERROR_ALREADY_EXISTS) {
+		// another instance owns the table
+		CloseHandle(g_section);
+		g_section = NULL;
+		return false;
+	}
+	g_shm = (portshm_t *)MapViewOfFile(g_section, FILE_MAP_WRITE, 0, 0, sizeof(portshm_t));
+	if(!g_shm) {
+		CloseHandle(g_section);
+		g_section = NULL;
+		return false;
+	}
+	// a new section is zero filled, clients check magic last
+	g_shm->version = PORTSHM_VERSION;
+	g_shm->record_size = sizeof(portshm_record_t);
+	g_shm->capacity = PORTSHM_RECORDS;
+	MemoryBarrier();
+	g_shm->magic = PORTSHM_MAGIC;
+	return true;
+}
+
+static void put_record(portshm_record_t *r, const ptable_entry_t *e) {
+	memset(r, 0, sizeof(*r));
+	// "COM5", without the colon senum() reports
+	sname(e->device, r->device, sizeof(r->device));
+	snprintf(r->name, sizeof(r->name), "%s", e->name);
+	snprintf(r->serial, sizeof(r->serial), "%s", e->id.serial);
+	snprintf(r->slot, sizeof(r->slot), "%s", e->slot);
+	r->vid = e->id.vid;
+	r->pid = e->id.pid;
+	r->hash = e->id.hash;
+	r->state = e->connected ? PORTSHM_CONNECTED : PORTSHM_DISCONNECTED;
+	r->lines = e->lines;
+	r->connected_at = e->connected_at ? evclock_to_wall_ns(e->connected_at) : 0;
+	r->disconnected_at = e->disconnected_at ? evclock_to_wall_ns(e->disconnected_at) : 0;
+}
+
+void portshm_publish(const ptable_t *t) {
+	if(!g_shm || !t) return;
+	InterlockedIncrement(&g_shm->seq);
+	uint32_t n = 0;
+	// connected ports first so lookups can stop at the first disconnected one
+	for(int pass = 0; pass < 2; pass++) {
+		for(uint32_t i = 0; i < t->count && n < PORTSHM_RECORDS; i++) {
+			if(t->entries[i].connected != (pass == 0)) continue;
+			put_record(&g_shm->records[n++], &t->entries[i]);
+		}
+	}
+	g_shm->count = n;
+	g_shm->updated_at = evclock_to_wall_ns(evclock_now());
+	InterlockedIncrement(&g_shm->seq);
+}
@@ -0,0 +1,186 @@
+// Shared memory port table
+//
+// The port table is mirrored into the named section PORTSHM_NAME so other
+// processes can look up ports without any IPC round trip. Records have a
+// fixed stride and are guarded by a sequence lock: the writer makes seq odd
+// while it updates and even again when done, a reader copies what it needs
+// and retries if seq was odd or changed in between.
+//
+// This header is also the client library. A test harness only needs it and
+// the Windows headers:
+//
+//   const portshm_t *m = portshm_map();
+//   portshm_record_t r;
+//   if(m && portshm_find(m, 0x16c0, 0x0483, "12345", &r)) use(r.device);
+//   portshm_unmap(m);
+
+#ifndef PORTSHM_H
+#define PORTSHM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <windows.h>
+
+#define PORTSHM_NAME     "Local\\ComPortNotify.PortTable"
+#define PORTSHM_MAGIC    0x4d53504eu   // "NPSM"
+#define PORTSHM_VERSION  2
+#define PORTSHM_RECORDS  256
+
+enum {
+	PORTSHM_DISCONNECTED = 0,
+	PORTSHM_CONNECTED = 1
+};
+
+typedef struct {
+	char device[32];           // "COM5"
+	char name[128];            // friendly name
+	char serial[64];           // USB serial number, empty if none
+	char slot[48];             // USB socket ("1400-3.2", see topo.h), empty if unknown
+	uint16_t vid;
+	uint16_t pid;
+	uint32_t hash;             // of vid, pid and serial, see devid.h
+	uint32_t state;            // PORTSHM_CONNECTED or PORTSHM_DISCONNECTED
+	uint32_t lines;            // modem input lines if watched: 1 CTS, 2 DSR, 4 DCD, 8 RI
+	int64_t connected_at;      // wall clock ns since the unix epoch, 0 = present at startup
+	int64_t disconnected_at;   // wall clock ns since the unix epoch, 0 = never
+} portshm_record_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;      // sizeof(portshm_record_t)
+	uint32_t capacity;         // PORTSHM_RECORDS
+	volatile LONG seq;         // odd while the table is being written
+	uint32_t count;            // valid records, connected ports first
+	int64_t updated_at;        // wall clock ns of the last update
+	portshm_record_t records[PORTSHM_RECORDS];
+} portshm_t;
+
+// server side, see portshm.cpp
+
+struct ptable;
+
+// create the section, false if it could not be created
+bool portshm_open();
+
+// mirror a published port table into the section
+void portshm_publish(const struct ptable *t);
+
+// client side
+
+// map the section read only, NULL if ComPortNotify is not running
+static inline const portshm_t *portshm_map() {
+	HANDLE h = OpenFileMappingA(FILE_MAP_READ, FALSE, PORTSHM_NAME);
+	if(!h) return NULL;
+	const portshm_t *m = (const portshm_t *)MapViewOfFile(h, FILE_MAP_READ, 0, 0, sizeof(portshm_t));
+	// the view keeps the section alive
+	CloseHandle(h);
+	if(!m) return NULL;
+	if(m->magic != PORTSHM_MAGIC || m->version != PORTSHM_VERSION || m->record_size != sizeof(portshm_record_t)) {
+		UnmapViewOfFile(m);
+		return NULL;
+	}
+	return m;
+}
+
+static inline void portshm_unmap(const portshm_t *m) {
+	if(m) UnmapViewOfFile(m);
+}
+
+// wait for an even sequence number and return it
+static inline LONG portshm_begin(const portshm_t *m) {
+	for(int spins = 0;; spins++) {
+		LONG seq = m->seq;
+		MemoryBarrier();
+		if(!(seq & 1)) return seq;
+		if(spins < 64) YieldProcessor();
+		else Sleep(0);
+	}
+}
+
+// true if nothing was written since portshm_begin returned seq
+static inline bool portshm_valid(const portshm_t *m, LONG seq) {
+	MemoryBarrier();
+	return m->seq == seq;
+}
+
+// copy up to max records into out, returns the number copied
+static inline uint32_t portshm_read(const portshm_t *m, portshm_record_t *out, uint32_t max) {
+	uint32_t n;
+	LONG seq;
+	do {
+		seq = portshm_begin(m);
+		n = m->count;
+		if(n > max) n = max;
+		if(n > PORTSHM_RECORDS) n = PORTSHM_RECORDS;
+		memcpy(out, (const void *)m->records, n * sizeof(portshm_record_t));
+	} while(!portshm_valid(m, seq));
+	return n;
+}
+
+// find the connected port of a device, serial may be NULL to match any
+static inline bool portshm_find(const portshm_t *m, uint16_t vid, uint16_t pid, const char *serial, portshm_record_t *out) {
+	bool found;
+	LONG seq;
+	do {
+		found = false;
+		seq = portshm_begin(m);
+		uint32_t n = m->count;
+		if(n > PORTSHM_RECORDS) n = PORTSHM_RECORDS;
+		for(uint32_t i = 0; i < n; i++) {
+			const portshm_record_t *r = &m->records[i];
+			// connected ports come first
+			if(r->state != PORTSHM_CONNECTED) break;
+			if(r->vid != vid || r->pid != pid) continue;
+			if(serial && strncmp(r->serial, serial, sizeof(r->serial)) != 0) continue;
+			memcpy(out, (const void *)r, sizeof(*out));
+			found = true;
+			break;
+		}
+	} while(!portshm_valid(m, seq));
+	return found;
+}
+
+// find the port connected at a USB socket ("1400-3.2")
+static inline bool portshm_find_slot(const portshm_t *m, const char *slot, portshm_record_t *out) {
+	bool found;
+	LONG seq;
+	do {
+		found = false;
+		seq = portshm_begin(m);
+		uint32_t n = m->count;
+		if(n > PORTSHM_RECORDS) n = PORTSHM_RECORDS;
+		for(uint32_t i = 0; i < n; i++) {
+			const portshm_record_t *r = &m->records[i];
+			if(r->state != PORTSHM_CONNECTED) break;
+			if(strncmp(r->slot, slot, sizeof(r->slot)) != 0) continue;
+			memcpy(out, (const void *)r, sizeof(*out));
+			found = true;
+			break;
+		}
+	} while(!portshm_valid(m, seq));
+	return found;
+}
+
+// find a port by name ("COM5"), connected or remembered
+static inline bool portshm_find_device(const portshm_t *m, const char *device, portshm_record_t *out) {
+	bool found;
+	LONG seq;
+	do {
+		found = false;
+		seq = portshm_begin(m);
+		uint32_t n = m->count;
+		if(n > PORTSHM_RECORDS) n = PORTSHM_RECORDS;
+		for(uint32_t i = 0; i < n; i++) {
+			const portshm_record_t *r = &m->records[i];
+			if(strncmp(r->device, device, sizeof(r->device)) != 0) continue;
+			memcpy(out, (const void *)r, sizeof(*out));
+			found = true;
+			break;
+		}
+	} while(!portshm_valid(m, seq));
+	return found;
+}
+
+#endif
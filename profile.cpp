@@ -0,0 +1,28 @@
+// Device profiles
+//
+// See profile.h
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "profile.h"
+#include "settings.h"
+
+static const char *PROFILES = "Profiles";
+static const char *DEFAULT_FORMAT = "115200,N,8,1";
+
+void profile_format(const devid_t *id, char *fmt, size_t size) {
+	strncpy(fmt, DEFAULT_FORMAT, size);
+	fmt[size - 1] = '\0';
+	char names[2][96];
+	snprintf(names[0], sizeof(names[0]), "%04x:%04x:%s", id->vid, id->pid, id->serial);
+	snprintf(names[1], sizeof(names[1]), "%04x:%04x", id->vid, id->pid);
+	for(int i = id->serial[0] ? 0 : 1; i < 2; i++) {
+		char buf[64];
+		if(settings_string(PROFILES, names[i], buf, sizeof(buf))) {
+			strncpy(fmt, buf, size);
+			fmt[size - 1] = '\0';
+			break;
+		}
+	}
+}
@@ -0,0 +1,18 @@
+// Device profiles
+//
+// Per-device serial settings, REG_SZ values named "<vid>:<pid>:<serial>"
+// or "<vid>:<pid>" under HKCU\Software\ComPortNotify\Profiles, or in the
+// [Profiles] section of cpnotify.ini (see settings.h). A lookup is one
+// probe of the settings index.
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include "devid.h"
+
+// serial format ("115200,N,8,1" style) for a device, most specific profile
+// first, "115200,N,8,1" if there is none
+void profile_format(const devid_t *id, char *fmt, size_t size);
+
+#endif
@@ -0,0 +1,148 @@
+// Published port table
+//
+// See ptable.h
+
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "ptable.h"
+#include "mem.h"
+
+// One per reading thread, linked for the publisher and never unlinked:
+// a thread that exits gives its record up for the next new reader, so
+// the list is as long as the most threads that ever read at once
+typedef struct reader {
+	volatile LONG64 epoch;     // epoch entered in, 0 outside read sections
+	volatile LONG owned;       // a thread uses it
+	struct reader *next;
+} reader_t;
+
+static ptable_t * volatile g_table = NULL;
+static volatile LONG64 g_epoch = 1;
+static reader_t * volatile g_readers = NULL;
+static volatile LONG g_records = 0;
+static __thread reader_t *tl_reader = NULL;
+static INIT_ONCE g_fls_once = INIT_ONCE_STATIC_INIT;
+static DWORD g_fls = FLS_OUT_OF_INDEXES;   // slot whose callback gives up a record
+static ptable_t *g_retired = NULL;
+static uint64_t g_version = 0;
+
+// Thread exit, on the exiting thread
+static void WINAPI give_up(PVOID p) {
+	reader_t *r = (reader_t *)p;
+	InterlockedExchange64(&r->epoch, 0);
+	InterlockedExchange(&r->owned, 0);
+	tl_reader = NULL;
+}
+
+static BOOL CALLBACK fls_init(PINIT_ONCE once, PVOID param, PVOID *ctx) {
+	g_fls = FlsAlloc(give_up);
+	return TRUE;
+}
+
+static reader_t *reader() {
+	if(tl_reader) return tl_reader;
+	InitOnceExecuteOnce(&g_fls_once, fls_init, NULL, NULL);
+	reader_t *r;
+	for(r = g_readers; r; r = r->next) {
+		if(!r->owned && InterlockedCompareExchange(&r->owned, 1, 0) == 0) break;
+	}
+	if(!r) {
+		r = (reader_t *)calloc(1, sizeof(reader_t));
+		if(!r) return NULL;
+		r->owned = 1;
+		// lock free push, the publisher only ever walks the list
+		reader_t *head;
+		do {
+			head = g_readers;
+			r->next = head;
+		} while(InterlockedCompareExchangePointer((PVOID volatile *)&g_readers, r, head) != head);
+		InterlockedIncrement(&g_records);
+	}
+	if(g_fls != FLS_OUT_OF_INDEXES) FlsSetValue(g_fls, r);
+	tl_reader = r;
+	return r;
+}
+
+uint32_t ptable_reader_records() {
+	return (uint32_t)g_records;
+}
+
+const ptable_t *ptable_enter() {
+	reader_t *r = reader();
+	if(!r) return NULL;
+	// announce before loading the pointer, the exchange is a full barrier
+	InterlockedExchange64(&r->epoch, g_epoch);
+	return g_table;
+}
+
+void ptable_leave() {
+	if(tl_reader) InterlockedExchange64(&tl_reader->epoch, 0);
+}
+
+void ptable_reclaim() {
+	// oldest epoch any reader is still in
+	LONG64 oldest = INT64_MAX;
+	for(reader_t *r = g_readers; r; r = r->next) {
+		LONG64 e = r->epoch;
+		if(e && e < oldest) oldest = e;
+	}
+	ptable_t **pp = &g_retired;
+	while(*pp) {
+		ptable_t *t = *pp;
+		// readers that entered after t's retirement saw its successor
+		if((LONG64)t->retired_epoch < oldest) {
+			*pp = t->retired_next;
+			mem_free(t);
+		} else {
+			pp = &t->retired_next;
+		}
+	}
+}
+
+// Copy string s to d, returns the byte after its terminator
+static char *put(char *d, const char *s) {
+	size_t len = strlen(s) + 1;
+	memcpy(d, s, len);
+	return d + len;
+}
+
+bool ptable_publish(const ptable_entry_t *entries, uint32_t count) {
+	size_t head = sizeof(ptable_t) + (count ? count - 1 : 0) * sizeof(ptable_entry_t);
+	size_t strings = 0;
+	for(uint32_t i = 0; i < count; i++) {
+		strings += strlen(entries[i].device) + 1 + strlen(entries[i].name) + 1 + strlen(entries[i].slot) + 1;
+		if(entries[i].hwid) strings += strlen(entries[i].hwid) + 1;
+	}
+	ptable_t *t = (ptable_t *)mem_alloc(MEM_SNAPSHOT, head + strings);
+	if(!t) return false;
+	t->version = ++g_version;
+	t->count = count;
+	t->retired_epoch = 0;
+	t->retired_next = NULL;
+	char *s = (char *)t + head;
+	for(uint32_t i = 0; i < count; i++) {
+		ptable_entry_t *e = &t->entries[i];
+		*e = entries[i];
+		e->device = s;
+		s = put(s, entries[i].device);
+		e->name = s;
+		s = put(s, entries[i].name);
+		e->slot = s;
+		s = put(s, entries[i].slot);
+		if(entries[i].hwid) {
+			e->hwid = s;
+			s = put(s, entries[i].hwid);
+		}
+	}
+
+	ptable_t *old = (ptable_t *)InterlockedExchangePointer((PVOID volatile *)&g_table, t);
+	if(old) {
+		// readers still in this epoch or older may hold old
+		old->retired_epoch = (uint64_t)InterlockedIncrement64(&g_epoch) - 1;
+		old->retired_next = g_retired;
+		g_retired = old;
+	}
+	ptable_reclaim();
+	return true;
+}
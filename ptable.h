@@ -0,0 +1,61 @@
+// Published port table
+//
+// The UI thread owns the history list. After every change it publishes
+// an immutable copy (connected and remembered ports, strings included)
+// behind one atomic pointer, for other threads to read without locks:
+//
+//   const ptable_t *t = ptable_enter();
+//   ... use t, never past ptable_leave ...
+//   ptable_leave();
+//
+// Old tables are freed once no reader can still hold them, tracked with
+// epochs: each reading thread announces the epoch it entered in and the
+// publisher frees a retired table when every reader has moved past it.
+// Readers never block and never wait for the publisher. Read sections do
+// not nest. The record of a reading thread is reused once it exits.
+
+#ifndef PTABLE_H
+#define PTABLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "devid.h"
+
+typedef struct {
+	const char *device;
+	const char *name;
+	const char *hwid;          // NULL if none
+	devid_t id;
+	bool connected;
+	uint32_t lines;            // modem input lines (SLINE_*), 0 if not watched
+	const char *slot;          // USB socket (see topo.h), "" if unknown
+	uint64_t connected_at;     // evclock ns, 0 = present at startup
+	uint64_t disconnected_at;  // evclock ns
+} ptable_entry_t;
+
+typedef struct ptable {
+	uint64_t version;          // increases with every publish
+	uint32_t count;
+	uint64_t retired_epoch;    // publisher bookkeeping
+	struct ptable *retired_next;
+	ptable_entry_t entries[1]; // count entries, followed by their strings
+} ptable_t;
+
+// publish a copy of count entries, strings are copied too
+// publisher thread only, false if out of memory (old table stays)
+bool ptable_publish(const ptable_entry_t *entries, uint32_t count);
+
+// free retired tables no reader holds any more, publisher thread only
+void ptable_reclaim();
+
+// pin and return the current table, NULL before the first publish
+const ptable_t *ptable_enter();
+
+// release the table returned by ptable_enter
+void ptable_leave();
+
+// reader records allocated so far, at most the number of threads that
+// ever read at the same time
+uint32_t ptable_reader_records();
+
+#endif
@@ -19,4 +19,11 @@
 #define ID_TRAY_DISC_AFTER_900  1014
 #define ID_TRAY_DISC_AFTER_1800 1015
 #define ID_TRAY_DISC_AFTER_3600 1016
+#define ID_TIMER_EXPIRY     1020
+#define ID_TIMER_FLAP       1021
+#define ID_TIMER_AWAIT      1022
 #define WM_SYSICON          (WM_USER + 1)
+#define WM_ALERT            (WM_USER + 2)
+#define WM_LINES            (WM_USER + 3)
+#define WM_SCANNED          (WM_USER + 4)
+#define WM_SETTINGS         (WM_USER + 5)
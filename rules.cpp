@@ -0,0 +1,284 @@
+// Device rules
+//
+// See rules.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "rules.h"
+#include "workpool.h"
+#include "metrics.h"
+#include "capture.h"
+#include "serial.h"
+#include "settings.h"
+
+static const char *RULES = "Rules";
+static const DWORD DEFAULT_RULE_TIMEOUT = 30000;
+
+#define RULE_WORKERS 2
+#define RULE_QUEUE   32
+#define RULE_CMD_MAX 4096
+
+enum {
+	RULE_RUN = 0,
+	RULE_LAUNCH,
+	RULE_CAPTURE
+};
+
+typedef struct {
+	uint16_t vid;
+	uint16_t pid;
+	bool any_serial;
+	char serial[DEVID_SERIAL_MAX];
+	uint32_t key;
+	int action;
+	char *arg;
+	int next;        // next rule in the same bucket, -1 ends the chain
+} rule_t;
+
+typedef struct {
+	char *cmd;
+	int action;
+	DWORD timeout;
+} rule_job_t;
+
+static rule_t *g_rules = NULL;
+static int g_nrules = 0;
+static int *g_buckets = NULL;
+static uint32_t g_mask = 0;
+static DWORD g_timeout = DEFAULT_RULE_TIMEOUT;
+static workpool_t *g_pool = NULL;
+
+// Parse "<vid>:<pid>[:<serial>] <action> <argument>" into r
+static bool parse_rule(const char *text, rule_t *r) {
+	memset(r, 0, sizeof(*r));
+	unsigned vid, pid;
+	int used = 0;
+	if(sscanf(text, "%4x:%4x%n", &vid, &pid, &used) != 2) return false;
+	r->vid = (uint16_t)vid;
+	r->pid = (uint16_t)pid;
+	const char *p = text + used;
+	r->any_serial = true;
+	if(*p == ':') {
+		p++;
+		size_t len = strcspn(p, " \t");
+		if(len >= sizeof(r->serial)) return false;
+		if(!(len == 1 && *p == '*')) {
+			memcpy(r->serial, p, len);
+			r->serial[len] = '\0';
+			r->any_serial = false;
+		}
+		p += len;
+	}
+	while(*p == ' ' || *p == '\t') p++;
+	size_t alen = strcspn(p, " \t");
+	if(alen == 3 && strncmp(p, "run", 3) == 0) r->action = RULE_RUN;
+	else if(alen == 6 && strncmp(p, "launch", 6) == 0) r->action = RULE_LAUNCH;
+	else if(alen == 7 && strncmp(p, "capture", 7) == 0) r->action = RULE_CAPTURE;
+	else return false;
+	p += alen;
+	while(*p == ' ' || *p == '\t') p++;
+	if(!*p && r->action != RULE_CAPTURE) return false;
+	r->arg = _strdup(p);
+	if(!r->arg) return false;
+	r->key = devid_hash(r->vid, r->pid, r->any_serial ? NULL : r->serial);
+	return true;
+}
+
+// settings_values callback, ctx is the capacity of g_rules
+static void add_rule(const char *name, const char *text, void *ctx) {
+	if(!text || (uint32_t)g_nrules >= *(uint32_t *)ctx) return;
+	rule_t *r = &g_rules[g_nrules];
+	if(!parse_rule(text, r)) return;
+	r->next = g_buckets[r->key & g_mask];
+	g_buckets[r->key & g_mask] = g_nrules;
+	g_nrules++;
+}
+
+// Drop the compiled rules, queued actions keep their own copies
+static void free_rules() {
+	for(int i = 0; i < g_nrules; i++) free(g_rules[i].arg);
+	free(g_rules);
+	free(g_buckets);
+	g_rules = NULL;
+	g_buckets = NULL;
+	g_nrules = 0;
+	g_mask = 0;
+}
+
+void rules_load() {
+	// on a reload the workers stay, actions already queued still run
+	free_rules();
+	g_timeout = DEFAULT_RULE_TIMEOUT;
+	DWORD value = settings_dword("", "RuleTimeout", 0);
+	if(value) g_timeout = value;
+	uint32_t count = settings_values(RULES, NULL, NULL);
+	if(!count) return;
+	g_rules = (rule_t *)calloc(count, sizeof(rule_t));
+	uint32_t nb = 1;
+	while(nb < count * 2) nb <<= 1;
+	g_buckets = (int *)malloc(nb * sizeof(int));
+	if(!g_rules || !g_buckets) {
+		free_rules();
+		return;
+	}
+	g_mask = nb - 1;
+	for(uint32_t i = 0; i < nb; i++) g_buckets[i] = -1;
+	settings_values(RULES, add_rule, &count);
+	if(g_nrules && !g_pool) g_pool = workpool_create(RULE_WORKERS, RULE_QUEUE);
+}
+
+void rules_unload() {
+	if(g_pool) {
+		workpool_destroy(g_pool);
+		g_pool = NULL;
+	}
+	free_rules();
+}
+
+// Append src to the command buffer, false if it does not fit
+static bool append(char *dst, size_t *len, const char *src) {
+	size_t n = strlen(src);
+	if(*len + n >= RULE_CMD_MAX) return false;
+	memcpy(dst + *len, src, n + 1);
+	*len += n;
+	return true;
+}
+
+// Letters, digits and ._:- only, safe anywhere on a command line
+static bool plain(const char *s) {
+	for(; *s; s++) {
+		char c = *s;
+		if(!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("._:-", c))) return false;
+	}
+	return true;
+}
+
+// Inert between double quotes: no " to end them, no trailing \ to escape
+// the closing one, none of the % ! cmd still expands there or ^, no
+// control characters
+static bool quotable(const char *s) {
+	size_t len = strlen(s);
+	if(len && s[len - 1] == '\\') return false;
+	for(; *s; s++) {
+		if((unsigned char)*s < 0x20 || strchr("\"%^!", *s)) return false;
+	}
+	return true;
+}
+
+// Substitute {port} {name} {vid} {pid} {serial} in tmpl
+// Values come from the device and are untrusted: plain ones go in as they
+// are, others in double quotes (unless the template already quotes them),
+// where cmd takes & | < > literally. NULL if a value can't be made inert.
+static char *expand(const char *tmpl, const char *device, const char *name, const devid_t *id) {
+	char *out = (char *)malloc(RULE_CMD_MAX);
+	if(!out) return NULL;
+	char port[32];
+	sname(device, port, sizeof(port));
+	char vid[8];
+	char pid[8];
+	snprintf(vid, sizeof(vid), "%04x", id->vid);
+	snprintf(pid, sizeof(pid), "%04x", id->pid);
+	size_t len = 0;
+	out[0] = '\0';
+	const char *p = tmpl;
+	bool ok = true;
+	bool quoted = false;
+	while(*p && ok) {
+		if(*p == '{') {
+			const char *val = NULL;
+			size_t skip = 0;
+			if(strncmp(p, "{port}", 6) == 0) { val = port; skip = 6; }
+			else if(strncmp(p, "{name}", 6) == 0) { val = name; skip = 6; }
+			else if(strncmp(p, "{vid}", 5) == 0) { val = vid; skip = 5; }
+			else if(strncmp(p, "{pid}", 5) == 0) { val = pid; skip = 5; }
+			else if(strncmp(p, "{serial}", 8) == 0) { val = id->serial; skip = 8; }
+			if(val) {
+				if(plain(val) || (quoted && quotable(val))) {
+					ok = append(out, &len, val);
+				} else if(quotable(val)) {
+					ok = append(out, &len, "\"") && append(out, &len, val) && append(out, &len, "\"");
+				} else {
+					ok = false;
+				}
+				p += skip;
+				continue;
+			}
+		}
+		if(*p == '"') quoted = !quoted;
+		if(len + 1 >= RULE_CMD_MAX) {
+			ok = false;
+			break;
+		}
+		out[len++] = *p++;
+		out[len] = '\0';
+	}
+	if(!ok) {
+		free(out);
+		return NULL;
+	}
+	return out;
+}
+
+static void run_job(void *arg) {
+	rule_job_t *job = (rule_job_t *)arg;
+	STARTUPINFOA si;
+	PROCESS_INFORMATION pi;
+	ZeroMemory(&si, sizeof(si));
+	si.cb = sizeof(si);
+	DWORD flags = job->action == RULE_RUN ? CREATE_NO_WINDOW : 0;
+	if(CreateProcessA(NULL, job->cmd, NULL, NULL, FALSE, flags, NULL, NULL, &si, &pi)) {
+		if(job->action == RULE_RUN) {
+			if(WaitForSingleObject(pi.hProcess, job->timeout) == WAIT_TIMEOUT) {
+				TerminateProcess(pi.hProcess, 1);
+				metrics_count(M_RULE_TIMEOUTS, 1);
+			}
+		}
+		CloseHandle(pi.hThread);
+		CloseHandle(pi.hProcess);
+	}
+	free(job->cmd);
+	free(job);
+}
+
+static void dispatch(const rule_t *r, const char *device, const char *name, const devid_t *id) {
+	if(r->action == RULE_CAPTURE) {
+		// only spawns the reader thread, cheap enough to do inline
+		capture_start(device, id, true);
+		metrics_count(M_RULES_FIRED, 1);
+		return;
+	}
+	rule_job_t *job = (rule_job_t *)malloc(sizeof(rule_job_t));
+	if(!job) return;
+	// a device whose serial or name can't be quoted safely gets no command
+	job->cmd = expand(r->arg, device, name, id);
+	job->action = r->action;
+	job->timeout = g_timeout;
+	if(!job->cmd || !g_pool || !workpool_submit(g_pool, run_job, job)) {
+		free(job->cmd);
+		free(job);
+		metrics_count(M_RULES_DROPPED, 1);
+		return;
+	}
+	metrics_count(M_RULES_FIRED, 1);
+}
+
+void rules_connected(const char *device, const char *name, const devid_t *id) {
+	if(!g_nrules) return;
+	// exact identity
+	for(int i = g_buckets[id->hash & g_mask]; i >= 0; i = g_rules[i].next) {
+		const rule_t *r = &g_rules[i];
+		if(!r->any_serial && r->key == id->hash && r->vid == id->vid && r->pid == id->pid && strcmp(r->serial, id->serial) == 0) {
+			dispatch(r, device, name, id);
+		}
+	}
+	// any serial number
+	uint32_t key = devid_hash(id->vid, id->pid, NULL);
+	for(int i = g_buckets[key & g_mask]; i >= 0; i = g_rules[i].next) {
+		const rule_t *r = &g_rules[i];
+		if(r->any_serial && r->key == key && r->vid == id->vid && r->pid == id->pid) {
+			dispatch(r, device, name, id);
+		}
+	}
+}
@@ -0,0 +1,40 @@
+// Device rules
+//
+// Rules live as REG_SZ values under HKCU\Software\ComPortNotify\Rules,
+// one rule per value, value names are free form:
+//
+//   <vid>:<pid>[:<serial>] <action> <argument>
+//
+//   16c0:0483 launch "C:\Tools\putty.exe" -serial {port}
+//   0403:6001:A50285BI run cmd /c echo {port} {serial} >> C:\log\boards.txt
+//   2e8a:000a capture
+//
+// Actions:
+//   run     run command, killed if it exceeds RuleTimeout (ms, default 30000)
+//   launch  start command and forget about it (terminals, GUIs)
+//   capture open the port and log it (no argument, see capture.h)
+//
+// {port} {name} {vid} {pid} {serial} are substituted in the argument.
+// {name} and {serial} come from the device and are untrusted: values with
+// characters other than letters, digits and ._:- are put in double quotes,
+// and a value containing " % ^ ! or control characters drops the rule.
+// Rules are compiled into a hash index keyed by identity, so matching a
+// connect costs two lookups however many rules there are. Commands run on
+// a small bounded worker pool and never delay refresh_ports().
+
+#ifndef RULES_H
+#define RULES_H
+
+#include "devid.h"
+
+// compile rules from the registry and start workers, again to reload
+void rules_load();
+
+// evaluate rules for a connected device and queue matching actions
+// device is the senum() device name ("COM5:"), name the friendly name
+void rules_connected(const char *device, const char *name, const devid_t *id);
+
+// drop rules and stop workers after running queued actions
+void rules_unload();
+
+#endif
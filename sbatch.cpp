@@ -0,0 +1,47 @@
+// Batch port open
+//
+// See sbatch.h
+
+#include <windows.h>
+#include "sbatch.h"
+#include "workpool.h"
+#include "evclock.h"
+
+static void open_one(void *arg) {
+	sopen_req_t *r = (sopen_req_t *)arg;
+	uint64_t t0 = evclock_now();
+	r->port = sopen_port(r->device);
+	uint64_t t1 = evclock_now();
+	r->open_us = (uint32_t)((t1 - t0) / 1000);
+	if(!r->port) {
+		r->error = GetLastError();
+		return;
+	}
+	if(r->fmt && !sconfig_port(r->port, r->fmt)) {
+		r->error = GetLastError();
+		sclose_port(r->port);
+		r->port = NULL;
+	}
+	r->config_us = (uint32_t)((evclock_now() - t1) / 1000);
+}
+
+int sopen_batch(sopen_req_t *reqs, int count, int threads) {
+	for(int i = 0; i < count; i++) {
+		reqs[i].port = NULL;
+		reqs[i].error = 0;
+		reqs[i].open_us = 0;
+		reqs[i].config_us = 0;
+	}
+	if(threads > count) threads = count;
+	workpool_t *pool = threads > 1 ? workpool_create(threads, count) : NULL;
+	for(int i = 0; i < count; i++) {
+		// without a pool, or if it refuses, open here
+		if(!pool || !workpool_submit(pool, open_one, &reqs[i])) open_one(&reqs[i]);
+	}
+	if(pool) workpool_destroy(pool);
+	int opened = 0;
+	for(int i = 0; i < count; i++) {
+		if(reqs[i].port) opened++;
+	}
+	return opened;
+}
@@ -0,0 +1,28 @@
+// Batch port open
+//
+// Opening and configuring a port can take tens to hundreds of
+// milliseconds on some USB-serial drivers (DTR toggling, driver start
+// up). sopen_batch opens a whole list on a bounded worker pool, so
+// bringing up a rack of boards takes about as long as its slowest port
+// instead of the sum of all of them.
+
+#ifndef SBATCH_H
+#define SBATCH_H
+
+#include <stdint.h>
+#include "serial.h"
+
+typedef struct {
+	const char *device;    // "COM5"
+	const char *fmt;       // as for sconfig, NULL keeps the driver settings
+	sport_t *port;         // opened port, NULL on failure
+	uint32_t error;        // GetLastError() of the step that failed
+	uint32_t open_us;      // time spent in sopen_port
+	uint32_t config_us;    // time spent in sconfig_port
+} sopen_req_t;
+
+// open and configure count ports on up to threads workers, returns the
+// number opened, close them with sclose_port
+int sopen_batch(sopen_req_t *reqs, int count, int threads);
+
+#endif
@@ -12,9 +12,8 @@
 #include <windows.h>
 #include <winnt.h>
 #include <setupapi.h>
+#include <cfgmgr32.h>
 
-static HANDLE h_serial;
-static COMMTIMEOUTS restore;
 
 // GUID for serial ports class
 //static const GUID GUID_SERENUM_BUS_ENUMERATOR={0x86E0D1E0L,0x8089,0x11D0,{0x9C,0xE4,0x08,0x00,0x3E,0x30,0x1F,0x73}};
@@ -61,46 +60,133 @@ bool IsNumeric(char *pszString, bool bIgnoreColon) {
   
 
 bool QueryRegistryPortName(HKEY hDeviceKey, int *nPort) {
-  bool bAdded = false;
-  char *pszPortName = NULL;
-  if (RegQueryValueString(hDeviceKey, "PortName", &pszPortName)) {
-    size_t nLen = strlen(pszPortName);
-    if (nLen > 3) {
-      if ((memcmp(pszPortName, "COM", 3) == 0) && IsNumeric((pszPortName + 3), false)) {
-        *nPort = atoi(pszPortName + 3);
-        bAdded = true;
-      }
-    }
-    free(pszPortName);
+  // "COMnnn" fits, one query instead of one for the size and one to read
+  char szPortName[16];
+  DWORD dwType = 0;
+  DWORD dwSize = sizeof(szPortName) - 1;
+  if(RegQueryValueEx(hDeviceKey, "PortName", NULL, &dwType, (LPBYTE)szPortName, &dwSize) != ERROR_SUCCESS || dwType != REG_SZ) return false;
+  szPortName[dwSize] = 0;
+  if(strlen(szPortName) > 3 && memcmp(szPortName, "COM", 3) == 0 && IsNumeric(szPortName + 3, false)) {
+    *nPort = atoi(szPortName + 3);
+    return true;
   }
-  return bAdded;
+  return false;
 }
-
   
-// windows - enumerate serial ports
-void senum(void (*fp_enum)(char *name, char *device, char *hwid)) {
-  HDEVINFO h_devinfo;
+// Ports is a fixed setup class, no need to look it up by name
+static const GUID PORTS_CLASS = {0x4D36E978L, 0xE325, 0x11CE, {0xBF, 0xC1, 0x08, 0x00, 0x2B, 0xE1, 0x03, 0x18}};
+
+// DEVPKEY_Device_LastArrivalDate, Windows 8 and later
+static const DEVPROPKEY SKEY_LAST_ARRIVAL={{0x83da6326,0x97a6,0x4088,{0x94,0x53,0xa1,0x92,0x3f,0x57,0x3b,0x29}},102};
+
+// when a device node last arrived, FILETIME ticks
+static bool arrival_of(DEVINST dev,uint64_t *ft) {
+  DEVPROPTYPE type=0;
+  FILETIME t;
+  ULONG size=sizeof(t);
+  if(CM_Get_DevNode_PropertyW(dev,&SKEY_LAST_ARRIVAL,&type,(PBYTE)&t,&size,0)!=CR_SUCCESS) return false;
+  if(type!=DEVPROP_TYPE_FILETIME||size!=sizeof(t)) return false;
+  *ft=((uint64_t)t.dwHighDateTime<<32)|t.dwLowDateTime;
+  return true;
+}
+
+// What senum() reports of a port besides its name and location does not
+// change while the device stays plugged in, so it is kept per device
+// instance and arrival time. The location paths are read every time: a hub
+// that re-enumerates can put the device on another port without a new
+// arrival. A port seen before costs its instance ID, arrival time, PortName
+// and location paths; its description, hardware IDs and parent are not read.
+typedef struct sinfo {
+  char key[MAX_DEVICE_ID_LEN];       // instance ID of the port device
+  uint64_t arrival;                  // FILETIME ticks, 0 = unknown, not cached
+  char *name;
+  char *hwid;                        // hardware ID list, NULL if none
+  char *location;                    // first location path, NULL if none
+  char instance[MAX_DEVICE_ID_LEN];  // USB device (parent of composite interfaces)
+  bool seen;
+  struct sinfo *next;
+} sinfo_t;
+
+static sinfo_t *s_info=NULL;
+// watches in the library enumerate from their own threads
+static SRWLOCK s_info_lock=SRWLOCK_INIT;
 
-  // First need to convert the name "Ports" to a GUID using SetupDiClassGuidsFromName
-  DWORD dwGuids = 0;
-  SetupDiClassGuidsFromName("Ports", NULL, 0, &dwGuids);
-  if (dwGuids == 0) return;
+static void free_info(sinfo_t *info) {
+  free(info->name);
+  free(info->hwid);
+  free(info->location);
+  free(info);
+}
 
-  // Allocate the needed memory
-  GUID *pGuids = (GUID *)malloc(dwGuids * sizeof(GUID));
-  if(!pGuids) return;
+static sinfo_t *find_info(const char *key,uint64_t arrival) {
+  for(sinfo_t *info=s_info;info;info=info->next) {
+    if(info->arrival==arrival&&strcmp(info->key,key)==0) return info;
+  }
+  return NULL;
+}
 
-  // Call the function again
-  if (!SetupDiClassGuidsFromName("Ports", pGuids, dwGuids, &dwGuids)) {
-    free(pGuids);
-    return;
+// first location path of a port into buf, "" if none
+static void read_location(HDEVINFO h_devinfo,SP_DEVINFO_DATA *devInfo,char *buf,DWORD size) {
+  DWORD type = 0;
+  if(!SetupDiGetDeviceRegistryProperty(h_devinfo, devInfo, SPDRP_LOCATION_PATHS, &type, (PBYTE)buf, size - 1, NULL) || type != REG_MULTI_SZ) {
+    buf[0] = 0;
   }
+  buf[size - 1] = 0;
+}
+
+// replace the location of info, false if out of memory
+static bool set_location(sinfo_t *info,const char *location) {
+  if(info->location && strcmp(info->location, location) == 0) return true;
+  char *copy = location[0] ? _strdup(location) : NULL;
+  if(location[0] && !copy) return false;
+  free(info->location);
+  info->location = copy;
+  return true;
+}
 
-  // Now create a "device information set" which is required to enumerate all the ports
-  h_devinfo = SetupDiGetClassDevs(pGuids, NULL, NULL, DIGCF_PRESENT);
-  free(pGuids);
+// read the details of a port, NULL if it has no description
+static sinfo_t *read_info(HDEVINFO h_devinfo,SP_DEVINFO_DATA *devInfo,const char *key,uint64_t arrival) {
+  char szFriendlyName[1024];
+  szFriendlyName[0] = 0;
+  DWORD dwType = 0;
+  if(!SetupDiGetDeviceRegistryProperty(h_devinfo, devInfo, SPDRP_DEVICEDESC, &dwType, (PBYTE)szFriendlyName, sizeof(szFriendlyName), NULL) || (dwType != REG_SZ)) return NULL;
+  sinfo_t *info = (sinfo_t *)calloc(1, sizeof(sinfo_t));
+  if(!info) return NULL;
+  strcpy(info->key, key);
+  info->arrival = arrival;
+  info->name = _strdup(szFriendlyName);
+  char hwidbuf[2048];
+  hwidbuf[0] = 0;
+  DWORD hwSize = sizeof(hwidbuf);
+  DWORD hwType = 0;
+  if(!SetupDiGetDeviceRegistryProperty(h_devinfo, devInfo, SPDRP_HARDWAREID, &hwType, (PBYTE)hwidbuf, hwSize, &hwSize) || hwType != REG_MULTI_SZ) {
+    hwidbuf[0] = 0;
+  }
+  if(hwidbuf[0]) info->hwid = _strdup(hwidbuf);
+  strcpy(info->instance, key);
+  // composite device interfaces (&MI_xx) carry the serial number on their parent
+  if(strstr(info->instance, "&MI_")) {
+    DEVINST parent;
+    char parentbuf[MAX_DEVICE_ID_LEN];
+    if(CM_Get_Parent(&parent, devInfo->DevInst, 0) == CR_SUCCESS && CM_Get_Device_IDA(parent, parentbuf, sizeof(parentbuf), 0) == CR_SUCCESS) {
+      strcpy(info->instance, parentbuf);
+    }
+  }
+  if(!info->name || (hwidbuf[0] && !info->hwid)) {
+    free_info(info);
+    return NULL;
+  }
+  return info;
+}
+
+// windows - enumerate serial ports
+void senum(void (*fp_enum)(char *name, char *device, char *hwid, char *instance, char *location)) {
+  HDEVINFO h_devinfo = SetupDiGetClassDevs(&PORTS_CLASS, NULL, NULL, DIGCF_PRESENT);
   if(h_devinfo == INVALID_HANDLE_VALUE) return;
 
+  AcquireSRWLockExclusive(&s_info_lock);
+  for(sinfo_t *info = s_info; info; info = info->next) info->seen = false;
+
   // Finally do the enumeration
   bool bMoreItems = true;
   int nIndex = 0;
@@ -126,26 +212,34 @@ void senum(void (*fp_enum)(char *name, char *device, char *hwid)) {
         // Close the key now that we are finished with it
         RegCloseKey(hDeviceKey);
       }
-      // If the port was a serial port, then also try to get its friendly name
+      // If the port was a serial port, then also get its details
       if(bAdded) {
-        char szFriendlyName[1024];
-        szFriendlyName[0] = 0;
-        DWORD dwSize = sizeof(szFriendlyName);
-        DWORD dwType = 0;
-        if(SetupDiGetDeviceRegistryProperty(h_devinfo, &devInfo, SPDRP_DEVICEDESC, &dwType, (PBYTE)szFriendlyName, dwSize, &dwSize) && (dwType == REG_SZ)) {
-          char hwidbuf[2048];
-          hwidbuf[0] = 0;
-          DWORD hwSize = sizeof(hwidbuf);
-          DWORD hwType = 0;
-          if(!SetupDiGetDeviceRegistryProperty(h_devinfo, &devInfo, SPDRP_HARDWAREID, &hwType, (PBYTE)hwidbuf, hwSize, &hwSize) || hwType != REG_MULTI_SZ) {
-            hwidbuf[0] = 0;
-          }
-          char *full = NULL;
-          if(hwidbuf[0]) {
-            full = _strdup(hwidbuf);
+        char key[MAX_DEVICE_ID_LEN];
+        uint64_t arrival = 0;
+        if(!SetupDiGetDeviceInstanceIdA(h_devinfo, &devInfo, key, sizeof(key), NULL)) key[0] = 0;
+        // without an arrival time a device could have been replugged elsewhere unnoticed
+        if(!key[0] || !arrival_of(devInfo.DevInst, &arrival)) arrival = 0;
+        sinfo_t *info = arrival ? find_info(key, arrival) : NULL;
+        bool cached = info != NULL;
+        if(!info) {
+          info = read_info(h_devinfo, &devInfo, key, arrival);
+          if(info && arrival) {
+            info->next = s_info;
+            s_info = info;
+            cached = true;
           }
-          fp_enum(szFriendlyName, szPortName, full);
-          if(full) free(full);
+        }
+        // physical position, the first of the paths is enough
+        char location[512];
+        read_location(h_devinfo, &devInfo, location, sizeof(location));
+        if(info && !set_location(info, location)) {
+          if(!cached) free_info(info);
+          info = NULL;
+        }
+        if(info) {
+          info->seen = true;
+          fp_enum(info->name, szPortName, info->hwid, info->instance[0] ? info->instance : NULL, info->location);
+          if(!cached) free_info(info);
         }
       }
     }
@@ -153,6 +247,19 @@ void senum(void (*fp_enum)(char *name, char *device, char *hwid)) {
     ++nIndex;
   }
 
+  // forget ports that are gone, and older arrivals of replugged ones
+  sinfo_t **pp = &s_info;
+  while(*pp) {
+    sinfo_t *info = *pp;
+    if(info->seen) {
+      pp = &info->next;
+    } else {
+      *pp = info->next;
+      free_info(info);
+    }
+  }
+  ReleaseSRWLockExclusive(&s_info_lock);
+
   // Free up the "device information set" now that we are finished with it
   SetupDiDestroyDeviceInfoList(h_devinfo);  
   
@@ -230,31 +337,149 @@ void senum(void (*fp_enum)(char *name, char *device, char *hwid)) {
   
 }
 
+// FNV-1a
+static uint64_t fnv(uint64_t h,const void *data,size_t len) {
+  for(size_t i=0;i<len;i++) h=(h^((const uint8_t*)data)[i])*1099511628211ull;
+  return h;
+}
+
+// What can change under an instance ID that stays in the list: the
+// devnode status (started, problem code) and PortName, which the class
+// installer writes after the device appears and rewrites when the COM
+// number is reassigned. An instance gone meanwhile hashes as such.
+static uint64_t node_state(uint64_t h,const char *instance) {
+  DEVINST dev;
+  if(CM_Locate_DevNodeA(&dev,(DEVINSTID_A)instance,CM_LOCATE_DEVNODE_NORMAL)!=CR_SUCCESS) return fnv(h,"-",1);
+  ULONG status=0,problem=0;
+  if(CM_Get_DevNode_Status(&status,&problem,dev,0)==CR_SUCCESS) {
+    h=fnv(h,&status,sizeof(status));
+    h=fnv(h,&problem,sizeof(problem));
+  }
+  HKEY key;
+  if(CM_Open_DevNode_Key(dev,KEY_QUERY_VALUE,0,RegDisposition_OpenExisting,&key,CM_REGISTRY_HARDWARE)==CR_SUCCESS) {
+    char port[16];
+    DWORD type=0,size=sizeof(port);
+    if(RegQueryValueExA(key,"PortName",NULL,&type,(LPBYTE)port,&size)==ERROR_SUCCESS&&type==REG_SZ) h=fnv(h,port,size);
+    RegCloseKey(key);
+  }
+  return fnv(h,"",1);
+}
+
+// windows - hash of the present device instance IDs of the Ports class
+// with the status and PortName of each, no SetupAPI or property reads
+uint64_t sgeneration() {
+  static const char *filter="{4d36e978-e325-11ce-bfc1-08002be10318}";
+  const ULONG flags=CM_GETIDLIST_FILTER_CLASS|CM_GETIDLIST_FILTER_PRESENT;
+  char stack[4096];
+  char *list=stack;
+  ULONG len=0;
+  CONFIGRET cr=CR_BUFFER_SMALL;
+  // the list can grow between asking for its size and getting it
+  for(int tries=0;cr==CR_BUFFER_SMALL&&tries<4;tries++) {
+    if(CM_Get_Device_ID_List_SizeA(&len,filter,flags)!=CR_SUCCESS) break;
+    if(len>sizeof(stack)) {
+      if(list!=stack) free(list);
+      list=(char*)malloc(len);
+      if(!list) return 0;
+    } else if(list!=stack) {
+      free(list);
+      list=stack;
+    }
+    cr=CM_Get_Device_ID_ListA(filter,list,len,flags);
+  }
+  uint64_t h=0;
+  if(cr==CR_SUCCESS) {
+    // the double NUL terminated list, one instance ID at a time
+    h=14695981039346656037ull;
+    for(char *id=list;id<list+len&&*id;id+=strlen(id)+1) {
+      h=fnv(h,id,strlen(id)+1);
+      h=node_state(h,id);
+    }
+    if(!h) h=1;
+  }
+  if(list!=stack) free(list);
+  return h;
+}
+
+// windows - strip the trailing colon
+void sname(const char *device, char *out, uint16_t size) {
+  strncpy(out,device,size);
+  out[size-1]=0;
+  size_t len=strlen(out);
+  if(len&&out[len-1]==':') out[len-1]=0;
+}
+
+// windows - see arrival_of
+bool sarrival(const char *instance,int64_t *wall_ns) {
+  DEVINST dev;
+  uint64_t t;
+  if(!instance||CM_Locate_DevNodeA(&dev,(DEVINSTID_A)instance,CM_LOCATE_DEVNODE_NORMAL)!=CR_SUCCESS) return false;
+  if(!arrival_of(dev,&t)||t<116444736000000000ull) return false;
+  // 100ns since 1601 to ns since 1970
+  *wall_ns=(int64_t)(t-116444736000000000ull)*100;
+  return true;
+}
+
+// ports are opened for overlapped i/o so one thread can write while
+// another is blocked reading, each direction has its own event
+struct sport {
+  HANDLE h;
+  HANDLE rd_ev;
+  HANDLE wr_ev;
+  HANDLE ln_ev;       // modem line waits, created on first use
+  HANDLE ln_cancel;   // manual reset, set by scancel_lines_port
+  COMMTIMEOUTS restore;
+};
+
+// implicit port for the single-port interface
+static sport_t *p_serial;
+
 // windows - open serial port
-// device has form "COMn"
-bool sopen(char* device) {
-  h_serial=CreateFile(device,GENERIC_READ|GENERIC_WRITE,0,0,OPEN_EXISTING,0,0);
-  if(h_serial==INVALID_HANDLE_VALUE) {
+// device has form "COMn" (senum's "COMn:" is accepted too)
+sport_t *sopen_port(const char *device) {
+  HANDLE h=CreateFile(device,GENERIC_READ|GENERIC_WRITE,0,0,OPEN_EXISTING,FILE_FLAG_OVERLAPPED,0);
+  if(h==INVALID_HANDLE_VALUE) {
   	// can't open port, verify format and...
   	if(strlen(device)>=4) {
   		if(memcmp(device,"COM",3)==0) {
   			if(device[3]>='1'&&device[3]<='9') {
   				// ..try alternate format (\\.\comN)
   				char *dev=(char *)malloc(strlen(device)+5);
-				if(!dev) return false;
+				if(!dev) return NULL;
   				strcpy(dev,"\\\\.\\com");
   				strcat(dev,device+3);
-  				h_serial=CreateFile(dev,GENERIC_READ|GENERIC_WRITE,0,0,OPEN_EXISTING,0,0);
+  				size_t len=strlen(dev);
+  				if(dev[len-1]==':') dev[len-1]=0;
+  				h=CreateFile(dev,GENERIC_READ|GENERIC_WRITE,0,0,OPEN_EXISTING,FILE_FLAG_OVERLAPPED,0);
   				free(dev);
   			}
   		}
   	}
   }
-  return h_serial!=INVALID_HANDLE_VALUE;
+  if(h==INVALID_HANDLE_VALUE) return NULL;
+  sport_t *port=(sport_t *)calloc(1,sizeof(sport_t));
+  if(!port) {
+    CloseHandle(h);
+    return NULL;
+  }
+  port->h=h;
+  port->rd_ev=CreateEvent(NULL,TRUE,FALSE,NULL);
+  port->wr_ev=CreateEvent(NULL,TRUE,FALSE,NULL);
+  port->ln_cancel=CreateEvent(NULL,TRUE,FALSE,NULL);
+  if(!port->rd_ev||!port->wr_ev||!port->ln_cancel) {
+    if(port->rd_ev) CloseHandle(port->rd_ev);
+    if(port->wr_ev) CloseHandle(port->wr_ev);
+    if(port->ln_cancel) CloseHandle(port->ln_cancel);
+    CloseHandle(h);
+    free(port);
+    return NULL;
+  }
+  GetCommTimeouts(h,&port->restore);
+  return port;
 }
 
 // windows - configure serial port
-bool sconfig(char* fmt) {
+bool sconfig_port(sport_t *port,const char* fmt) {
   DCB dcb;
   COMMTIMEOUTS cmt;
   // clear dcb  
@@ -268,38 +493,156 @@ bool sconfig(char* fmt) {
   dcb.fOutX=0;
   dcb.fInX=0;
   dcb.fRtsControl=0;
-  if(!SetCommState(h_serial,&dcb)) return false;
+  if(!SetCommState(port->h,&dcb)) return false;
   // configure buffers
-  if(!SetupComm(h_serial,1024,1024)) return false;
+  if(!SetupComm(port->h,1024,1024)) return false;
   // configure timeouts 
-  GetCommTimeouts(h_serial,&cmt);
-  memcpy(&restore,&cmt,sizeof(cmt));
+  GetCommTimeouts(port->h,&cmt);
   cmt.ReadIntervalTimeout=1;
   cmt.ReadTotalTimeoutMultiplier=1;
   cmt.ReadTotalTimeoutConstant=1;
   cmt.WriteTotalTimeoutConstant=1;
   cmt.WriteTotalTimeoutMultiplier=1;
-  if(!SetCommTimeouts(h_serial,&cmt)) return false;
+  if(!SetCommTimeouts(port->h,&cmt)) return false;
   return true;
 }
 
+// windows - wait for data on read
+bool swait_port(sport_t *port,uint32_t ms) {
+  COMMTIMEOUTS cmt;
+  GetCommTimeouts(port->h,&cmt);
+  // MAXDWORD interval+multiplier: return as soon as anything arrives, or after ms
+  cmt.ReadIntervalTimeout=MAXDWORD;
+  cmt.ReadTotalTimeoutMultiplier=MAXDWORD;
+  cmt.ReadTotalTimeoutConstant=ms;
+  return SetCommTimeouts(port->h,&cmt)!=0;
+}
+
 // windows - read from serial port
-int32_t sread(void *p_read,uint16_t i_read) {
+int32_t sread_port(sport_t *port,void *p_read,uint16_t i_read) {
   DWORD i_actual=0;
-  if(!ReadFile(h_serial,p_read,i_read,&i_actual,NULL)) return -1;
+  OVERLAPPED ov;
+  memset(&ov,0,sizeof(ov));
+  ov.hEvent=port->rd_ev;
+  if(!ReadFile(port->h,p_read,i_read,NULL,&ov)&&GetLastError()!=ERROR_IO_PENDING) return -1;
+  if(!GetOverlappedResult(port->h,&ov,&i_actual,TRUE)) {
+    // cancelled by scancel_port, not an error
+    return GetLastError()==ERROR_OPERATION_ABORTED ? 0 : -1;
+  }
   return (int32_t)i_actual;
 }
 
 // windows - write to serial port
-int32_t swrite(void* p_write,uint16_t i_write) {
+int32_t swrite_port(sport_t *port,const void* p_write,uint16_t i_write) {
   DWORD i_actual=0;
-  if(!WriteFile(h_serial,p_write,i_write,&i_actual,NULL)) return -1;
+  OVERLAPPED ov;
+  memset(&ov,0,sizeof(ov));
+  ov.hEvent=port->wr_ev;
+  if(!WriteFile(port->h,p_write,i_write,NULL,&ov)&&GetLastError()!=ERROR_IO_PENDING) return -1;
+  if(!GetOverlappedResult(port->h,&ov,&i_actual,TRUE)) return -1;
   return (int32_t)i_actual;
 }
 
+// windows - abort a blocked read or write
+void scancel_port(sport_t *port) {
+  CancelIoEx(port->h,NULL);
+}
+
+// windows - modem status bits to SLINE_*
+static uint32_t lines_of_status(DWORD st) {
+  uint32_t lines=0;
+  if(st&MS_CTS_ON) lines|=SLINE_CTS;
+  if(st&MS_DSR_ON) lines|=SLINE_DSR;
+  if(st&MS_RLSD_ON) lines|=SLINE_DCD;
+  if(st&MS_RING_ON) lines|=SLINE_RI;
+  return lines;
+}
+
+// windows - comm event mask to SLINE_*
+static uint32_t lines_of_events(DWORD ev) {
+  uint32_t lines=0;
+  if(ev&EV_CTS) lines|=SLINE_CTS;
+  if(ev&EV_DSR) lines|=SLINE_DSR;
+  if(ev&EV_RLSD) lines|=SLINE_DCD;
+  if(ev&EV_RING) lines|=SLINE_RI;
+  return lines;
+}
+
+// windows - read modem input lines
+int32_t slines_port(sport_t *port) {
+  DWORD st=0;
+  if(!GetCommModemStatus(port->h,&st)) return -1;
+  return (int32_t)lines_of_status(st);
+}
+
+// windows - wait for a modem line change with an overlapped WaitCommEvent,
+// which runs alongside reads and writes on the same handle
+int32_t swait_lines_port(sport_t *port,uint32_t *lines,uint32_t *changed) {
+  if(!port->ln_ev) port->ln_ev=CreateEvent(NULL,TRUE,FALSE,NULL);
+  if(!port->ln_ev) return -1;
+  if(WaitForSingleObject(port->ln_cancel,0)==WAIT_OBJECT_0) return 0;
+  if(!SetCommMask(port->h,EV_CTS|EV_DSR|EV_RLSD|EV_RING)) return -1;
+  DWORD mask=0;
+  OVERLAPPED ov;
+  memset(&ov,0,sizeof(ov));
+  ov.hEvent=port->ln_ev;
+  if(!WaitCommEvent(port->h,&mask,&ov)) {
+    if(GetLastError()!=ERROR_IO_PENDING) return -1;
+    HANDLE waits[2]={port->ln_ev,port->ln_cancel};
+    DWORD n=0;
+    if(WaitForMultipleObjects(2,waits,FALSE,INFINITE)!=WAIT_OBJECT_0) {
+      CancelIoEx(port->h,&ov);
+      GetOverlappedResult(port->h,&ov,&n,TRUE);
+      return 0;
+    }
+    if(!GetOverlappedResult(port->h,&ov,&n,FALSE)) return -1;
+  }
+  int32_t st=slines_port(port);
+  if(st<0) return -1;
+  *lines=(uint32_t)st;
+  *changed=lines_of_events(mask);
+  return 1;
+}
+
+// windows - abort modem line waits for good
+void scancel_lines_port(sport_t *port) {
+  SetEvent(port->ln_cancel);
+}
+
 // windows - close serial port
-bool sclose() {
+bool sclose_port(sport_t *port) {
   // politeness: restore (some) original configuration
-  SetCommTimeouts(h_serial,&restore);
-  return CloseHandle(h_serial)!=0;
+  SetCommTimeouts(port->h,&port->restore);
+  bool ok=CloseHandle(port->h)!=0;
+  CloseHandle(port->rd_ev);
+  CloseHandle(port->wr_ev);
+  CloseHandle(port->ln_cancel);
+  if(port->ln_ev) CloseHandle(port->ln_ev);
+  free(port);
+  return ok;
+}
+
+// single-port interface
+bool sopen(char* device) {
+  p_serial=sopen_port(device);
+  return p_serial!=NULL;
+}
+
+bool sconfig(char* fmt) {
+  return p_serial && sconfig_port(p_serial,fmt);
+}
+
+int32_t sread(void *p_read,uint16_t i_read) {
+  return p_serial ? sread_port(p_serial,p_read,i_read) : -1;
+}
+
+int32_t swrite(void* p_write,uint16_t i_write) {
+  return p_serial ? swrite_port(p_serial,p_write,i_write) : -1;
+}
+
+bool sclose() {
+  if(!p_serial) return false;
+  bool ok=sclose_port(p_serial);
+  p_serial=NULL;
+  return ok;
 }
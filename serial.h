@@ -11,7 +11,25 @@ extern "C" {
 
 // enumerate serial devices
 // fp_enum is callback to receive each device
-void senum(void (*fp_enum)(char *name,char *device,char *hwid));
+// hwid is the hardware ID list, instance the device instance ID of the
+// USB device (parent of composite interfaces), location the first location
+// path ("PCIROOT(0)#PCI(1400)#USBROOT(0)#USB(3)"), any may be NULL
+void senum(void (*fp_enum)(char *name,char *device,char *hwid,char *instance,char *location));
+
+// generation of the serial port device list, a hash of the present Ports
+// class devices with their devnode status and PortName, cheap next to
+// senum(): when it has not changed since the last senum() there is nothing
+// new to find, a COM number reassigned in place changes it too. 0 if it
+// could not be taken.
+// Take it before senum() so changes in between show up next time.
+uint64_t sgeneration();
+
+// short port name ("COM5") of a senum() device name ("COM5:")
+void sname(const char *device, char *out, uint16_t size);
+
+// when the device with instance ID instance last arrived, wall clock ns
+// since the unix epoch, false if the system does not know
+bool sarrival(const char *instance, int64_t *wall_ns);
 
 // open serial port
 // device has system dependant form
@@ -33,6 +51,49 @@ int32_t swrite(void* p_write,uint16_t i_write);
 // close serial port
 bool sclose();
 
+// multi-port interface, the functions above operate on one implicit port
+typedef struct sport sport_t;
+
+// open serial port, returns NULL on failure
+sport_t *sopen_port(const char *device);
+
+// configure serial port, fmt as for sconfig
+bool sconfig_port(sport_t *port, const char *fmt);
+
+// make reads wait up to ms for the first byte, then return what has arrived
+bool swait_port(sport_t *port, uint32_t ms);
+
+// read from serial port
+// returns bytes actually read, -1 on error (ie: device removed)
+int32_t sread_port(sport_t *port, void *p_read, uint16_t i_read);
+
+// write to serial port
+int32_t swrite_port(sport_t *port, const void *p_write, uint16_t i_write);
+
+// abort a read or write blocked in another thread
+void scancel_port(sport_t *port);
+
+// modem input lines
+#define SLINE_CTS 0x01
+#define SLINE_DSR 0x02
+#define SLINE_DCD 0x04
+#define SLINE_RI  0x08
+
+// current modem input lines (SLINE_*), -1 on error
+int32_t slines_port(sport_t *port);
+
+// wait for a modem input line to change, without polling
+// lines receives the lines after the change, changed the lines that changed
+// (a ring pulse may be over by the time lines is read)
+// returns 1 on a change, 0 if cancelled, -1 on error (ie: device removed)
+int32_t swait_lines_port(sport_t *port, uint32_t *lines, uint32_t *changed);
+
+// make swait_lines_port return 0, now and in every later call
+void scancel_lines_port(sport_t *port);
+
+// close serial port and free handle
+bool sclose_port(sport_t *port);
+
 #ifdef __cplusplus
 }
 #endif
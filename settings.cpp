@@ -0,0 +1,451 @@
+// Settings store
+//
+// See settings.h
+//
+// The file is kept twice: as read, to rewrite it around a changed line
+// with comments and order intact, and as a parsed copy with names and
+// values cut out in place. An open addressing table of entry indexes,
+// keyed by section and name ignoring ASCII case like the registry, finds
+// a value.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <windows.h>
+#include "settings.h"
+
+static const char *SETTINGS_KEY = "Software\\ComPortNotify";
+static const char *INI_NAME = "cpnotify.ini";
+
+#define MAX_FILE_SIZE (1 << 20)
+
+typedef struct {
+	const char *section;       // into text
+	const char *name;
+	const char *value;
+	uint32_t line;             // offset of the line in raw
+	uint32_t next_line;        // offset after it, newline included
+} entry_t;
+
+typedef struct {
+	const char *name;
+	uint32_t end;              // offset in raw after the header or the last entry
+} section_t;
+
+typedef struct {
+	char *raw;
+	char *text;
+	uint32_t len;
+	FILETIME written;
+	entry_t *entries;
+	int nentries;
+	section_t *sections;       // [0] is the main section, before any header
+	int nsections;
+	int32_t *cells;
+	uint32_t mask;
+} store_t;
+
+static store_t g_store;
+static bool g_portable = false;
+static char g_dir[MAX_PATH];
+static char g_path[MAX_PATH];
+static SRWLOCK g_lock = SRWLOCK_INIT;
+static HWND g_hwnd = NULL;
+static UINT g_msg = 0;
+
+static char fold(char c) {
+	return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+// FNV-1a of section and name, ignoring ASCII case
+static uint32_t hash(const char *section, const char *name) {
+	uint32_t h = 2166136261u;
+	for(const char *s = section; *s; s++) h = (h ^ (uint8_t)fold(*s)) * 16777619u;
+	h *= 16777619u;
+	for(const char *s = name; *s; s++) h = (h ^ (uint8_t)fold(*s)) * 16777619u;
+	return h;
+}
+
+static void free_store(store_t *s) {
+	free(s->raw);
+	free(s->text);
+	free(s->entries);
+	free(s->sections);
+	free(s->cells);
+	memset(s, 0, sizeof(*s));
+}
+
+static char *trim(char *p) {
+	while(*p == ' ' || *p == '\t') p++;
+	char *e = p + strlen(p);
+	while(e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) *--e = '\0';
+	return p;
+}
+
+static int find(const store_t *s, const char *section, const char *name) {
+	if(!s->cells) return -1;
+	uint32_t i = hash(section, name) & s->mask;
+	for(;; i = (i + 1) & s->mask) {
+		int e = s->cells[i];
+		if(e < 0) return -1;
+		if(_stricmp(s->entries[e].section, section) == 0 && _stricmp(s->entries[e].name, name) == 0) return e;
+	}
+}
+
+// last block of a section, -1 if the file has none
+static int find_section(const store_t *s, const char *section) {
+	for(int i = s->nsections - 1; i >= 0; i--) {
+		if(_stricmp(s->sections[i].name, section) == 0) return i;
+	}
+	return -1;
+}
+
+// index text, a copy of raw
+static bool parse(store_t *s) {
+	uint32_t lines = 1;
+	for(uint32_t i = 0; i < s->len; i++) lines += s->raw[i] == '\n';
+	s->entries = (entry_t *)calloc(lines, sizeof(entry_t));
+	s->sections = (section_t *)calloc(lines + 1, sizeof(section_t));
+	uint32_t ncells = 2;
+	while(ncells < lines * 2) ncells <<= 1;
+	s->cells = (int32_t *)malloc(ncells * sizeof(int32_t));
+	if(!s->entries || !s->sections || !s->cells) return false;
+	s->mask = ncells - 1;
+	for(uint32_t i = 0; i < ncells; i++) s->cells[i] = -1;
+	s->sections[0].name = "";
+	s->nsections = 1;
+	int sec = 0;
+	uint32_t pos = 0;
+	while(pos < s->len) {
+		uint32_t eol = pos;
+		while(eol < s->len && s->text[eol] != '\n') eol++;
+		uint32_t next = eol < s->len ? eol + 1 : s->len;
+		s->text[eol] = '\0';
+		char *p = trim(s->text + pos);
+		if(*p == '[') {
+			char *close = strchr(p, ']');
+			if(close) {
+				*close = '\0';
+				sec = s->nsections++;
+				s->sections[sec].name = trim(p + 1);
+				s->sections[sec].end = next;
+			}
+		} else if(*p && *p != ';' && *p != '#') {
+			char *eq = strchr(p, '=');
+			if(eq) {
+				char *value = trim(eq + 1);
+				*eq = '\0';
+				char *name = trim(p);
+				if(*name) {
+					entry_t *e = &s->entries[s->nentries];
+					e->section = s->sections[sec].name;
+					e->name = name;
+					e->value = value;
+					e->line = pos;
+					e->next_line = next;
+					s->sections[sec].end = next;
+					// the first of repeated names is the one looked up
+					if(find(s, e->section, name) < 0) {
+						uint32_t i = hash(e->section, name) & s->mask;
+						while(s->cells[i] >= 0) i = (i + 1) & s->mask;
+						s->cells[i] = s->nentries;
+					}
+					s->nentries++;
+				}
+			}
+		}
+		pos = next;
+	}
+	return true;
+}
+
+static bool read_store(store_t *s, const char *path) {
+	memset(s, 0, sizeof(*s));
+	HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(f == INVALID_HANDLE_VALUE) return false;
+	BY_HANDLE_FILE_INFORMATION info;
+	bool ok = GetFileInformationByHandle(f, &info) && !info.nFileSizeHigh && info.nFileSizeLow <= MAX_FILE_SIZE;
+	if(ok) {
+		s->len = info.nFileSizeLow;
+		s->written = info.ftLastWriteTime;
+		s->raw = (char *)malloc(s->len + 1);
+		s->text = (char *)malloc(s->len + 1);
+		ok = s->raw && s->text;
+	}
+	if(ok && s->len) {
+		HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+		const char *view = m ? (const char *)MapViewOfFile(m, FILE_MAP_READ, 0, 0, s->len) : NULL;
+		if(view) {
+			memcpy(s->raw, view, s->len);
+			UnmapViewOfFile(view);
+		} else {
+			ok = false;
+		}
+		if(m) CloseHandle(m);
+	}
+	CloseHandle(f);
+	if(ok) {
+		s->raw[s->len] = '\0';
+		memcpy(s->text, s->raw, s->len + 1);
+		ok = parse(s);
+	}
+	if(!ok) free_store(s);
+	return ok;
+}
+
+bool settings_replace_file(const char *path, const void *data, size_t len) {
+	char tmp[MAX_PATH + 24];
+	snprintf(tmp, sizeof(tmp), "%s.%lu.tmp", path, (unsigned long)GetCurrentProcessId());
+	HANDLE f = CreateFileA(tmp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(f == INVALID_HANDLE_VALUE) return false;
+	DWORD written = 0;
+	bool ok = WriteFile(f, data, (DWORD)len, &written, NULL) && written == len && FlushFileBuffers(f);
+	CloseHandle(f);
+	if(ok) ok = MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+	if(!ok) DeleteFileA(tmp);
+	return ok;
+}
+
+static bool ini_set(const char *section, const char *name, const char *value) {
+	if(!name[0] || strpbrk(name, "=\r\n") || strpbrk(section, "]\r\n") || (value && strpbrk(value, "\r\n"))) return false;
+	AcquireSRWLockExclusive(&g_lock);
+	// rewrite what is on disk now, another instance may have changed it
+	store_t cur;
+	if(!read_store(&cur, g_path)) {
+		// start a new file, but never replace one that could not be read
+		if(GetFileAttributesA(g_path) != INVALID_FILE_ATTRIBUTES) {
+			ReleaseSRWLockExclusive(&g_lock);
+			return false;
+		}
+		memset(&cur, 0, sizeof(cur));
+		cur.raw = (char *)calloc(1, 1);
+		cur.text = (char *)calloc(1, 1);
+		if(!cur.raw || !cur.text || !parse(&cur)) {
+			free_store(&cur);
+			ReleaseSRWLockExclusive(&g_lock);
+			return false;
+		}
+	}
+	int e = find(&cur, section, name);
+	int sec = find_section(&cur, section);
+	bool ok = true;
+	if(e >= 0 || value) {
+		// raw up to cut, the new line, raw from resume
+		uint32_t cut = cur.len;
+		uint32_t resume = cur.len;
+		if(e >= 0) {
+			cut = cur.entries[e].line;
+			resume = cur.entries[e].next_line;
+		} else if(sec >= 0) {
+			cut = resume = cur.sections[sec].end;
+		}
+		char *out = (char *)malloc(cur.len + strlen(section) + strlen(name) + (value ? strlen(value) : 0) + 16);
+		ok = out != NULL;
+		if(ok) {
+			size_t n = cut;
+			memcpy(out, cur.raw, cut);
+			if(value) {
+				// a last line without a newline gets one before anything follows it
+				if(n && out[n - 1] != '\n') n += sprintf(out + n, "\r\n");
+				if(e < 0 && sec < 0) n += sprintf(out + n, "[%s]\r\n", section);
+				n += sprintf(out + n, "%s=%s\r\n", name, value);
+			}
+			memcpy(out + n, cur.raw + resume, cur.len - resume);
+			n += cur.len - resume;
+			ok = settings_replace_file(g_path, out, n);
+			free(out);
+		}
+		if(ok) {
+			free_store(&g_store);
+			read_store(&g_store, g_path);
+		}
+	}
+	free_store(&cur);
+	ReleaseSRWLockExclusive(&g_lock);
+	return ok;
+}
+
+// Pick up changes made outside this process, true if there were any
+static bool reload_if_changed() {
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	// a deleted file leaves the settings as they were
+	if(!GetFileAttributesExA(g_path, GetFileExInfoStandard, &attr)) return false;
+	AcquireSRWLockShared(&g_lock);
+	bool same = CompareFileTime(&attr.ftLastWriteTime, &g_store.written) == 0 && !attr.nFileSizeHigh && attr.nFileSizeLow == g_store.len;
+	ReleaseSRWLockShared(&g_lock);
+	if(same) return false;
+	store_t s;
+	if(!read_store(&s, g_path)) return false;
+	AcquireSRWLockExclusive(&g_lock);
+	free_store(&g_store);
+	g_store = s;
+	ReleaseSRWLockExclusive(&g_lock);
+	return true;
+}
+
+static DWORD WINAPI watch_thread(LPVOID param) {
+	HANDLE ch = FindFirstChangeNotificationA(g_dir, FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE);
+	if(ch == INVALID_HANDLE_VALUE) return 0;
+	while(WaitForSingleObject(ch, INFINITE) == WAIT_OBJECT_0) {
+		// editors save in several steps, let them finish
+		Sleep(100);
+		if(reload_if_changed() && g_hwnd) PostMessage(g_hwnd, g_msg, 0, 0);
+		if(!FindNextChangeNotification(ch)) break;
+	}
+	FindCloseChangeNotification(ch);
+	return 0;
+}
+
+void settings_load(HWND hwnd, UINT msg) {
+	g_hwnd = hwnd;
+	g_msg = msg;
+	if(g_portable) return;
+	DWORD n = GetModuleFileNameA(NULL, g_dir, sizeof(g_dir));
+	if(!n || n >= sizeof(g_dir)) return;
+	char *slash = strrchr(g_dir, '\\');
+	if(!slash) return;
+	*slash = '\0';
+	if(snprintf(g_path, sizeof(g_path), "%s\\%s", g_dir, INI_NAME) >= (int)sizeof(g_path)) return;
+	if(GetFileAttributesA(g_path) == INVALID_FILE_ATTRIBUTES) return;
+	if(!read_store(&g_store, g_path)) return;
+	g_portable = true;
+	HANDLE t = CreateThread(NULL, 0, watch_thread, NULL, 0, NULL);
+	if(t) CloseHandle(t);
+}
+
+bool settings_portable() {
+	return g_portable;
+}
+
+static bool reg_open(const char *section, REGSAM access, bool create, HKEY *key) {
+	char path[128];
+	if(section[0]) snprintf(path, sizeof(path), "%s\\%s", SETTINGS_KEY, section);
+	else snprintf(path, sizeof(path), "%s", SETTINGS_KEY);
+	if(create) return RegCreateKeyExA(HKEY_CURRENT_USER, path, 0, NULL, 0, access, NULL, key, NULL) == ERROR_SUCCESS;
+	return RegOpenKeyExA(HKEY_CURRENT_USER, path, 0, access, key) == ERROR_SUCCESS;
+}
+
+uint32_t settings_dword(const char *section, const char *name, uint32_t def) {
+	if(g_portable) {
+		uint32_t value = def;
+		AcquireSRWLockShared(&g_lock);
+		int e = find(&g_store, section, name);
+		if(e >= 0) {
+			const char *v = g_store.entries[e].value;
+			char *end;
+			unsigned long n = strtoul(v, &end, 0);
+			if(end != v && !*end) value = (uint32_t)n;
+		}
+		ReleaseSRWLockShared(&g_lock);
+		return value;
+	}
+	HKEY hKey;
+	if(!reg_open(section, KEY_QUERY_VALUE, false, &hKey)) return def;
+	DWORD value = 0;
+	DWORD size = sizeof(value);
+	DWORD type = 0;
+	LONG result = RegQueryValueExA(hKey, name, NULL, &type, (LPBYTE)&value, &size);
+	RegCloseKey(hKey);
+	if(result != ERROR_SUCCESS || type != REG_DWORD) return def;
+	return value;
+}
+
+bool settings_string(const char *section, const char *name, char *out, size_t size) {
+	if(!size) return false;
+	if(g_portable) {
+		bool ok = false;
+		AcquireSRWLockShared(&g_lock);
+		int e = find(&g_store, section, name);
+		if(e >= 0) {
+			size_t len = strlen(g_store.entries[e].value);
+			if(len < size) {
+				memcpy(out, g_store.entries[e].value, len + 1);
+				ok = true;
+			}
+		}
+		ReleaseSRWLockShared(&g_lock);
+		return ok;
+	}
+	HKEY hKey;
+	if(!reg_open(section, KEY_QUERY_VALUE, false, &hKey)) return false;
+	DWORD type = 0;
+	DWORD len = (DWORD)size - 1;
+	LONG result = RegQueryValueExA(hKey, name, NULL, &type, (LPBYTE)out, &len);
+	RegCloseKey(hKey);
+	if(result != ERROR_SUCCESS || type != REG_SZ) return false;
+	out[len] = '\0';
+	return true;
+}
+
+bool settings_set_dword(const char *section, const char *name, uint32_t value) {
+	if(g_portable) {
+		char text[16];
+		snprintf(text, sizeof(text), "%u", value);
+		return ini_set(section, name, text);
+	}
+	HKEY hKey;
+	if(!reg_open(section, KEY_SET_VALUE, true, &hKey)) return false;
+	DWORD v = value;
+	bool ok = RegSetValueExA(hKey, name, 0, REG_DWORD, (const BYTE *)&v, sizeof(v)) == ERROR_SUCCESS;
+	RegCloseKey(hKey);
+	return ok;
+}
+
+bool settings_set_string(const char *section, const char *name, const char *value) {
+	if(g_portable) return ini_set(section, name, value);
+	HKEY hKey;
+	if(!reg_open(section, KEY_SET_VALUE, value != NULL, &hKey)) return value == NULL;
+	bool ok;
+	if(value) ok = RegSetValueExA(hKey, name, 0, REG_SZ, (const BYTE *)value, (DWORD)(strlen(value) + 1)) == ERROR_SUCCESS;
+	else ok = RegDeleteValueA(hKey, name) == ERROR_SUCCESS;
+	RegCloseKey(hKey);
+	return ok;
+}
+
+uint32_t settings_values(const char *section, settings_fn fn, void *ctx) {
+	uint32_t calls = 0;
+	if(g_portable) {
+		AcquireSRWLockShared(&g_lock);
+		for(int i = 0; i < g_store.nentries; i++) {
+			const entry_t *e = &g_store.entries[i];
+			if(_stricmp(e->section, section) != 0) continue;
+			if(fn) fn(e->name, e->value, ctx);
+			calls++;
+		}
+		ReleaseSRWLockShared(&g_lock);
+		return calls;
+	}
+	HKEY hKey;
+	if(!reg_open(section, KEY_QUERY_VALUE, false, &hKey)) return 0;
+	DWORD count = 0;
+	DWORD maxData = 0;
+	char *data = NULL;
+	if(RegQueryInfoKeyA(hKey, NULL, NULL, NULL, NULL, NULL, NULL, &count, NULL, &maxData, NULL, NULL) == ERROR_SUCCESS && count) {
+		data = (char *)malloc(maxData + 2);
+	}
+	for(DWORD i = 0; data && i < count; i++) {
+		char name[256];
+		DWORD nameSize = sizeof(name);
+		DWORD dataSize = maxData;
+		DWORD type = 0;
+		if(RegEnumValueA(hKey, i, name, &nameSize, NULL, &type, (LPBYTE)data, &dataSize) != ERROR_SUCCESS) continue;
+		data[dataSize] = '\0';
+		data[dataSize + 1] = '\0';
+		if(type == REG_SZ) {
+			if(fn) fn(name, data, ctx);
+			calls++;
+		} else if(type == REG_MULTI_SZ) {
+			for(char *p = data; *p; p += strlen(p) + 1) {
+				if(fn) fn(name, p, ctx);
+				calls++;
+			}
+		} else {
+			if(fn) fn(name, NULL, ctx);
+			calls++;
+		}
+	}
+	free(data);
+	RegCloseKey(hKey);
+	return calls;
+}
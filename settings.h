@@ -0,0 +1,57 @@
+// Settings store
+//
+// Settings live under HKCU\Software\ComPortNotify, or in the portable build
+// in cpnotify.ini next to the executable: when that file exists at startup
+// it is used instead of the registry. Sections are the subkeys ("Rules",
+// "Profiles", "Slots", ...), "" is the main key. In the file the main key
+// is the lines before the first [section], numbers are decimal or 0x hex:
+//
+//   NotificationMode=2
+//   [Profiles]
+//   16c0:0483:12345=115200,N,8,1
+//
+// The file is mapped and parsed once into a hash index, lookups are probes
+// into it. Changes are written to a temporary file that then replaces
+// cpnotify.ini, so readers never see half a file. Changes made by another
+// instance or an editor are picked up and announced with a message.
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <windows.h>
+
+// value callback: value is NULL for values that are not text (registry
+// DWORD and binary values), a REG_MULTI_SZ value or a name repeated in the
+// file gives one call per string
+typedef void (*settings_fn)(const char *name, const char *value, void *ctx);
+
+// pick the store and index the file, msg is posted to hwnd after the file
+// changed outside this process
+void settings_load(HWND hwnd, UINT msg);
+
+// true if settings come from cpnotify.ini
+bool settings_portable();
+
+// number value, def if missing or not a number
+uint32_t settings_dword(const char *section, const char *name, uint32_t def);
+
+// text value, false if missing or longer than size - 1
+bool settings_string(const char *section, const char *name, char *out, size_t size);
+
+bool settings_set_dword(const char *section, const char *name, uint32_t value);
+
+// value NULL removes name
+bool settings_set_string(const char *section, const char *name, const char *value);
+
+// call fn for every value of a section in order, returns the number of
+// calls, fn may be NULL to only count them
+uint32_t settings_values(const char *section, settings_fn fn, void *ctx);
+
+// replace the file at path with data through a temporary file next to it,
+// readers see the old file or the new one, never part of it
+bool settings_replace_file(const char *path, const void *data, size_t len);
+
+#endif
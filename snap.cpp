@@ -0,0 +1,163 @@
+// Port snapshot
+//
+// See snap.h
+//
+// Buffers come from the heap rather than mem_alloc: they are few, kept
+// for the life of the process and larger than the fixed region's biggest
+// size class.
+
+#include <stdlib.h>
+#include <string.h>
+#include "snap.h"
+#include "metrics.h"
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME  1099511628211ull
+
+// FNV-1a of s and a terminator, so fields hash apart, NULL differs from ""
+static uint64_t fnv(uint64_t h, const char *s) {
+	if(!s) return (h ^ 0xff) * FNV_PRIME;
+	for(; *s; s++) h = (h ^ (uint8_t)*s) * FNV_PRIME;
+	return h * FNV_PRIME;
+}
+
+static bool reserve(snap_t *s, size_t need) {
+	if(s->count == s->cap) {
+		uint32_t cap = s->cap ? s->cap * 2 : 64;
+		snap_key_t *keys = (snap_key_t *)realloc(s->keys, cap * sizeof(snap_key_t));
+		if(!keys) return false;
+		s->keys = keys;
+		snap_str_t *str = (snap_str_t *)realloc(s->str, cap * sizeof(snap_str_t));
+		if(!str) return false;
+		s->str = str;
+		s->cap = cap;
+		metrics_count(M_ALLOCS, 2);
+	}
+	if(s->pool_len + need > s->pool_cap) {
+		size_t cap = s->pool_cap ? (size_t)s->pool_cap * 2 : 4096;
+		while(cap < s->pool_len + need) cap *= 2;
+		if(cap > UINT32_MAX) return false;
+		char *pool = (char *)realloc(s->pool, cap);
+		if(!pool) return false;
+		s->pool = pool;
+		s->pool_cap = (uint32_t)cap;
+		metrics_count(M_ALLOCS, 1);
+	}
+	return true;
+}
+
+static uint32_t put(snap_t *s, const char *str) {
+	if(!str) return SNAP_NONE;
+	uint32_t off = s->pool_len;
+	size_t len = strlen(str) + 1;
+	memcpy(s->pool + off, str, len);
+	s->pool_len += (uint32_t)len;
+	return off;
+}
+
+void snap_clear(snap_t *s) {
+	s->count = 0;
+	s->pool_len = 0;
+}
+
+void snap_free(snap_t *s) {
+	free(s->keys);
+	free(s->str);
+	free(s->pool);
+	memset(s, 0, sizeof(*s));
+}
+
+bool snap_add(snap_t *s, const char *device, const char *name, const char *hwid, const char *instance, const char *slot) {
+	size_t need = strlen(device) + strlen(name) + strlen(slot) + 3;
+	if(hwid) need += strlen(hwid) + 1;
+	if(instance) need += strlen(instance) + 1;
+	if(!reserve(s, need)) return false;
+	snap_str_t *p = &s->str[s->count];
+	p->device = put(s, device);
+	p->name = put(s, name);
+	p->hwid = put(s, hwid);
+	p->instance = put(s, instance);
+	p->slot = put(s, slot);
+	snap_key_t *k = &s->keys[s->count];
+	k->key = fnv(FNV_OFFSET, device);
+	uint64_t attr = fnv(k->key, name);
+	attr = fnv(attr, hwid);
+	attr = fnv(attr, instance);
+	k->attr = fnv(attr, slot) | 1;
+	k->idx = s->count;
+	k->flags = 0;
+	s->count++;
+	return true;
+}
+
+static int by_key(const void *a, const void *b) {
+	uint64_t x = ((const snap_key_t *)a)->key;
+	uint64_t y = ((const snap_key_t *)b)->key;
+	return (x > y) - (x < y);
+}
+
+static const char *device_at(const snap_t *s, uint32_t pos) {
+	return s->pool + s->str[s->keys[pos].idx].device;
+}
+
+void snap_sort(snap_t *s) {
+	if(s->count < 2) return;
+	qsort(s->keys, s->count, sizeof(snap_key_t), by_key);
+	// names sharing a hash go by name, the order compare() expects
+	for(uint32_t i = 1; i < s->count; i++) {
+		if(s->keys[i].key != s->keys[i - 1].key) continue;
+		for(uint32_t j = i; j > 0 && s->keys[j].key == s->keys[j - 1].key && strcmp(device_at(s, j - 1), device_at(s, j)) > 0; j--) {
+			snap_key_t t = s->keys[j];
+			s->keys[j] = s->keys[j - 1];
+			s->keys[j - 1] = t;
+		}
+	}
+}
+
+static int compare(const snap_t *prev, uint32_t i, const snap_t *cur, uint32_t j) {
+	uint64_t x = prev->keys[i].key;
+	uint64_t y = cur->keys[j].key;
+	if(x != y) return x < y ? -1 : 1;
+	return strcmp(device_at(prev, i), device_at(cur, j));
+}
+
+void snap_diff(snap_t *prev, snap_t *cur, snap_fn fn, void *ctx) {
+	const snap_key_t *a = prev->keys;
+	const snap_key_t *b = cur->keys;
+	uint32_t n = prev->count;
+	uint32_t m = cur->count;
+	uint32_t i = 0, j = 0, pending = 0;
+	while(i < n && j < m) {
+		// the common case, the same port with the same details: attr covers
+		// the name too, so both hashes would have to collide to get here wrongly
+		if(!((a[i].key ^ b[j].key) | (a[i].attr ^ b[j].attr))) {
+			i++;
+			j++;
+			continue;
+		}
+		int d = compare(prev, i, cur, j);
+		if(d < 0) {
+			fn(SNAP_REMOVED, prev, i++, ctx);
+		} else if(d > 0) {
+			cur->keys[j++].flags |= SNAP_ADD;
+			pending++;
+		} else {
+			cur->keys[j++].flags |= SNAP_CHANGE;
+			i++;
+			pending++;
+		}
+	}
+	while(i < n) fn(SNAP_REMOVED, prev, i++, ctx);
+	for(; j < m; j++) {
+		cur->keys[j].flags |= SNAP_ADD;
+		pending++;
+	}
+	// connects after every removal of the same enumeration
+	for(j = 0; pending && j < m; j++) {
+		uint32_t f = cur->keys[j].flags & (SNAP_ADD | SNAP_CHANGE);
+		if(!f) continue;
+		cur->keys[j].flags &= ~f;
+		pending--;
+		fn(f == SNAP_ADD ? SNAP_ADDED : SNAP_CHANGED, cur, j, ctx);
+	}
+}
@@ -0,0 +1,90 @@
+// Port snapshot
+//
+// The ports of one enumeration as a structure of arrays: a key array
+// sorted by port name hash, holding for each port that hash, a hash of
+// everything else reported about it and the index of its strings, which
+// are offsets into one pool. Two snapshots are compared in two passes: a
+// merge walk over both key arrays reports removals as it finds them and
+// flags the keys of ports that came or changed, then a walk over the new
+// keys reports the flagged ones, so every removal comes before any
+// connect. Strings are only touched for ports that came, went or changed.
+//
+// Buffers only grow and are kept when a snapshot is cleared, so once the
+// largest enumeration has been seen, filling and comparing snapshots
+// allocate nothing.
+
+#ifndef SNAP_H
+#define SNAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SNAP_NONE UINT32_MAX     // offset of a missing string
+
+enum {
+	SNAP_ADDED = 1,              // pos is in cur
+	SNAP_CHANGED,                // pos is in cur, same port name with other details
+	SNAP_REMOVED                 // pos is in prev
+};
+
+// snap_key_t flags
+enum {
+	SNAP_LATE = 1,               // free for the caller, see main.cpp
+	SNAP_ADD = 2,                // snap_diff bookkeeping
+	SNAP_CHANGE = 4
+};
+
+typedef struct {
+	uint64_t key;                // hash of the port name
+	uint64_t attr;               // hash of name and details, 0 = report as changed next time
+	uint32_t idx;                // into str
+	uint32_t flags;
+} snap_key_t;
+
+typedef struct {
+	uint32_t device;             // pool offsets
+	uint32_t name;
+	uint32_t hwid;               // SNAP_NONE if none
+	uint32_t instance;           // SNAP_NONE if none
+	uint32_t slot;               // "" if unknown
+} snap_str_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t cap;
+	snap_key_t *keys;            // sorted once snap_sort ran
+	snap_str_t *str;
+	char *pool;
+	uint32_t pool_len;
+	uint32_t pool_cap;
+} snap_t;
+
+// change of the port at key position pos of s
+typedef void (*snap_fn)(int change, snap_t *s, uint32_t pos, void *ctx);
+
+// empty s, keeping its buffers
+void snap_clear(snap_t *s);
+
+void snap_free(snap_t *s);
+
+// append a port, false if out of memory
+bool snap_add(snap_t *s, const char *device, const char *name, const char *hwid, const char *instance, const char *slot);
+
+// sort the keys, after the last snap_add
+void snap_sort(snap_t *s);
+
+// call fn for every port removed from prev to cur, then for every port
+// added or changed, both in key order: a device that moved to another
+// port is seen leaving before it arrives
+void snap_diff(snap_t *prev, snap_t *cur, snap_fn fn, void *ctx);
+
+// strings of the port at key position pos
+static inline const snap_str_t *snap_port(const snap_t *s, uint32_t pos) {
+	return &s->str[s->keys[pos].idx];
+}
+
+static inline const char *snap_str(const snap_t *s, uint32_t off) {
+	return off == SNAP_NONE ? NULL : s->pool + off;
+}
+
+#endif
@@ -0,0 +1,28 @@
+gcc -O2 -I. test/metrics_test.cpp metrics.cpp -o bin/metrics_test || exit /b 1
+bin\metrics_test || exit /b 1
+gcc -O2 -I. test/snap_test.cpp snap.cpp metrics.cpp -o bin/snap_test || exit /b 1
+bin\snap_test || exit /b 1
+gcc -O2 -I. test/mem_test.cpp mem.cpp metrics.cpp settings.cpp -o bin/mem_test || exit /b 1
+bin\mem_test || exit /b 1
+gcc -O2 -I. test/ptable_test.cpp ptable.cpp mem.cpp metrics.cpp settings.cpp -o bin/ptable_test || exit /b 1
+bin\ptable_test || exit /b 1
+g++ -std=c++20 -O2 -I. test/await_test.cpp await.cpp ptable.cpp mem.cpp metrics.cpp settings.cpp serial.cpp devid.cpp evclock.cpp timerwheel.cpp -lsetupapi -lcfgmgr32 -o bin/await_test || exit /b 1
+bin\await_test || exit /b 1
+gcc -O2 -I. test/snap_bench.cpp snap.cpp metrics.cpp -o bin/snap_bench || exit /b 1
+bin\snap_bench || exit /b 1
+gcc -O2 -I. test/frame_test.cpp frame.cpp -o bin/frame_test || exit /b 1
+bin\frame_test || exit /b 1
+gcc -O2 -I. test/frame_bench.cpp frame.cpp -o bin/frame_bench || exit /b 1
+bin\frame_bench || exit /b 1
+gcc -O2 -I. test/crc_test.cpp crc.cpp -o bin/crc_test || exit /b 1
+bin\crc_test || exit /b 1
+gcc -O2 -I. test/crc_bench.cpp crc.cpp -o bin/crc_bench || exit /b 1
+bin\crc_bench || exit /b 1
+gcc -O2 -I. test/portshm_bench.cpp portshm.cpp serial.cpp evclock.cpp -lsetupapi -lcfgmgr32 -o bin/portshm_bench || exit /b 1
+bin\portshm_bench || exit /b 1
+g++ -O2 -I. test/alert_bench.cpp alert.cpp settings.cpp mem.cpp metrics.cpp ptable.cpp serial.cpp evclock.cpp -lsetupapi -lcfgmgr32 -o bin/alert_bench || exit /b 1
+bin\alert_bench || exit /b 1
+gcc -O2 -I. test/metrics_bench.cpp metrics.cpp -o bin/metrics_bench || exit /b 1
+bin\metrics_bench || exit /b 1
+gcc -O2 -I. test/history_bench.cpp history.cpp timerwheel.cpp mem.cpp metrics.cpp settings.cpp -o bin/history_bench || exit /b 1
+bin\history_bench || exit /b 1
@@ -0,0 +1,158 @@
+// alert: matching throughput with 100 capture streams at once
+//
+// 32 patterns are loaded the way the portable build reads them, from a
+// cpnotify.ini next to the executable. 100 threads, one per stream as
+// capture runs them, feed 1MB of log lines each in reads of 4KB. A
+// pattern is planted every 64KB, each stream must match all of them and
+// raise one alert, the rest fall in AlertInterval. Figures are MB/s for
+// one stream alone and for all 100 together.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "alert.h"
+#include "settings.h"
+#include "metrics.h"
+#include "mem.h"
+
+#define STREAMS 100
+#define SIZE    (1024 * 1024)
+#define FEED    4096
+#define PLANT   (64 * 1024)
+#define ROUNDS  4
+#define WM_BENCH_ALERT (WM_APP + 1)
+
+static const char *PATTERNS[] = {
+	"PANIC", "assert failed", "Guru Meditation", "HardFault", "watchdog reset",
+	"stack overflow", "brownout", "kernel oops", "segmentation fault", "out of memory",
+	"abort()", "rst:0x", "Backtrace:", "fatal error", "bus error", "illegal instruction",
+	"usage fault", "lockup", "double fault", "heap corrupt", "ERR_TIMEOUT", "CRC mismatch",
+	"boot loop", "unhandled exception", "reboot", "Task watchdog", "disk full", "i2c nack",
+	"spi timeout", "flash write failed", "ota rollback", "low voltage"
+};
+#define NPATTERNS (sizeof(PATTERNS) / sizeof(PATTERNS[0]))
+
+static int g_failed = 0;
+static uint8_t *g_text = NULL;
+static HWND g_win = NULL;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+typedef struct {
+	char device[16];
+	size_t start;
+	alert_stream_t stream;
+} feeder_t;
+
+// the whole text once per round, starting at the stream's own offset
+static DWORD WINAPI feed(LPVOID param) {
+	feeder_t *f = (feeder_t *)param;
+	for(int r = 0; r < ROUNDS; r++) {
+		for(size_t pos = 0; pos < SIZE; pos += FEED) {
+			alert_feed(&f->stream, f->device, g_text + (f->start + pos) % SIZE, FEED);
+		}
+	}
+	return 0;
+}
+
+static double seconds_since(LARGE_INTEGER t0) {
+	LARGE_INTEGER t1, f;
+	QueryPerformanceCounter(&t1);
+	QueryPerformanceFrequency(&f);
+	return (double)(t1.QuadPart - t0.QuadPart) / (double)f.QuadPart;
+}
+
+// alerts posted to the window, released like the receiver would
+static uint32_t take_alerts() {
+	uint32_t n = 0;
+	MSG msg;
+	while(PeekMessage(&msg, g_win, WM_BENCH_ALERT, WM_BENCH_ALERT, PM_REMOVE)) {
+		mem_free((void *)msg.lParam);
+		n++;
+	}
+	return n;
+}
+
+static uint64_t counter(int c) {
+	metrics_snap_t snap;
+	metrics_snapshot(&snap);
+	return snap.counters[c];
+}
+
+// MB/s of n streams fed on a thread each
+static double run(feeder_t *feeders, int n) {
+	HANDLE threads[STREAMS];
+	LARGE_INTEGER t0;
+	QueryPerformanceCounter(&t0);
+	for(int i = 0; i < n; i++) threads[i] = CreateThread(NULL, 0, feed, &feeders[i], 0, NULL);
+	for(int i = 0; i < n; i++) {
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+	return (double)SIZE * ROUNDS * n / seconds_since(t0) / 1e6;
+}
+
+int main() {
+	// patterns in a cpnotify.ini next to the executable
+	char ini[MAX_PATH];
+	DWORD len = GetModuleFileNameA(NULL, ini, sizeof(ini));
+	char *slash = len && len < sizeof(ini) ? strrchr(ini, '\\') : NULL;
+	if(!slash || (size_t)(slash - ini) + 14 > sizeof(ini)) return 1;
+	strcpy(slash + 1, "cpnotify.ini");
+	if(GetFileAttributesA(ini) != INVALID_FILE_ATTRIBUTES) {
+		printf("alert_bench: skipped, %s exists\n", ini);
+		return 0;
+	}
+	FILE *f = fopen(ini, "w");
+	if(!f) return 1;
+	fprintf(f, "[Alerts]\n");
+	for(size_t i = 0; i < NPATTERNS; i++) fprintf(f, "Pattern=%s\n", PATTERNS[i]);
+	fclose(f);
+	g_win = CreateWindowExA(0, "STATIC", "", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, NULL, NULL);
+	settings_load(NULL, 0);
+	alert_load(g_win, WM_BENCH_ALERT);
+	DeleteFileA(ini);
+	CHECK(alert_active());
+
+	// timestamped lines of digits, no letters for a pattern to start in
+	g_text = (uint8_t *)malloc(SIZE);
+	if(!g_text) return 1;
+	uint32_t seed = 1;
+	for(size_t i = 0; i < SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		g_text[i] = i % 80 == 79 ? '\n' : i % 80 == 14 ? ']' : "0123456789 .:"[(seed >> 16) % 13];
+	}
+	uint32_t planted = 0;
+	for(size_t at = 100; at < SIZE; at += PLANT) {
+		const char *p = PATTERNS[planted % NPATTERNS];
+		// case must not matter
+		for(size_t k = 0; p[k]; k++) g_text[at + k] = planted % 2 && p[k] >= 'a' && p[k] <= 'z' ? p[k] - 'a' + 'A' : p[k];
+		planted++;
+	}
+
+	static feeder_t feeders[STREAMS];
+	for(int i = 0; i < STREAMS; i++) {
+		snprintf(feeders[i].device, sizeof(feeders[i].device), "COM%d:", i + 1);
+		feeders[i].start = (size_t)i * 37 * FEED % SIZE;
+	}
+
+	uint64_t matches = counter(M_ALERT_MATCHES);
+	double one = run(feeders, 1);
+	CHECK(counter(M_ALERT_MATCHES) - matches == (uint64_t)planted * ROUNDS);
+	CHECK(take_alerts() == 1);
+
+	memset(feeders, 0, sizeof(feeders[0]));
+	snprintf(feeders[0].device, sizeof(feeders[0].device), "COM1:");
+	matches = counter(M_ALERT_MATCHES);
+	double all = run(feeders, STREAMS);
+	CHECK(counter(M_ALERT_MATCHES) - matches == (uint64_t)planted * ROUNDS * STREAMS);
+	CHECK(take_alerts() == STREAMS);
+
+	printf("1 stream:    %8.0f MB/s\n", one);
+	printf("%d streams: %8.0f MB/s, %.0f MB/s per stream\n", STREAMS, all, all / STREAMS);
+	free(g_text);
+	DestroyWindow(g_win);
+	printf("alert_bench: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
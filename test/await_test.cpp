@@ -0,0 +1,101 @@
+// await: coroutine waits, driven by the event loop hooks
+//
+// Built with -std=c++20 so the coroutine half of await.h is compiled.
+// Events arrive with senum() device names ("COM5:"), waits and results
+// use short port names ("COM5") as portshm and the DLL do.
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "await.h"
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+static int g_stage = 0;
+static await_result_t g_last;
+
+static await_task plug_and_unplug() {
+	await_result_t r = co_await wait_for_device(0x16c0, 0x0483, "12345", 5000);
+	g_last = r;
+	g_stage = 1;
+	if(r.status != AWAIT_OK) co_return;
+	r = co_await next_removal(r.port, 0);
+	g_last = r;
+	g_stage = 2;
+}
+
+static await_task never_plugged() {
+	await_result_t r = co_await wait_for_device(0x2341, 0x0043, NULL, 1);
+	g_last = r;
+	g_stage = 3;
+}
+
+static await_task port_only() {
+	co_await next_removal("COM9:", 0);
+	g_stage = 4;
+}
+
+static devid_t teensy() {
+	devid_t id;
+	memset(&id, 0, sizeof(id));
+	id.vid = 0x16c0;
+	id.pid = 0x0483;
+	strcpy(id.serial, "12345");
+	id.hash = devid_hash(id.vid, id.pid, id.serial);
+	return id;
+}
+
+int main() {
+	await_load(NULL, 0);
+	devid_t id = teensy();
+
+	plug_and_unplug();
+	CHECK(g_stage == 0);
+	CHECK(await_pending() == 1);
+	// another board of the same kind does not count
+	devid_t other = id;
+	strcpy(other.serial, "99999");
+	other.hash = devid_hash(other.vid, other.pid, other.serial);
+	await_connected("COM4:", &other);
+	await_dispatch();
+	CHECK(g_stage == 0);
+
+	await_connected("COM5:", &id);
+	CHECK(g_stage == 0);          // completions wait for the end of the diff
+	await_dispatch();
+	CHECK(g_stage == 1);
+	CHECK(g_last.status == AWAIT_OK);
+	CHECK(strcmp(g_last.port, "COM5") == 0);
+	CHECK(await_pending() == 1);
+
+	await_removed("COM4:", &other);
+	await_dispatch();
+	CHECK(g_stage == 1);
+	await_removed("COM5:", &id);
+	await_dispatch();
+	CHECK(g_stage == 2);
+	CHECK(g_last.status == AWAIT_OK);
+	CHECK(strcmp(g_last.port, "COM5") == 0);
+	CHECK(await_pending() == 0);
+
+	never_plugged();
+	CHECK(await_pending() == 1);
+	Sleep(20);
+	await_timer();
+	CHECK(g_stage == 3);
+	CHECK(g_last.status == AWAIT_TIMEOUT);
+	CHECK(await_pending() == 0);
+
+	// a removal wait may name the port either way, the event needs no identity
+	port_only();
+	CHECK(await_pending() == 1);
+	await_removed("COM9:", NULL);
+	await_dispatch();
+	CHECK(g_stage == 4);
+	CHECK(await_pending() == 0);
+
+	printf("await_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
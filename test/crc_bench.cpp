@@ -0,0 +1,60 @@
+// crc: throughput of every implementation, per algorithm
+//
+// One 1MB buffer, as the largest logs checksum at a time, and 64 byte
+// frames, as most framed protocols send them. Figures are GB/s.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "crc.h"
+
+#define SIZE   (1024 * 1024)
+#define ROUNDS 200
+#define FRAME  64
+
+static const struct {
+	int algo;
+	const char *name;
+	const char *impl;
+} IMPLS[] = {
+	{ CRC_16_CCITT, "crc16", "slice8" },
+	{ CRC_16_CCITT, "crc16", "pclmul" },
+	{ CRC_32C, "crc32c", "slice8" },
+	{ CRC_32C, "crc32c", "sse4.2" }
+};
+
+static double seconds_since(LARGE_INTEGER t0) {
+	LARGE_INTEGER t1, f;
+	QueryPerformanceCounter(&t1);
+	QueryPerformanceFrequency(&f);
+	return (double)(t1.QuadPart - t0.QuadPart) / (double)f.QuadPart;
+}
+
+int main() {
+	uint8_t *buf = (uint8_t *)malloc(SIZE);
+	if(!buf) return 1;
+	uint32_t seed = 1;
+	for(size_t i = 0; i < SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+	volatile uint32_t sink = 0;
+	printf("%-7s %-7s %10s %10s\n", "algo", "impl", "1MB GB/s", "64B GB/s");
+	for(size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); i++) {
+		if(!crc_use(IMPLS[i].algo, IMPLS[i].impl)) continue;
+		LARGE_INTEGER t0;
+		QueryPerformanceCounter(&t0);
+		for(int r = 0; r < ROUNDS; r++) sink += crc_compute(IMPLS[i].algo, buf, SIZE);
+		double big = (double)SIZE * ROUNDS / seconds_since(t0) / 1e9;
+		QueryPerformanceCounter(&t0);
+		for(int r = 0; r < ROUNDS; r++) {
+			for(size_t pos = 0; pos < SIZE; pos += FRAME) sink += crc_compute(IMPLS[i].algo, buf + pos, FRAME);
+		}
+		double small = (double)SIZE * ROUNDS / seconds_since(t0) / 1e9;
+		printf("%-7s %-7s %10.2f %10.2f\n", IMPLS[i].name, IMPLS[i].impl, big, small);
+	}
+	free(buf);
+	printf("crc_bench: done\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+// crc: known answers and bitwise agreement, for every implementation
+//
+// Each implementation the CPU has is put in use without the startup
+// check, so a wrong one fails here instead of being quietly replaced.
+// Beyond the "123456789" check values, every length from 0 to 63 at every
+// alignment of a 16 byte block, longer buffers and split updates must
+// give the bit by bit result.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+static const struct {
+	int algo;
+	const char *impl;
+} IMPLS[] = {
+	{ CRC_16_CCITT, "slice8" },
+	{ CRC_16_CCITT, "pclmul" },
+	{ CRC_32C, "slice8" },
+	{ CRC_32C, "sse4.2" }
+};
+
+// reference, one bit at a time
+static uint32_t bitwise(int algo, const uint8_t *p, size_t len) {
+	if(algo == CRC_16_CCITT) {
+		uint16_t c = 0xFFFF;
+		for(size_t i = 0; i < len; i++) {
+			c ^= (uint16_t)(p[i] << 8);
+			for(int b = 0; b < 8; b++) c = (c & 0x8000) ? (uint16_t)((c << 1) ^ 0x1021) : (uint16_t)(c << 1);
+		}
+		return c;
+	}
+	uint32_t c = 0xFFFFFFFF;
+	for(size_t i = 0; i < len; i++) {
+		c ^= p[i];
+		for(int b = 0; b < 8; b++) c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+	}
+	return ~c;
+}
+
+int main() {
+	static const uint32_t check[CRC_COUNT] = { 0x29B1, 0xE3069283 };
+	uint8_t buf[4096 + 16];
+	uint32_t seed = 12345;
+	for(size_t i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+
+	for(size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); i++) {
+		int algo = IMPLS[i].algo;
+		if(!crc_use(algo, IMPLS[i].impl)) {
+			printf("crc_test: no %s on this CPU\n", IMPLS[i].impl);
+			continue;
+		}
+		CHECK(strcmp(crc_impl(algo), IMPLS[i].impl) == 0);
+		CHECK(crc_compute(algo, "123456789", 9) == check[algo]);
+		CHECK(bitwise(algo, (const uint8_t *)"123456789", 9) == check[algo]);
+
+		int wrong = 0;
+		for(size_t off = 0; off < 16; off++) {
+			for(size_t len = 0; len < 64; len++) {
+				if(crc_compute(algo, buf + off, len) != bitwise(algo, buf + off, len)) wrong++;
+			}
+		}
+		for(size_t len = 64; len <= 4096; len += 61) {
+			if(crc_compute(algo, buf + 3, len) != bitwise(algo, buf + 3, len)) wrong++;
+		}
+		// one checksum in pieces of every size up to 63
+		for(size_t piece = 1; piece < 64; piece++) {
+			uint32_t state = crc_begin(algo);
+			for(size_t pos = 0; pos < 1000; pos += piece) state = crc_update(algo, state, buf + pos, pos + piece > 1000 ? 1000 - pos : piece);
+			if(crc_end(algo, state) != bitwise(algo, buf, 1000)) wrong++;
+		}
+		if(wrong) printf("crc_test: %s %s, %d wrong\n", algo == CRC_16_CCITT ? "crc16" : "crc32c", IMPLS[i].impl, wrong);
+		CHECK(wrong == 0);
+
+		// frames carry their checksum as sent on the wire
+		uint8_t frame[40];
+		memcpy(frame, buf, 32);
+		uint32_t c = crc_compute(algo, frame, 32);
+		uint32_t len;
+		if(algo == CRC_16_CCITT) {
+			frame[32] = (uint8_t)(c >> 8);
+			frame[33] = (uint8_t)c;
+			len = 34;
+		} else {
+			for(int b = 0; b < 4; b++) frame[32 + b] = (uint8_t)(c >> (8 * b));
+			len = 36;
+		}
+		CHECK(crc_check_frame(algo, frame, len));
+		frame[5] ^= 1;
+		CHECK(!crc_check_frame(algo, frame, len));
+	}
+	CHECK(crc_algo("crc16") == CRC_16_CCITT && crc_algo("CRC32C") == CRC_32C && crc_algo("md5") < 0);
+
+	printf("crc_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+// frame: delimiter scan and framing throughput, per scan
+//
+// The scan alone runs over 64MB without a delimiter. Framing runs over
+// newline terminated lines of 1KB, as a logging board sends them, and
+// over COBS frames of 1KB, which are all decoded into the framer buffer.
+// Figures are GB/s of stream.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "frame.h"
+
+#define SIZE   (64 * 1024 * 1024)
+#define FRAME  1024
+#define FEED   4096
+#define ROUNDS 5
+
+static const char *IMPLS[] = { "avx2", "sse2", "bytes" };
+static uint64_t g_frames = 0;
+
+static void count(void *ctx, const uint8_t *frame, uint32_t len) {
+	g_frames++;
+}
+
+static double seconds_since(LARGE_INTEGER t0) {
+	LARGE_INTEGER t1, f;
+	QueryPerformanceCounter(&t1);
+	QueryPerformanceFrequency(&f);
+	return (double)(t1.QuadPart - t0.QuadPart) / (double)f.QuadPart;
+}
+
+static double scan_rate(const uint8_t *buf) {
+	LARGE_INTEGER t0;
+	QueryPerformanceCounter(&t0);
+	size_t found = 0;
+	for(int r = 0; r < ROUNDS; r++) found += (size_t)(frame_scan(buf, buf + SIZE, '\n', '\n') - buf);
+	double s = seconds_since(t0);
+	if(found != (size_t)SIZE * ROUNDS) printf("frame_bench: scan found a delimiter\n");
+	return (double)SIZE * ROUNDS / s / 1e9;
+}
+
+static double feed_rate(int mode, const uint8_t *buf, size_t len) {
+	framer_t f;
+	if(!frame_init(&f, mode, FRAME * 2)) return 0;
+	LARGE_INTEGER t0;
+	QueryPerformanceCounter(&t0);
+	for(int r = 0; r < ROUNDS; r++) {
+		for(size_t pos = 0; pos < len; pos += FEED) {
+			frame_feed(&f, buf + pos, (uint32_t)(len - pos < FEED ? len - pos : FEED), count, NULL);
+		}
+	}
+	double s = seconds_since(t0);
+	frame_free(&f);
+	return (double)len * ROUNDS / s / 1e9;
+}
+
+int main() {
+	uint8_t *plain = (uint8_t *)malloc(SIZE);
+	uint8_t *lines = (uint8_t *)malloc(SIZE);
+	uint8_t *cobs = (uint8_t *)malloc(SIZE);
+	if(!plain || !lines || !cobs) return 1;
+	uint32_t seed = 1;
+	for(size_t i = 0; i < SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		uint8_t c = (uint8_t)(seed >> 16);
+		plain[i] = c == '\n' ? ' ' : c;
+		lines[i] = i % FRAME == FRAME - 1 ? '\n' : 'a' + (c % 26);
+	}
+	// COBS frames of FRAME - 2 nonzero bytes: one code byte, the data, the delimiter
+	for(size_t i = 0; i < SIZE; i += FRAME) {
+		uint8_t *p = cobs + i;
+		for(size_t k = 0; k < FRAME; k++) p[k] = plain[i + k] ? plain[i + k] : 1;
+		for(size_t k = 0; k < FRAME - 1; k += 255) p[k] = (uint8_t)(FRAME - 1 - k < 255 ? FRAME - 1 - k : 255);
+		p[FRAME - 1] = 0;
+	}
+
+	printf("%-6s %10s %10s %10s\n", "scan", "scan GB/s", "line GB/s", "cobs GB/s");
+	for(size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); i++) {
+		if(!frame_use(IMPLS[i])) continue;
+		double scan = scan_rate(plain);
+		double line = feed_rate(FRAME_LINE, lines, SIZE);
+		double dec = feed_rate(FRAME_COBS, cobs, SIZE);
+		printf("%-6s %10.2f %10.2f %10.2f\n", IMPLS[i], scan, line, dec);
+	}
+	free(plain);
+	free(lines);
+	free(cobs);
+	printf("frame_bench: %llu frames\n", (unsigned long long)g_frames);
+	return 0;
+}
@@ -0,0 +1,179 @@
+// frame: every scan gives the same frames, encoded frames come back
+//
+// Random streams are cut into random feeds and framed once per scan the
+// CPU has, the frames must match those of the byte by byte scan. SLIP and
+// COBS frames of random payloads must decode to the payload.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+#define STREAM  (256 * 1024)
+#define FRAMES  2000
+#define MAXLEN  600
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+static const char *IMPLS[] = { "avx2", "sse2", "bytes" };
+static uint32_t g_seed = 12345;
+
+static uint32_t next_rand() {
+	g_seed = g_seed * 1103515245 + 12345;
+	return g_seed >> 8;
+}
+
+// frames as they came: length, then the bytes
+typedef struct {
+	uint8_t *data;
+	size_t used;
+	size_t cap;
+} out_t;
+
+static void collect(void *ctx, const uint8_t *frame, uint32_t len) {
+	out_t *o = (out_t *)ctx;
+	if(o->used + 4 + len > o->cap) {
+		o->cap = (o->used + 4 + len) * 2;
+		o->data = (uint8_t *)realloc(o->data, o->cap);
+	}
+	memcpy(o->data + o->used, &len, 4);
+	memcpy(o->data + o->used + 4, frame, len);
+	o->used += 4 + len;
+}
+
+static void run(int mode, const uint8_t *stream, size_t len, uint32_t seed, out_t *o) {
+	framer_t f;
+	CHECK(frame_init(&f, mode, 256));
+	o->used = 0;
+	g_seed = seed;
+	for(size_t pos = 0; pos < len;) {
+		size_t n = 1 + next_rand() % 300;
+		if(n > len - pos) n = len - pos;
+		frame_feed(&f, stream + pos, (uint32_t)n, collect, o);
+		pos += n;
+	}
+	frame_free(&f);
+}
+
+// bytes with delimiters and escapes about one in 40
+static void random_stream(uint8_t *s, size_t len) {
+	static const uint8_t special[] = { '\n', '\r', 0x00, 0xC0, 0xDB, 0xDC, 0xDD };
+	for(size_t i = 0; i < len; i++) {
+		uint32_t r = next_rand();
+		s[i] = r % 40 ? (uint8_t)(r >> 8) : special[(r >> 8) % sizeof(special)];
+	}
+}
+
+static void same_frames(uint8_t *stream) {
+	for(int mode = FRAME_LINE; mode <= FRAME_COBS; mode++) {
+		out_t ref = { NULL, 0, 0 };
+		out_t got = { NULL, 0, 0 };
+		CHECK(frame_use("bytes"));
+		run(mode, stream, STREAM, 777, &ref);
+		CHECK(ref.used > 0);
+		for(size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); i++) {
+			if(!frame_use(IMPLS[i])) {
+				printf("frame_test: no %s on this CPU\n", IMPLS[i]);
+				continue;
+			}
+			run(mode, stream, STREAM, 777, &got);
+			CHECK(got.used == ref.used && memcmp(got.data, ref.data, ref.used) == 0);
+		}
+		free(ref.data);
+		free(got.data);
+	}
+}
+
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out) {
+	size_t code_at = 0;
+	size_t o = 1;
+	uint8_t code = 1;
+	for(size_t i = 0; i < len; i++) {
+		if(in[i]) {
+			out[o++] = in[i];
+			code++;
+		}
+		if(!in[i] || code == 0xFF) {
+			out[code_at] = code;
+			code_at = o++;
+			code = 1;
+		}
+	}
+	out[code_at] = code;
+	out[o++] = 0;
+	return o;
+}
+
+static size_t slip_encode(const uint8_t *in, size_t len, uint8_t *out) {
+	size_t o = 0;
+	for(size_t i = 0; i < len; i++) {
+		if(in[i] == 0xC0) {
+			out[o++] = 0xDB;
+			out[o++] = 0xDC;
+		} else if(in[i] == 0xDB) {
+			out[o++] = 0xDB;
+			out[o++] = 0xDD;
+		} else {
+			out[o++] = in[i];
+		}
+	}
+	out[o++] = 0xC0;
+	return o;
+}
+
+static void round_trip(int mode) {
+	uint8_t *payloads = (uint8_t *)malloc((size_t)FRAMES * MAXLEN);
+	uint32_t *lens = (uint32_t *)malloc(FRAMES * sizeof(uint32_t));
+	uint8_t *wire = (uint8_t *)malloc((size_t)FRAMES * (MAXLEN * 2 + 4));
+	size_t w = 0;
+	for(int i = 0; i < FRAMES; i++) {
+		uint8_t *p = payloads + (size_t)i * MAXLEN;
+		lens[i] = 1 + next_rand() % (MAXLEN - 1);
+		for(uint32_t k = 0; k < lens[i]; k++) {
+			uint32_t r = next_rand();
+			p[k] = r % 8 ? (uint8_t)(r >> 8) : (r >> 8) % 2 ? 0 : 0xC0;
+		}
+		w += mode == FRAME_COBS ? cobs_encode(p, lens[i], wire + w) : slip_encode(p, lens[i], wire + w);
+	}
+	for(size_t i = 0; i < sizeof(IMPLS) / sizeof(IMPLS[0]); i++) {
+		if(!frame_use(IMPLS[i])) continue;
+		framer_t f;
+		CHECK(frame_init(&f, mode, MAXLEN));
+		out_t got = { NULL, 0, 0 };
+		g_seed = 99;
+		for(size_t pos = 0; pos < w;) {
+			size_t n = 1 + next_rand() % 1000;
+			if(n > w - pos) n = w - pos;
+			frame_feed(&f, wire + pos, (uint32_t)n, collect, &got);
+			pos += n;
+		}
+		CHECK(f.frames == FRAMES && f.dropped == 0);
+		size_t at = 0;
+		bool same = true;
+		for(int k = 0; k < FRAMES && same; k++) {
+			uint32_t len;
+			memcpy(&len, got.data + at, 4);
+			same = len == lens[k] && memcmp(got.data + at + 4, payloads + (size_t)k * MAXLEN, len) == 0;
+			at += 4 + len;
+		}
+		CHECK(same);
+		frame_free(&f);
+		free(got.data);
+	}
+	free(payloads);
+	free(lens);
+	free(wire);
+}
+
+int main() {
+	uint8_t *stream = (uint8_t *)malloc(STREAM);
+	random_stream(stream, STREAM);
+	same_frames(stream);
+	free(stream);
+	round_trip(FRAME_SLIP);
+	round_trip(FRAME_COBS);
+	printf("frame_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
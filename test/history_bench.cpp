@@ -0,0 +1,116 @@
+// history: memory stays flat while 100,000 distinct devices come and go
+//
+// Each device is added, disconnected and never seen again, one every
+// simulated millisecond. Once with HistoryLimit 256 and no "Hide after",
+// so the cap has to drop them, once with "Hide after" 5 seconds and no
+// cap, so expiry has to. Live MEM_HISTORY bytes after the first 10,000
+// devices must never be exceeded later, and must be 0 once everything
+// is dropped. Figures are ns per device and the live bytes held, then
+// ns per lookup among 10,000 connected ports.
+
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "history.h"
+#include "evclock.h"
+#include "mem.h"
+
+#define DEVICES 100000
+#define SETTLE  (DEVICES / 10)
+#define LIMIT   256
+#define HIDE    5
+#define STEP    (EVCLOCK_NS_PER_SEC / 1000)
+#define PORTS   10000
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+static uint64_t live_bytes() {
+	mem_stats_t s;
+	mem_stats(MEM_HISTORY, &s);
+	return s.live_bytes;
+}
+
+static double seconds_since(LARGE_INTEGER t0) {
+	LARGE_INTEGER t1, f;
+	QueryPerformanceCounter(&t1);
+	QueryPerformanceFrequency(&f);
+	return (double)(t1.QuadPart - t0.QuadPart) / (double)f.QuadPart;
+}
+
+// limit < 0 never trims, timeout < 0 never expires
+static void churn(const char *what, int limit, int timeout) {
+	uint64_t now = 1000 * EVCLOCK_NS_PER_SEC;
+	history_init(now);
+	CHECK(live_bytes() == 0);
+	uint64_t settled = 0;
+	uint64_t peak = 0;
+	LARGE_INTEGER t0;
+	QueryPerformanceCounter(&t0);
+	for(int i = 0; i < DEVICES; i++) {
+		// same lengths for every device, so equal counts are equal bytes
+		char device[16];
+		char name[48];
+		char hwid[48];
+		snprintf(device, sizeof(device), "COM%06d", i);
+		snprintf(name, sizeof(name), "USB Serial Device %06d", i);
+		snprintf(hwid, sizeof(hwid), "USB\\VID_16C0&PID_0483\\%06d", i);
+		hport_t *hp = history_add(device, name, hwid);
+		CHECK(hp != NULL);
+		if(!hp) return;
+		hp->disconnected_at = now;
+		history_schedule(hp, timeout);
+		if(limit >= 0) history_trim(limit);
+		now += STEP;
+		history_expire(now);
+		uint64_t live = live_bytes();
+		if(i < SETTLE) {
+			if(live > settled) settled = live;
+		} else if(live > peak) {
+			peak = live;
+		}
+	}
+	double ns = seconds_since(t0) * 1e9 / DEVICES;
+	CHECK(peak <= settled);
+
+	if(limit >= 0) history_trim(0);
+	if(timeout >= 0) history_expire(now + (uint64_t)(timeout + 1) * EVCLOCK_NS_PER_SEC);
+	CHECK(history == NULL);
+	CHECK(live_bytes() == 0);
+	printf("%-14s %6.0f ns per device, %7llu bytes live at most\n", what, ns, (unsigned long long)peak);
+}
+
+// every port looked up by name, as a refresh with all of them changed does
+static void lookups() {
+	char device[16];
+	for(int i = 0; i < PORTS; i++) {
+		snprintf(device, sizeof(device), "COM%d", i);
+		hport_t *hp = history_add(device, "USB Serial Device", NULL);
+		CHECK(hp != NULL);
+		if(hp) hp->connected = true;
+	}
+	int found = 0;
+	LARGE_INTEGER t0;
+	QueryPerformanceCounter(&t0);
+	for(int i = 0; i < PORTS; i++) {
+		snprintf(device, sizeof(device), "COM%d", i);
+		hport_t *hp = history_find(device);
+		if(hp && strcmp(hp->device, device) == 0) found++;
+	}
+	double ns = seconds_since(t0) * 1e9 / PORTS;
+	CHECK(found == PORTS);
+	CHECK(history_find("COM") == NULL);
+	for(hport_t *hp = history; hp; hp = hp->next) hp->connected = false;
+	history_trim(0);
+	CHECK(live_bytes() == 0);
+	printf("%-14s %6.0f ns per lookup among %d ports\n", "history_find", ns, PORTS);
+}
+
+int main() {
+	churn("HistoryLimit", LIMIT, -1);
+	churn("Hide after", -1, HIDE);
+	lookups();
+	printf("history_bench: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+// mem: fixed footprint churn stays inside the region
+//
+// Port tables are published on every change and sized by the number of
+// ports, up to tens of KB, while history and notification strings come
+// and go. Once every size has been seen, the region must stop growing
+// and no allocation may fail.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "mem.h"
+
+#define REGION   (512 * 1024)
+#define ENTRY    160           // about sizeof(ptable_entry_t) and its strings
+#define PORTS    200
+#define STRINGS  64
+#define ROUNDS   20000
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+static void *g_tables[3];      // published, retired, being built
+static void *g_strings[STRINGS];
+static uint32_t g_seed = 12345;
+
+static uint32_t next_rand() {
+	g_seed = g_seed * 1103515245 + 12345;
+	return g_seed >> 8;
+}
+
+// One publish of a table of ports, the oldest of three goes
+static void publish(uint32_t ports) {
+	mem_free(g_tables[0]);
+	g_tables[0] = g_tables[1];
+	g_tables[1] = g_tables[2];
+	g_tables[2] = mem_alloc(MEM_SNAPSHOT, (size_t)ports * ENTRY);
+	CHECK(g_tables[2] != NULL);
+}
+
+static void churn_string() {
+	uint32_t i = next_rand() % STRINGS;
+	mem_free(g_strings[i]);
+	g_strings[i] = mem_alloc(MEM_HISTORY, 8 + next_rand() % 200);
+	CHECK(g_strings[i] != NULL);
+}
+
+int main() {
+	if(!mem_reserve(REGION)) {
+		printf("mem_test: no region\n");
+		return 1;
+	}
+	// every table size three times in a row, every string size class full
+	for(uint32_t p = 1; p <= PORTS; p++) {
+		for(int i = 0; i < 3; i++) publish(p);
+	}
+	static const size_t sizes[] = { 16, 48, 112, 207 };
+	for(size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+		for(int i = 0; i < STRINGS; i++) g_strings[i] = mem_alloc(MEM_HISTORY, sizes[c]);
+		for(int i = 0; i < STRINGS; i++) {
+			mem_free(g_strings[i]);
+			g_strings[i] = NULL;
+		}
+	}
+	for(int i = 0; i < STRINGS; i++) churn_string();
+	size_t size, carved;
+	mem_region(&size, &carved);
+	CHECK(size == REGION);
+	CHECK(carved <= size);
+
+	// steady state: nothing new is carved
+	for(int r = 0; r < ROUNDS; r++) {
+		publish(1 + next_rand() % PORTS);
+		churn_string();
+	}
+	size_t after;
+	mem_region(&size, &after);
+	CHECK(after == carved);
+
+	mem_stats_t s;
+	mem_stats(MEM_SNAPSHOT, &s);
+	CHECK(s.failures == 0);
+	CHECK(s.live_objects == 3);
+	mem_stats(MEM_HISTORY, &s);
+	CHECK(s.failures == 0);
+	CHECK(s.live_objects == STRINGS);
+
+	// beyond the region allocations fail cleanly
+	void *big = mem_alloc(MEM_SNAPSHOT, REGION);
+	CHECK(big == NULL);
+	mem_stats(MEM_SNAPSHOT, &s);
+	CHECK(s.failures == 1);
+
+	printf("mem_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+// metrics: figures of exited threads are kept, their blocks reused
+//
+// Threads come and go like capture and bridge threads do per connection.
+// The snapshot must still hold everything they recorded.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "metrics.h"
+
+#define THREADS 32
+#define ROUNDS  64
+#define EVENTS  1000
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+static DWORD WINAPI worker(LPVOID param) {
+	for(int i = 0; i < EVENTS; i++) {
+		metrics_count(M_EVENTS, 1);
+		metrics_record(H_ENUM, (uint64_t)i);
+	}
+	return 0;
+}
+
+static uint64_t hist_total(const metrics_snap_t *s, int h) {
+	uint64_t n = 0;
+	for(int i = 0; i < METRICS_BUCKETS; i++) n += s->hist[h][i];
+	return n;
+}
+
+int main() {
+	metrics_snap_t *s = (metrics_snap_t *)malloc(sizeof(metrics_snap_t));
+	if(!s) return 1;
+	metrics_count(M_EVENTS, 1);   // this thread's block stays live
+	for(int r = 0; r < ROUNDS; r++) {
+		HANDLE t[THREADS];
+		for(int i = 0; i < THREADS; i++) t[i] = CreateThread(NULL, 0, worker, NULL, 0, NULL);
+		for(int i = 0; i < THREADS; i++) {
+			CHECK(t[i] != NULL);
+			if(!t[i]) continue;
+			WaitForSingleObject(t[i], INFINITE);
+			CloseHandle(t[i]);
+		}
+		metrics_snapshot(s);
+		CHECK(s->counters[M_EVENTS] == 1 + (uint64_t)(r + 1) * THREADS * EVENTS);
+		CHECK(hist_total(s, H_ENUM) == (uint64_t)(r + 1) * THREADS * EVENTS);
+	}
+	CHECK(metrics_quantile(s, H_ENUM, 1.0) >= EVENTS - 1);
+	free(s);
+	printf("metrics_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+// portshm: lookup cost from a client, with and without a writer
+//
+// The section is created and mapped like ComPortNotify and a client do,
+// in one process. A table of 200 ports is published and the client looks
+// up the last connected one. With a writer publishing new versions all
+// the time, lookups that overlap a write go through the sequence lock
+// retry; every record they return must be from a single version.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "portshm.h"
+#include "ptable.h"
+
+#define PORTS   200
+#define LOOKUPS 2000000
+
+static int g_failed = 0;
+static volatile LONG g_stop = 0;
+static ptable_t *g_table = NULL;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+// name and slot of every entry carry the version, a record where they
+// differ was copied in the middle of a write
+static char g_names[PORTS][32];
+static char g_devices[PORTS][32];
+static char g_serials[PORTS][16];
+
+static void fill(uint64_t version) {
+	for(int i = 0; i < PORTS; i++) {
+		ptable_entry_t *e = &g_table->entries[i];
+		snprintf(g_names[i], sizeof(g_names[i]), "v%llu", (unsigned long long)version);
+		e->name = g_names[i];
+		e->slot = g_names[i];
+	}
+	g_table->version = version;
+}
+
+static DWORD WINAPI writer(LPVOID param) {
+	for(uint64_t v = 2; !g_stop; v++) {
+		fill(v);
+		portshm_publish(g_table);
+	}
+	return 0;
+}
+
+static double seconds_since(LARGE_INTEGER t0) {
+	LARGE_INTEGER t1, f;
+	QueryPerformanceCounter(&t1);
+	QueryPerformanceFrequency(&f);
+	return (double)(t1.QuadPart - t0.QuadPart) / (double)f.QuadPart;
+}
+
+// ns per lookup, counts lookups that saw a write and torn records
+static double lookups(const portshm_t *m, uint32_t *overlapped, uint32_t *torn) {
+	portshm_record_t r;
+	*overlapped = 0;
+	*torn = 0;
+	LARGE_INTEGER t0;
+	QueryPerformanceCounter(&t0);
+	for(int i = 0; i < LOOKUPS; i++) {
+		LONG before = m->seq;
+		bool found = portshm_find(m, 0x16c0, 0x0483, "S199", &r);
+		if(m->seq != before) (*overlapped)++;
+		if(!found || strcmp(r.name, r.slot) != 0 || strcmp(r.device, "COM200") != 0) (*torn)++;
+	}
+	return seconds_since(t0) * 1e9 / LOOKUPS;
+}
+
+int main() {
+	if(!portshm_open()) {
+		// ComPortNotify owns the section while it runs
+		printf("portshm_bench: skipped, section in use\n");
+		return 0;
+	}
+	const portshm_t *m = portshm_map();
+	CHECK(m != NULL);
+	if(!m) return 1;
+
+	g_table = (ptable_t *)calloc(1, sizeof(ptable_t) + (PORTS - 1) * sizeof(ptable_entry_t));
+	for(int i = 0; i < PORTS; i++) {
+		ptable_entry_t *e = &g_table->entries[i];
+		snprintf(g_devices[i], sizeof(g_devices[i]), "COM%d:", i + 1);
+		snprintf(g_serials[i], sizeof(g_serials[i]), "S%d", i);
+		e->device = g_devices[i];
+		e->id.vid = 0x16c0;
+		e->id.pid = 0x0483;
+		snprintf(e->id.serial, sizeof(e->id.serial), "%s", g_serials[i]);
+		e->connected = true;
+	}
+	g_table->count = PORTS;
+	fill(1);
+	portshm_publish(g_table);
+
+	uint32_t overlapped, torn;
+	double idle = lookups(m, &overlapped, &torn);
+	CHECK(torn == 0);
+	printf("idle:        %7.1f ns per lookup\n", idle);
+
+	HANDLE w = CreateThread(NULL, 0, writer, NULL, 0, NULL);
+	double busy = lookups(m, &overlapped, &torn);
+	InterlockedExchange(&g_stop, 1);
+	WaitForSingleObject(w, INFINITE);
+	CloseHandle(w);
+	CHECK(torn == 0);
+	printf("with writer: %7.1f ns per lookup, %lu of %d overlapped a write\n", busy, (unsigned long)overlapped, LOOKUPS);
+
+	portshm_unmap(m);
+	free(g_table);
+	printf("portshm_bench: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+// ptable: readers on short lived threads, publisher reusing memory at once
+//
+// Alerts read the port table from capture threads that live as long as
+// one connection. Each table a reader holds must stay intact until it
+// leaves, and the reader records of exited threads must be reused.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "ptable.h"
+#include "mem.h"
+
+#define THREADS 16
+#define ROUNDS  100
+#define READS   200
+#define PORTS   8
+
+static int g_failed = 0;
+static volatile LONG g_torn = 0;        // tables that changed under a reader
+static volatile LONG g_publish_failed = 0;
+static volatile LONG g_stop = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+// every entry of a table names its version
+static bool intact(const ptable_t *t) {
+	char name[32];
+	snprintf(name, sizeof(name), "v%llu", (unsigned long long)t->version);
+	if(t->count != PORTS) return false;
+	for(uint32_t i = 0; i < t->count; i++) {
+		if(t->entries[i].connected_at != t->version || strcmp(t->entries[i].name, name) != 0) return false;
+	}
+	return true;
+}
+
+static DWORD WINAPI reader(LPVOID param) {
+	for(int i = 0; i < READS; i++) {
+		const ptable_t *t = ptable_enter();
+		if(t) {
+			// still the same after the publisher had every chance to free it
+			uint64_t version = t->version;
+			bool ok = intact(t);
+			for(int k = 0; k < 20 && ok; k++) {
+				SwitchToThread();
+				ok = t->version == version && intact(t);
+			}
+			if(!ok) InterlockedIncrement(&g_torn);
+		}
+		ptable_leave();
+	}
+	return 0;
+}
+
+static DWORD WINAPI publisher(LPVOID param) {
+	ptable_entry_t e[PORTS];
+	char name[32];
+	memset(e, 0, sizeof(e));
+	for(uint64_t v = 1; !g_stop; v++) {
+		snprintf(name, sizeof(name), "v%llu", (unsigned long long)v);
+		for(int i = 0; i < PORTS; i++) {
+			e[i].device = "\\\\.\\COM1";
+			e[i].name = name;
+			e[i].slot = "";
+			e[i].connected_at = v;
+		}
+		if(!ptable_publish(e, PORTS)) InterlockedIncrement(&g_publish_failed);
+		// tables retire as fast as readers let them, give them the chance
+		SwitchToThread();
+	}
+	return 0;
+}
+
+int main() {
+	// freed tables are handed out again right away, a reader still on one would see it change
+	if(!mem_reserve(4 * 1024 * 1024)) return 1;
+	HANDLE pub = CreateThread(NULL, 0, publisher, NULL, 0, NULL);
+	for(int r = 0; r < ROUNDS; r++) {
+		HANDLE t[THREADS];
+		for(int i = 0; i < THREADS; i++) t[i] = CreateThread(NULL, 0, reader, NULL, 0, NULL);
+		for(int i = 0; i < THREADS; i++) {
+			WaitForSingleObject(t[i], INFINITE);
+			CloseHandle(t[i]);
+		}
+	}
+	InterlockedExchange(&g_stop, 1);
+	WaitForSingleObject(pub, INFINITE);
+	CloseHandle(pub);
+
+	CHECK(g_torn == 0);
+	CHECK(g_publish_failed == 0);
+	CHECK(ptable_reader_records() <= THREADS);
+	// with every reader gone one more publish frees all but the current table
+	ptable_entry_t e;
+	memset(&e, 0, sizeof(e));
+	e.device = e.name = e.slot = "";
+	CHECK(ptable_publish(&e, 1));
+	mem_stats_t s;
+	mem_stats(MEM_SNAPSHOT, &s);
+	CHECK(s.live_objects == 1);
+
+	printf("ptable_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
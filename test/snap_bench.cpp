@@ -0,0 +1,182 @@
+// snap: time of one refresh with nothing changed, snapshots against lists
+//
+// The list side is the diff refresh_ports() did before snapshots: every
+// enumeration builds a linked list of separately allocated ports, each is
+// looked up in the history list by name and the history is walked again
+// for removals. The snapshot side fills, sorts and merges two snapshots.
+// Both get the same ports, none of them changed, so neither reports
+// anything and the time is all bookkeeping.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include "snap.h"
+
+#define ROUNDS 20
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+typedef struct lport {
+	char *device;
+	char *name;
+	char *hwid;
+	char *instance;
+	struct lport *next;
+} lport_t;
+
+typedef struct hport {
+	char *device;
+	char *name;
+	char *hwid;
+	bool connected;
+	bool seen;
+	struct hport *next;
+} hport_t;
+
+static hport_t *g_history = NULL;
+static int g_reported = 0;
+
+static void port_strings(int i, char *device, char *name, char *hwid, char *instance) {
+	snprintf(device, 32, "COM%d:", i + 1);
+	snprintf(name, 64, "USB Serial Device (COM%d)", i + 1);
+	snprintf(hwid, 64, "USB\\VID_16C0&PID_0483&REV_0100");
+	snprintf(instance, 64, "USB\\VID_16C0&PID_0483\\%08d", i);
+}
+
+static lport_t *list_enum(int ports) {
+	lport_t *list = NULL;
+	char device[32], name[64], hwid[64], instance[64];
+	for(int i = 0; i < ports; i++) {
+		port_strings(i, device, name, hwid, instance);
+		lport_t *p = (lport_t *)calloc(1, sizeof(lport_t));
+		p->device = strdup(device);
+		p->name = strdup(name);
+		p->hwid = strdup(hwid);
+		p->instance = strdup(instance);
+		p->next = list;
+		list = p;
+	}
+	return list;
+}
+
+static void list_free(lport_t *p) {
+	while(p) {
+		lport_t *next = p->next;
+		free(p->device);
+		free(p->name);
+		free(p->hwid);
+		free(p->instance);
+		free(p);
+		p = next;
+	}
+}
+
+static hport_t *find_hport(const char *device) {
+	for(hport_t *hp = g_history; hp; hp = hp->next) {
+		if(strcmp(hp->device, device) == 0) return hp;
+	}
+	return NULL;
+}
+
+static void list_refresh(int ports) {
+	lport_t *list = list_enum(ports);
+	for(hport_t *hp = g_history; hp; hp = hp->next) hp->seen = false;
+	for(lport_t *a = list; a; a = a->next) {
+		hport_t *found = find_hport(a->device);
+		if(found) {
+			found->seen = true;
+			if(strcmp(found->name, a->name) != 0 || strcmp(found->hwid, a->hwid) != 0) g_reported++;
+			continue;
+		}
+		hport_t *n = (hport_t *)calloc(1, sizeof(hport_t));
+		n->device = strdup(a->device);
+		n->name = strdup(a->name);
+		n->hwid = strdup(a->hwid);
+		n->connected = true;
+		n->seen = true;
+		n->next = g_history;
+		g_history = n;
+		g_reported++;
+	}
+	for(hport_t *hp = g_history; hp; hp = hp->next) {
+		if(hp->connected && !hp->seen) {
+			hp->connected = false;
+			g_reported++;
+		}
+	}
+	list_free(list);
+}
+
+static void history_free() {
+	while(g_history) {
+		hport_t *next = g_history->next;
+		free(g_history->device);
+		free(g_history->name);
+		free(g_history->hwid);
+		free(g_history);
+		g_history = next;
+	}
+}
+
+static void on_change(int change, snap_t *s, uint32_t pos, void *ctx) {
+	g_reported++;
+}
+
+static void snap_refresh(snap_t **prev, snap_t **cur, int ports) {
+	char device[32], name[64], hwid[64], instance[64];
+	snap_clear(*cur);
+	for(int i = 0; i < ports; i++) {
+		port_strings(i, device, name, hwid, instance);
+		snap_add(*cur, device, name, hwid, instance, "");
+	}
+	snap_sort(*cur);
+	snap_diff(*prev, *cur, on_change, NULL);
+	snap_t *t = *prev;
+	*prev = *cur;
+	*cur = t;
+}
+
+static double ms_since(LARGE_INTEGER t0) {
+	LARGE_INTEGER t1, f;
+	QueryPerformanceCounter(&t1);
+	QueryPerformanceFrequency(&f);
+	return (double)(t1.QuadPart - t0.QuadPart) * 1000.0 / (double)f.QuadPart;
+}
+
+static void bench(int ports) {
+	LARGE_INTEGER t0;
+
+	list_refresh(ports);
+	g_reported = 0;
+	QueryPerformanceCounter(&t0);
+	for(int r = 0; r < ROUNDS; r++) list_refresh(ports);
+	double list_ms = ms_since(t0) / ROUNDS;
+	CHECK(g_reported == 0);
+	history_free();
+
+	snap_t a, b;
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+	snap_t *prev = &a, *cur = &b;
+	snap_refresh(&prev, &cur, ports);
+	snap_refresh(&prev, &cur, ports);   // both buffers at full size
+	g_reported = 0;
+	QueryPerformanceCounter(&t0);
+	for(int r = 0; r < ROUNDS; r++) snap_refresh(&prev, &cur, ports);
+	double snap_ms = ms_since(t0) / ROUNDS;
+	CHECK(g_reported == 0);
+	snap_free(&a);
+	snap_free(&b);
+
+	printf("%6d ports: lists %8.3f ms, snapshots %8.3f ms per refresh\n", ports, list_ms, snap_ms);
+}
+
+int main() {
+	bench(1000);
+	bench(10000);
+	printf("snap_bench: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
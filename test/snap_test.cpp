@@ -0,0 +1,90 @@
+// snap: diff reports every removal before any connect
+//
+// A board that resets into its bootloader leaves one port and shows up
+// on another within the same enumeration. Flap detection can only merge
+// the two steps if the removal is seen first.
+
+#include <stdio.h>
+#include <string.h>
+#include "snap.h"
+
+#define PORTS 200
+
+static int g_failed = 0;
+
+#define CHECK(c) do { if(!(c)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #c); g_failed++; } } while(0)
+
+typedef struct {
+	int removed;
+	int added;
+	int changed;
+	int connect_before_removal;
+	char last_removed[32];
+} seen_t;
+
+static void on_change(int change, snap_t *s, uint32_t pos, void *ctx) {
+	seen_t *seen = (seen_t *)ctx;
+	const char *device = snap_str(s, snap_port(s, pos)->device);
+	if(change == SNAP_REMOVED) {
+		if(seen->added || seen->changed) seen->connect_before_removal++;
+		seen->removed++;
+		snprintf(seen->last_removed, sizeof(seen->last_removed), "%s", device);
+	} else if(change == SNAP_ADDED) {
+		seen->added++;
+	} else {
+		seen->changed++;
+	}
+}
+
+static void fill(snap_t *s, int from, int to, const char *name) {
+	snap_clear(s);
+	for(int i = from; i < to; i++) {
+		char device[32];
+		snprintf(device, sizeof(device), "\\\\.\\COM%d", i);
+		snap_add(s, device, name, "USB\\VID_2341&PID_0043", NULL, "");
+	}
+	snap_sort(s);
+}
+
+int main() {
+	snap_t a, b;
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+
+	// one port moves: COM5 goes, COM300 comes
+	fill(&a, 1, PORTS, "Arduino Uno");
+	for(int i = 1; i < PORTS; i++) {
+		char device[32];
+		snprintf(device, sizeof(device), "\\\\.\\COM%d", i == 5 ? 300 : i);
+		snap_add(&b, device, "Arduino Uno", "USB\\VID_2341&PID_0043", NULL, "");
+	}
+	snap_sort(&b);
+	seen_t seen;
+	memset(&seen, 0, sizeof(seen));
+	snap_diff(&a, &b, on_change, &seen);
+	CHECK(seen.removed == 1);
+	CHECK(seen.added == 1);
+	CHECK(seen.changed == 0);
+	CHECK(seen.connect_before_removal == 0);
+	CHECK(strcmp(seen.last_removed, "\\\\.\\COM5") == 0);
+
+	// many at once, every name changed and half the ports gone
+	fill(&a, 1, PORTS, "Arduino Uno");
+	fill(&b, PORTS / 2, PORTS + PORTS / 2, "Arduino Mega");
+	memset(&seen, 0, sizeof(seen));
+	snap_diff(&a, &b, on_change, &seen);
+	CHECK(seen.removed == PORTS / 2 - 1);
+	CHECK(seen.changed == PORTS / 2);
+	CHECK(seen.added == PORTS / 2);
+	CHECK(seen.connect_before_removal == 0);
+
+	// bookkeeping is cleared, the same snapshot twice differs in nothing
+	memset(&seen, 0, sizeof(seen));
+	snap_diff(&b, &b, on_change, &seen);
+	CHECK(seen.removed == 0 && seen.added == 0 && seen.changed == 0);
+
+	snap_free(&a);
+	snap_free(&b);
+	printf("snap_test: %s\n", g_failed ? "FAILED" : "ok");
+	return g_failed ? 1 : 0;
+}
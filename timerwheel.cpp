@@ -0,0 +1,116 @@
+// Hierarchical timer wheel
+//
+// See timerwheel.h
+
+#include <stddef.h>
+#include "timerwheel.h"
+
+static void slot_init(tw_node_t *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+static void slot_push(tw_node_t *head, tw_node_t *n) {
+	n->prev = head->prev;
+	n->next = head;
+	head->prev->next = n;
+	head->prev = n;
+}
+
+static void unlink_node(tw_node_t *n) {
+	n->prev->next = n->next;
+	n->next->prev = n->prev;
+	n->next = NULL;
+	n->prev = NULL;
+}
+
+// Place node in the level whose span covers its distance from now
+// nodes due before first go to the slot of tick first
+static void place(twheel_t *w, tw_node_t *n, uint64_t first) {
+	uint64_t at = n->deadline > first ? n->deadline : first;
+	uint64_t delta = at - w->now;
+	int level = 0;
+	while(level < TW_LEVELS - 1 && delta >= ((uint64_t)1 << (TW_BITS * (level + 1)))) level++;
+	if(delta >= ((uint64_t)1 << (TW_BITS * TW_LEVELS))) {
+		// beyond the wheel span, park in the farthest slot and cascade later
+		at = w->now + ((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1;
+	}
+	slot_push(&w->slots[level][(at >> (TW_BITS * level)) & TW_MASK], n);
+}
+
+void tw_init(twheel_t *w, uint64_t now) {
+	w->now = now;
+	w->count = 0;
+	for(int l = 0; l < TW_LEVELS; l++) {
+		for(int s = 0; s < TW_SLOTS; s++) slot_init(&w->slots[l][s]);
+	}
+}
+
+bool tw_pending(const tw_node_t *n) {
+	return n->next != NULL;
+}
+
+void tw_schedule(twheel_t *w, tw_node_t *n, uint64_t deadline, void *ctx) {
+	if(tw_pending(n)) {
+		unlink_node(n);
+		w->count--;
+	}
+	n->deadline = deadline;
+	n->ctx = ctx;
+	place(w, n, w->now + 1);
+	w->count++;
+}
+
+void tw_cancel(twheel_t *w, tw_node_t *n) {
+	if(!tw_pending(n)) return;
+	unlink_node(n);
+	w->count--;
+}
+
+// Move every node of a higher level slot down to where it now belongs
+static void cascade(twheel_t *w, int level) {
+	tw_node_t *head = &w->slots[level][(w->now >> (TW_BITS * level)) & TW_MASK];
+	tw_node_t list;
+	if(head->next == head) return;
+	list.next = head->next;
+	list.prev = head->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	slot_init(head);
+	while(list.next != &list) {
+		tw_node_t *n = list.next;
+		unlink_node(n);
+		place(w, n, w->now);
+	}
+}
+
+void tw_advance(twheel_t *w, uint64_t now, void (*fp_expire)(tw_node_t *n)) {
+	while(w->now < now) {
+		if(w->count == 0) {
+			w->now = now;
+			break;
+		}
+		w->now++;
+		for(int l = 1; l < TW_LEVELS; l++) {
+			if((w->now & (((uint64_t)1 << (TW_BITS * l)) - 1)) != 0) break;
+			cascade(w, l);
+		}
+		tw_node_t *head = &w->slots[0][w->now & TW_MASK];
+		while(head->next != head) {
+			tw_node_t *n = head->next;
+			unlink_node(n);
+			w->count--;
+			fp_expire(n);
+		}
+	}
+}
+
+uint64_t tw_next_tick(const twheel_t *w) {
+	if(w->count == 0) return UINT64_MAX;
+	for(uint64_t t = w->now + 1; t <= w->now + TW_SLOTS; t++) {
+		const tw_node_t *head = &w->slots[0][t & TW_MASK];
+		if(head->next != head) return t;
+	}
+	// only far timers pending, wake at the next level 1 cascade
+	return (w->now | TW_MASK) + 1;
+}
@@ -0,0 +1,52 @@
+// Hierarchical timer wheel
+//
+// Four levels of 64 slots. Level 0 resolves single ticks, each further
+// level covers 64 times the span of the one below and is cascaded down
+// as time advances. Nodes are intrusive, so scheduling never allocates.
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 4
+
+// Embed one of these in the object that should expire
+typedef struct tw_node {
+	struct tw_node *next;
+	struct tw_node *prev;
+	uint64_t deadline;
+	void *ctx;
+} tw_node_t;
+
+typedef struct {
+	uint64_t now;
+	unsigned count;
+	tw_node_t slots[TW_LEVELS][TW_SLOTS];
+} twheel_t;
+
+// initialize wheel, now is the current tick
+void tw_init(twheel_t *w, uint64_t now);
+
+// (re)schedule node to expire at deadline, ctx is handed back on expiry
+void tw_schedule(twheel_t *w, tw_node_t *n, uint64_t deadline, void *ctx);
+
+// remove node from wheel, harmless if not scheduled
+void tw_cancel(twheel_t *w, tw_node_t *n);
+
+// true if node is currently scheduled
+bool tw_pending(const tw_node_t *n);
+
+// advance wheel to tick now, calling fp_expire for each expired node
+// nodes are unlinked before fp_expire is called and may be rescheduled
+void tw_advance(twheel_t *w, uint64_t now, void (*fp_expire)(tw_node_t *n));
+
+// earliest tick at which tw_advance may have work to do
+// returns UINT64_MAX if the wheel is empty
+uint64_t tw_next_tick(const twheel_t *w);
+
+#endif
@@ -0,0 +1,204 @@
+// USB topology index
+//
+// See topo.h
+//
+// Entries live in a fixed pool, two open addressing tables of pool
+// indexes (by device, by slot) find them. Removed table cells become
+// tombstones, a table is rebuilt once a quarter of it is tombstones.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <windows.h>
+#include "topo.h"
+#include "settings.h"
+
+static const char *SLOTS = "Slots";
+
+#define TOPO_ENTRIES 256
+#define TOPO_CELLS   512          // power of two, twice the entries
+#define CELL_EMPTY   -1
+#define CELL_GONE    -2
+
+typedef struct {
+	char device[32];
+	char slot[TOPO_SLOT_MAX];
+} topo_entry_t;
+
+typedef struct {
+	char slot[TOPO_SLOT_MAX];
+	char label[96];
+} topo_label_t;
+
+typedef struct {
+	int16_t cells[TOPO_CELLS];
+	int gone;
+	bool by_slot;
+} topo_table_t;
+
+static topo_entry_t g_entries[TOPO_ENTRIES];
+static int16_t g_free[TOPO_ENTRIES];
+static int g_nfree = -1;          // -1 until first use
+static bool g_used[TOPO_ENTRIES];
+static topo_table_t g_by_device = { {0}, 0, false };
+static topo_table_t g_by_slot = { {0}, 0, true };
+static topo_label_t *g_labels = NULL;
+static int g_nlabels = 0;
+
+static void init() {
+	if(g_nfree >= 0) return;
+	for(int i = 0; i < TOPO_CELLS; i++) {
+		g_by_device.cells[i] = CELL_EMPTY;
+		g_by_slot.cells[i] = CELL_EMPTY;
+	}
+	for(int i = 0; i < TOPO_ENTRIES; i++) g_free[i] = (int16_t)(TOPO_ENTRIES - 1 - i);
+	g_nfree = TOPO_ENTRIES;
+}
+
+// FNV-1a, ignoring ASCII case
+static uint32_t hash(const char *s) {
+	uint32_t h = 2166136261u;
+	for(; *s; s++) {
+		char c = *s;
+		if(c >= 'a' && c <= 'z') c -= 'a' - 'A';
+		h = (h ^ (uint8_t)c) * 16777619u;
+	}
+	return h;
+}
+
+static const char *key_of(const topo_table_t *t, int e) {
+	return t->by_slot ? g_entries[e].slot : g_entries[e].device;
+}
+
+// cell holding key, -1 if none
+static int find_cell(const topo_table_t *t, const char *key) {
+	uint32_t i = hash(key) & (TOPO_CELLS - 1);
+	for(int n = 0; n < TOPO_CELLS; n++, i = (i + 1) & (TOPO_CELLS - 1)) {
+		int e = t->cells[i];
+		if(e == CELL_EMPTY) return -1;
+		if(e >= 0 && _stricmp(key_of(t, e), key) == 0) return (int)i;
+	}
+	return -1;
+}
+
+static void insert_cell(topo_table_t *t, int e) {
+	uint32_t i = hash(key_of(t, e)) & (TOPO_CELLS - 1);
+	while(t->cells[i] >= 0) i = (i + 1) & (TOPO_CELLS - 1);
+	if(t->cells[i] == CELL_GONE) t->gone--;
+	t->cells[i] = (int16_t)e;
+}
+
+static void rebuild(topo_table_t *t) {
+	for(int i = 0; i < TOPO_CELLS; i++) t->cells[i] = CELL_EMPTY;
+	t->gone = 0;
+	for(int e = 0; e < TOPO_ENTRIES; e++) {
+		if(g_used[e]) insert_cell(t, e);
+	}
+}
+
+static void remove_cell(topo_table_t *t, int cell) {
+	t->cells[cell] = CELL_GONE;
+	if(++t->gone > TOPO_CELLS / 4) rebuild(t);
+}
+
+// Drop entry e from both tables and the pool
+static void remove_entry(int e) {
+	int dcell = find_cell(&g_by_device, g_entries[e].device);
+	int scell = find_cell(&g_by_slot, g_entries[e].slot);
+	// unused first, so a rebuild leaves it out
+	g_used[e] = false;
+	g_free[g_nfree++] = (int16_t)e;
+	if(dcell >= 0) remove_cell(&g_by_device, dcell);
+	if(scell >= 0) remove_cell(&g_by_slot, scell);
+}
+
+// settings_values callback, ctx is the capacity of g_labels
+static void add_label(const char *name, const char *value, void *ctx) {
+	if(!value || g_nlabels >= *(int *)ctx) return;
+	topo_label_t *l = &g_labels[g_nlabels];
+	if(strlen(name) >= sizeof(l->slot) || strlen(value) >= sizeof(l->label)) return;
+	strcpy(l->slot, name);
+	strcpy(l->label, value);
+	g_nlabels++;
+}
+
+void topo_load() {
+	free(g_labels);
+	g_labels = NULL;
+	g_nlabels = 0;
+	int count = (int)settings_values(SLOTS, NULL, NULL);
+	if(!count) return;
+	g_labels = (topo_label_t *)calloc(count, sizeof(topo_label_t));
+	if(g_labels) settings_values(SLOTS, add_label, &count);
+}
+
+bool topo_slot(const char *location, char *out, size_t size) {
+	if(!location || !size) return false;
+	const char *root = strstr(location, "USBROOT(");
+	if(!root) return false;
+	// controller: the segment before USBROOT, "PCI(1400)" gives "1400"
+	char ctrl[16] = "";
+	const char *seg = root;
+	if(seg > location) {
+		seg--;
+		while(seg > location && seg[-1] != '#') seg--;
+		const char *open = strchr(seg, '(');
+		if(open && open < root) {
+			size_t n = 0;
+			for(const char *p = open + 1; *p && *p != ')' && n < sizeof(ctrl) - 1; p++) ctrl[n++] = *p;
+			ctrl[n] = '\0';
+		}
+	}
+	size_t len = (size_t)snprintf(out, size, "%s", ctrl[0] ? ctrl : "usb");
+	int ports = 0;
+	// hub port chain, composite interfaces (USBMI) end it
+	for(const char *p = strstr(root, "#USB("); p; p = strstr(p + 5, "#USB(")) {
+		int port = atoi(p + 5);
+		int n = snprintf(out + len, size > len ? size - len : 0, "%c%d", ports ? '.' : '-', port);
+		if(n < 0 || len + (size_t)n >= size) return false;
+		len += (size_t)n;
+		ports++;
+	}
+	return ports > 0;
+}
+
+void topo_set(const char *device, const char *slot) {
+	init();
+	topo_remove(device);
+	// a board still listed at this slot has gone without us noticing
+	int cell = find_cell(&g_by_slot, slot);
+	if(cell >= 0) remove_entry(g_by_slot.cells[cell]);
+	if(!g_nfree) return;
+	int e = g_free[--g_nfree];
+	g_used[e] = true;
+	snprintf(g_entries[e].device, sizeof(g_entries[e].device), "%s", device);
+	snprintf(g_entries[e].slot, sizeof(g_entries[e].slot), "%s", slot);
+	insert_cell(&g_by_device, e);
+	insert_cell(&g_by_slot, e);
+}
+
+void topo_remove(const char *device) {
+	init();
+	int cell = find_cell(&g_by_device, device);
+	if(cell >= 0) remove_entry(g_by_device.cells[cell]);
+}
+
+const char *topo_slot_of(const char *device) {
+	init();
+	int cell = find_cell(&g_by_device, device);
+	return cell >= 0 ? g_entries[g_by_device.cells[cell]].slot : NULL;
+}
+
+const char *topo_device_at(const char *slot) {
+	init();
+	int cell = find_cell(&g_by_slot, slot);
+	return cell >= 0 ? g_entries[g_by_slot.cells[cell]].device : NULL;
+}
+
+const char *topo_label(const char *slot) {
+	for(int i = 0; i < g_nlabels; i++) {
+		if(_stricmp(g_labels[i].slot, slot) == 0) return g_labels[i].label;
+	}
+	return slot;
+}
@@ -0,0 +1,48 @@
+// USB topology index
+//
+// Maps serial ports to the physical USB socket they are plugged into.
+// A slot names the host controller and the hub port chain, "1400-3.2" is
+// port 2 of the hub on port 3 of the controller at PCI 14.0, taken from
+// the location path SetupDi reports. Slots stay the same for a socket no
+// matter which board is in it, so identical boards can be told apart.
+//
+// Slots can be given names: REG_SZ values under
+// HKCU\Software\ComPortNotify\Slots (or [Slots] in cpnotify.ini), named
+// after the slot ("1400-3.2"), data is the name ("Rack A, slot 4").
+//
+// The index holds the connected ports and is updated per connect and
+// removal. Lookups both ways (port to slot, slot to port) are hash
+// probes. Event loop thread only; returned strings stay valid until the
+// next change.
+
+#ifndef TOPO_H
+#define TOPO_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define TOPO_SLOT_MAX 48
+
+// read slot names
+void topo_load();
+
+// slot of a location path ("PCIROOT(0)#PCI(1400)#USBROOT(0)#USB(3)#USB(2)")
+// false if the path is not on a USB hub port
+bool topo_slot(const char *location, char *out, size_t size);
+
+// device is now connected at slot
+void topo_set(const char *device, const char *slot);
+
+// device is gone
+void topo_remove(const char *device);
+
+// slot of a connected device, NULL if unknown
+const char *topo_slot_of(const char *device);
+
+// device connected at slot, NULL if none
+const char *topo_device_at(const char *slot);
+
+// configured name of slot, or slot itself
+const char *topo_label(const char *slot);
+
+#endif
@@ -0,0 +1,108 @@
+// Bounded worker pool
+//
+// See workpool.h
+
+#include <stdlib.h>
+#include <windows.h>
+#include "workpool.h"
+
+typedef struct {
+	void (*fn)(void *arg);
+	void *arg;
+} job_t;
+
+struct workpool {
+	SRWLOCK lock;
+	CONDITION_VARIABLE has_job;
+	CONDITION_VARIABLE idle;
+	job_t *jobs;
+	int size;
+	int head;
+	int count;
+	int busy;
+	bool stop;
+	int nthreads;
+	HANDLE *threads;
+};
+
+static DWORD WINAPI worker(LPVOID param) {
+	workpool_t *pool = (workpool_t *)param;
+	AcquireSRWLockExclusive(&pool->lock);
+	while(true) {
+		while(!pool->count && !pool->stop) SleepConditionVariableSRW(&pool->has_job, &pool->lock, INFINITE, 0);
+		if(!pool->count) break;
+		job_t job = pool->jobs[pool->head];
+		pool->head = (pool->head + 1) % pool->size;
+		pool->count--;
+		pool->busy++;
+		ReleaseSRWLockExclusive(&pool->lock);
+		job.fn(job.arg);
+		AcquireSRWLockExclusive(&pool->lock);
+		pool->busy--;
+		if(!pool->count && !pool->busy) WakeAllConditionVariable(&pool->idle);
+	}
+	ReleaseSRWLockExclusive(&pool->lock);
+	return 0;
+}
+
+workpool_t *workpool_create(int threads, int queue) {
+	workpool_t *pool = (workpool_t *)calloc(1, sizeof(workpool_t));
+	if(!pool) return NULL;
+	if(threads > MAXIMUM_WAIT_OBJECTS) threads = MAXIMUM_WAIT_OBJECTS;
+	InitializeSRWLock(&pool->lock);
+	InitializeConditionVariable(&pool->has_job);
+	InitializeConditionVariable(&pool->idle);
+	pool->size = queue;
+	pool->jobs = (job_t *)calloc(queue, sizeof(job_t));
+	pool->threads = (HANDLE *)calloc(threads, sizeof(HANDLE));
+	if(!pool->jobs || !pool->threads) {
+		free(pool->jobs);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+	for(int i = 0; i < threads; i++) {
+		HANDLE h = CreateThread(NULL, 64 * 1024, worker, pool, STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+		if(h) pool->threads[pool->nthreads++] = h;
+	}
+	if(!pool->nthreads) {
+		free(pool->jobs);
+		free(pool->threads);
+		free(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+bool workpool_submit(workpool_t *pool, void (*fn)(void *arg), void *arg) {
+	AcquireSRWLockExclusive(&pool->lock);
+	bool ok = pool->count < pool->size && !pool->stop;
+	if(ok) {
+		job_t *job = &pool->jobs[(pool->head + pool->count) % pool->size];
+		job->fn = fn;
+		job->arg = arg;
+		pool->count++;
+		WakeConditionVariable(&pool->has_job);
+	}
+	ReleaseSRWLockExclusive(&pool->lock);
+	return ok;
+}
+
+void workpool_wait(workpool_t *pool) {
+	AcquireSRWLockExclusive(&pool->lock);
+	while(pool->count || pool->busy) SleepConditionVariableSRW(&pool->idle, &pool->lock, INFINITE, 0);
+	ReleaseSRWLockExclusive(&pool->lock);
+}
+
+void workpool_destroy(workpool_t *pool) {
+	if(!pool) return;
+	AcquireSRWLockExclusive(&pool->lock);
+	pool->stop = true;
+	WakeAllConditionVariable(&pool->has_job);
+	ReleaseSRWLockExclusive(&pool->lock);
+	WaitForMultipleObjects(pool->nthreads, pool->threads, TRUE, INFINITE);
+	for(int i = 0; i < pool->nthreads; i++) CloseHandle(pool->threads[i]);
+	free(pool->threads);
+	free(pool->jobs);
+	free(pool);
+}
@@ -0,0 +1,26 @@
+// Bounded worker pool
+//
+// Fixed number of threads fed from a fixed size job queue. Submitting
+// never blocks: when the queue is full the job is refused and the caller
+// decides what to drop.
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+
+typedef struct workpool workpool_t;
+
+// create pool with threads workers and room for queue pending jobs
+workpool_t *workpool_create(int threads, int queue);
+
+// queue fn(arg), returns false if the queue is full
+bool workpool_submit(workpool_t *pool, void (*fn)(void *arg), void *arg);
+
+// wait until the queue is empty and all workers are idle
+void workpool_wait(workpool_t *pool);
+
+// finish queued jobs, stop the workers and free the pool
+void workpool_destroy(workpool_t *pool);
+
+#endif